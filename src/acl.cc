@@ -0,0 +1,153 @@
+/*
+ * Copyright (C) Internet Systems Consortium, Inc. ("ISC")
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ */
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+#include <arpa/inet.h>
+
+#include "acl.h"
+#include "util.h"
+
+//
+// adds a rule to the trie.  The rules must be added shortest first, so
+// that a new child node can inherit its parent's entry (leaf pushing)
+// and a rule's range never covers a more specific rule's child node.
+//
+void ClientACL::insert(std::vector<uint32_t>& trie, const Rule& rule)
+{
+	auto   p = rule.ipv4 ? &rule.addr[12] : rule.addr;
+	size_t node = 0;
+	size_t index = (p[0] << 8) | p[1];
+	auto   bits = rule.bits;
+	auto   stride = 16U;
+
+	for (p += 2; bits > stride; ++p) {
+		auto entry = trie[node + index];
+		if (!(entry & child)) {
+			auto offset = trie.size();
+			if (offset >= child) {
+				throw std::runtime_error("ACL too large");
+			}
+			trie.resize(offset + 256, entry);
+			trie[node + index] = child | offset;
+		}
+		node = trie[node + index] & ~child;
+		index = *p;
+		bits -= stride;
+		stride = 8;
+	}
+
+	// fill every entry covered by the remaining bits of the prefix
+	auto span = size_t(1) << (stride - bits);
+	index &= ~(span - 1);
+	std::fill(&trie[node + index], &trie[node + index] + span, rule.action);
+}
+
+void ClientACL::compile(std::vector<Rule>& rules)
+{
+	std::stable_sort(rules.begin(), rules.end(),
+			 [](const Rule& a, const Rule& b) { return a.bits < b.bits; });
+
+	for (const auto& rule : rules) {
+		insert(rule.ipv4 ? v4 : v6, rule);
+	}
+
+	list = std::move(rules);
+}
+
+std::shared_ptr<const ClientACL> ClientACL::load(const std::string& filename)
+{
+	std::ifstream file(filename);
+	if (!file) {
+		throw_errno("opening ACL file: " + filename);
+	}
+
+	std::vector<Rule> list;
+	std::string	  line;
+	unsigned	  lineno = 0;
+
+	while (std::getline(file, line)) {
+		++lineno;
+
+		auto hash = line.find('#');
+		if (hash != std::string::npos) {
+			line.erase(hash);
+		}
+
+		std::istringstream is(line);
+		std::string	   prefix, action, extra;
+		if (!(is >> prefix)) {
+			continue;
+		}
+
+		auto error = [&](const std::string& msg) {
+			return std::runtime_error(filename + " line " + std::to_string(lineno) + ": " +
+						  msg);
+		};
+
+		if (!(is >> action) || (is >> extra)) {
+			throw error("expected <prefix> <action>");
+		}
+
+		Rule rule = {};
+		if (action == "allow") {
+			rule.action = allow;
+		} else if (action == "refuse") {
+			rule.action = refuse;
+		} else if (action == "drop") {
+			rule.action = drop;
+		} else {
+			throw error("unknown action " + action);
+		}
+
+		auto slash = prefix.find('/');
+		auto addr = prefix.substr(0, slash);
+
+		unsigned max;
+		if (::inet_pton(AF_INET, addr.c_str(), &rule.addr[12]) == 1) {
+			rule.ipv4 = true;
+			max = 32;
+		} else if (::inet_pton(AF_INET6, addr.c_str(), rule.addr) == 1) {
+			max = 128;
+		} else {
+			throw error("invalid address " + addr);
+		}
+
+		rule.bits = max;
+		if (slash != std::string::npos) {
+			try {
+				size_t n = 0;
+				rule.bits = std::stoul(prefix.substr(slash + 1), &n);
+				if (n != prefix.size() - slash - 1) {
+					throw std::invalid_argument("length");
+				}
+			} catch (std::logic_error&) {
+				throw error("invalid prefix " + prefix);
+			}
+			if (rule.bits > max) {
+				throw error("invalid prefix " + prefix);
+			}
+		}
+
+		list.push_back(rule);
+	}
+
+	std::shared_ptr<ClientACL> acl(new ClientACL());
+	acl->compile(list);
+
+	return acl;
+}
+
+ClientACL::ClientACL() : v4(65536, allow), v6(65536, allow)
+{
+}
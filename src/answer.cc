@@ -7,11 +7,18 @@
  *
  */
 
+#include <algorithm>
 #include <arpa/inet.h>
+#include <cstring>
 #include <ldns/ldns.h>
+#include <memory>
+#include <new>
+#include <stdexcept>
 #include <string>
+#include <unordered_map>
 
 #include "answer.h"
+#include "arena.h"
 #include "util.h"
 
 /*
@@ -49,190 +56,424 @@
  *
  */
 
+std::atomic<size_t> Answer::variant_bytes{0};
+
 const Answer* Answer::empty = new Answer(nullptr, RRList(), RRList(), RRList(), Flags::none);
 
-void Answer::put_name_pointer(const ldns_rdf* name, uint16_t offset)
+//
+// scratch state for compiling one answer, reused by each thread for
+// every answer it compiles so that the only allocation per answer is
+// the answer itself.  Names are compressed using an open addressed
+// table of the name suffixes already written, each keyed on a hash of
+// its lower-cased wire format.  Entries are invalidated in bulk by
+// bumping the generation number rather than by clearing the table.
+//
+struct Answer::Builder {
+
+	static const size_t max_size = UINT16_MAX - sizeof(edns_opt_rr);
+	static const size_t max_rrs = max_size / 11;
+	static const size_t table_size = 1024; // must be a power of two
+
+	struct Suffix {
+		const uint8_t* name;
+		uint32_t       hash;
+		uint32_t       generation;
+		uint16_t       offset;
+	};
+
+	uint8_t	 buf[max_size];
+	size_t	 pos = 0;
+	uint16_t offsets[max_size / 2];
+	size_t	 n_offsets = 0;
+	uint16_t ends[max_rrs + 1]; // of the additional section's RRs
+
+	Suffix	 table[table_size] = {};
+	uint32_t generation = 0;
+	size_t	 entries = 0;
+
+	static Builder& get();
+	void		reset();
+
+	void need(size_t n);
+	void put(const void* p, size_t n);
+	void put8(uint8_t v);
+	void put16(uint16_t v);
+	void put32(uint32_t v);
+	void put16_at(size_t at, uint16_t v);
+
+	const Suffix* find(const uint8_t* name, uint32_t hash) const;
+	void	      insert(const uint8_t* name, uint32_t hash, uint16_t offset);
+};
+
+Answer::Builder& Answer::Builder::get()
 {
-	auto clone = ldns_rdf_clone(name);
-	auto ptr = RDFPtr(clone, ldns_rdf_deep_free);
-	c_table[ptr] = offset;
+	static thread_local std::unique_ptr<Builder> builder;
+	if (!builder) {
+		builder.reset(new Builder());
+	}
+	return *builder;
 }
 
-uint16_t Answer::get_name_pointer(const ldns_rdf* name) const
+void Answer::Builder::reset()
 {
-	auto	clone = ldns_rdf_clone(name);
-	auto	ptr = RDFPtr(clone, ldns_rdf_deep_free);
-	const auto& iter = c_table.find(ptr);
-	if (iter != c_table.end()) {
-		return iter->second;
-	} else {
-		return 0;
+	pos = 0;
+	n_offsets = 0;
+	entries = 0;
+	if (++generation == 0) {
+		// wrapped - the stale entries must really be cleared
+		for (auto& e : table) {
+			e.generation = 0;
+		}
+		generation = 1;
 	}
 }
 
-// TODO: error checking
-void Answer::dname_to_wire(ldns_buffer* lbuf, const ldns_rdf* name)
+void Answer::Builder::need(size_t n)
 {
-	// if compression is not enabled just write the data
-	if (!compressed()) {
-		ldns_buffer_write(lbuf, ldns_rdf_data(name), ldns_rdf_size(name));
-		return;
+	if (n > max_size - pos) {
+		throw std::runtime_error("answer too large");
 	}
+}
 
-	// no labels left, right final zero
-	if (ldns_dname_label_count(name) == 0) {
-		ldns_buffer_write_u8(lbuf, 0);
-		return;
+void Answer::Builder::put(const void* p, size_t n)
+{
+	need(n);
+	::memcpy(buf + pos, p, n);
+	pos += n;
+}
+
+void Answer::Builder::put8(uint8_t v)
+{
+	put(&v, sizeof v);
+}
+
+void Answer::Builder::put16(uint16_t v)
+{
+	v = htons(v);
+	put(&v, sizeof v);
+}
+
+void Answer::Builder::put32(uint32_t v)
+{
+	v = htonl(v);
+	put(&v, sizeof v);
+}
+
+void Answer::Builder::put16_at(size_t at, uint16_t v)
+{
+	v = htons(v);
+	::memcpy(buf + at, &v, sizeof v);
+}
+
+static bool same_name(const uint8_t* a, const uint8_t* b)
+{
+	auto len = ZoneData::name_length(a);
+	if (len != ZoneData::name_length(b)) {
+		return false;
+	}
+	for (size_t i = 0; i < len; ++i) {
+		if (lower(a[i]) != lower(b[i])) {
+			return false;
+		}
 	}
+	return true;
+}
+
+const Answer::Builder::Suffix* Answer::Builder::find(const uint8_t* name, uint32_t hash) const
+{
+	for (auto i = hash;; ++i) {
+		const auto& e = table[i & (table_size - 1)];
+		if (e.generation != generation) {
+			return nullptr;
+		}
+		if (e.hash == hash && same_name(e.name, name)) {
+			return &e;
+		}
+	}
+}
 
-	// look up the name in the map of name locations
-	auto cpos = get_name_pointer(name);
-	if (cpos) {
-		c_offsets.push_back(ldns_buffer_position(lbuf));
-		ldns_buffer_write_u16(lbuf, cpos | 0xc000);
+void Answer::Builder::insert(const uint8_t* name, uint32_t hash, uint16_t offset)
+{
+	// keep the table sparse - names that don't fit just aren't compressed
+	if (entries >= table_size / 2) {
 		return;
 	}
 
-	// not found - store the current position in the map, with an
-	// offset based on the assumed minimum question section size
-	uint16_t pos = ldns_buffer_position(lbuf);
-	uint16_t real_pos = pos + 12 + fix_offset;
-	if (real_pos < (16384 - 255)) { // room for question section
-		put_name_pointer(name, real_pos);
+	for (auto i = hash;; ++i) {
+		auto& e = table[i & (table_size - 1)];
+		if (e.generation != generation) {
+			e = Suffix{name, hash, generation, offset};
+			++entries;
+			return;
+		}
 	}
+}
 
-	// chop the name in two, writing the left hand label
-	// into the memory buffer
-	auto label = ldns_dname_label(name, 0);
-	auto rest = ldns_dname_left_chop(name);
-	auto size = ldns_rdf_size(label) - 1;
-	auto data = ldns_rdf_data(label);
-	ldns_buffer_write(lbuf, data, size);
-	ldns_rdf_deep_free(label);
+//
+// hash every suffix of a name, right to left, so that each label
+// is only hashed once
+//
+static size_t suffix_hashes(const uint8_t* name, const uint8_t** labels, uint32_t* hashes)
+{
+	size_t n = 0;
+	for (auto p = name; *p; p += *p + 1) {
+		labels[n++] = p;
+	}
 
-	// recursively do it all again for the trailing labels
-	dname_to_wire(lbuf, rest);
+	uint32_t h = 2166136261U;
+	for (auto i = n; i-- > 0;) {
+		auto p = labels[i];
+		for (auto j = 0U; j <= *p; ++j) {
+			h ^= lower(p[j]);
+			h *= 16777619U;
+		}
+		hashes[i] = h;
+	}
 
-	// which need to be deallocated after
-	ldns_rdf_deep_free(rest);
+	return n;
 }
 
-void Answer::rr_to_wire(ldns_buffer* lbuf, const ldns_rr* rr)
+void Answer::dname_to_wire(Builder& b, const uint8_t* name)
 {
-	dname_to_wire(lbuf, ldns_rr_owner(rr));
-	ldns_buffer_write_u16(lbuf, ldns_rr_get_type(rr));
-	ldns_buffer_write_u16(lbuf, ldns_rr_get_class(rr));
-	ldns_buffer_write_u32(lbuf, ldns_rr_ttl(rr));
+	// if compression is not enabled just write the data
+	if (!compressed()) {
+		b.put(name, ZoneData::name_length(name));
+		return;
+	}
 
-	// store a dummy RDLENGTH field and remember its position for later
-	uint16_t rdlen_pos = ldns_buffer_position(lbuf);
-	ldns_buffer_write_u16(lbuf, 0);
-
-	// output the sub RDFs that make up the individual fields within
-	// the RDATA of the RR
-	//
-	// simple check for DNAME possible here because we know that the
-	// only records with DNAME rdata that appear in the root zone are
-	// compressible NS or SOA records
-	for (auto i = 0U; i < ldns_rr_rd_count(rr); ++i) {
-		auto rdf = ldns_rr_rdf(rr, i);
-		if (ldns_rdf_get_type(rdf) == LDNS_RDF_TYPE_DNAME) {
-			dname_to_wire(lbuf, rdf);
-		} else {
-			ldns_rdf2buffer_wire(lbuf, rdf);
+	const uint8_t* labels[128];
+	uint32_t       hashes[128];
+	auto	       n = suffix_hashes(name, labels, hashes);
+
+	for (size_t i = 0; i < n; ++i) {
+		// look up the suffix among those already written
+		auto e = b.find(labels[i], hashes[i]);
+		if (e) {
+			b.need(sizeof(uint16_t));
+			b.offsets[b.n_offsets++] = b.pos;
+			b.put16(e->offset | 0xc000);
+			return;
+		}
+
+		// not found - remember the current position, with an
+		// offset based on the assumed minimum question section size
+		uint16_t real_pos = b.pos + 12 + fix_offset;
+		if (real_pos < (16384 - 255)) { // room for question section
+			b.insert(labels[i], hashes[i], real_pos);
 		}
+
+		// write the left hand label and move on to the rest
+		b.put(labels[i], *labels[i] + 1);
+	}
+
+	// no labels left, write final zero
+	b.put8(0);
+}
+
+void Answer::rr_to_wire(Builder& b, const Record& rr)
+{
+	dname_to_wire(b, rr.owner);
+	b.put16(rr.type);
+	b.put16(rr.klass);
+	b.put32(rr.ttl);
+
+	// store a dummy RDLENGTH field and remember its position for later
+	auto rdlen_pos = b.pos;
+	b.put16(0);
+
+	// only the names in NS and SOA records are compressible (RFC 3597),
+	// everything else is copied verbatim
+	if (rr.type == LDNS_RR_TYPE_NS) {
+		dname_to_wire(b, rr.rdata);
+	} else if (rr.type == LDNS_RR_TYPE_SOA) {
+		auto mname = rr.rdata;
+		auto rname = mname + ZoneData::name_length(mname);
+		auto rest = rname + ZoneData::name_length(rname);
+		dname_to_wire(b, mname);
+		dname_to_wire(b, rname);
+		b.put(rest, rr.rdata + rr.rdlen - rest);
+	} else {
+		b.put(rr.rdata, rr.rdlen);
 	}
 
 	// overwrite the dummy RDLENGTH field with the real length
-	ldns_buffer_write_u16_at(lbuf, rdlen_pos, ldns_buffer_position(lbuf) - rdlen_pos - 2);
+	b.put16_at(rdlen_pos, b.pos - rdlen_pos - 2);
 }
 
-size_t Answer::rrlist_to_wire(ldns_buffer* lbuf, const RRList& rrs)
+// optionally noting where each RR written ends
+size_t Answer::rrlist_to_wire(Builder& b, const RRList& rrs, uint16_t* ends)
 {
 	size_t n = 0;
 
-	for (const auto& rrp : rrs.list()) {
-		auto rr = rrp.get();
-		if (ldns_rr_get_type(rr) == LDNS_RR_TYPE_RRSIG) {
-			if (flags & Flags::dnssec) {
-				rr_to_wire(lbuf, rrp.get());
-				++n;
-			}
-		} else {
-			rr_to_wire(lbuf, rrp.get());
-			++n;
+	for (auto rr : rrs.list()) {
+		if (rr->type == LDNS_RR_TYPE_RRSIG && !(flags & Flags::dnssec)) {
+			continue;
+		}
+		rr_to_wire(b, *rr);
+		if (ends) {
+			ends[n] = b.pos;
 		}
+		++n;
 	}
 
 	return n;
 }
 
+void Answer::fixup(uint8_t* out, uint16_t delta) const
+{
+	// copy buffer
+	auto n = _size;
+	auto p = out;
+	auto q = buf;
+	while (n--) {
+		*p++ = *q++;
+	}
+
+	// adjust compression pointers
+	for (auto i = 0U; i < n_offsets; ++i) {
+		auto& p = *reinterpret_cast<uint16_t*>(out + offsets[i]);
+		p = htons(ntohs(p) + delta);
+	}
+}
+
+//
+// find or create the shared copy of this answer for the given pointer
+// adjustment.  Each variant's allocation starts with the adjustment it
+// was made for, followed by the answer data.  Creation is lock-free -
+// if two threads race to publish the same variant the loser just frees
+// its own copy.  Returns nullptr if all of the slots are in use for other
+// adjustments or if the global memory limit has been reached.
+//
+const uint8_t* Answer::variant(uint16_t delta) const
+{
+	auto hdr = sizeof(uint16_t);
+
+	// look for an existing variant - slots are filled in order
+	for (auto& slot : variants) {
+		auto p = slot.load(std::memory_order_acquire);
+		if (!p) break;
+		if (*reinterpret_cast<const uint16_t*>(p) == delta) {
+			return p + hdr;
+		}
+	}
+
+	// check there's room for another
+	auto n = hdr + _size;
+	if (variant_bytes.fetch_add(n, std::memory_order_relaxed) + n > variant_limit) {
+		variant_bytes.fetch_sub(n, std::memory_order_relaxed);
+		return nullptr;
+	}
+
+	auto mine = new uint8_t[n];
+	*reinterpret_cast<uint16_t*>(mine) = delta;
+	fixup(mine + hdr, delta);
+
+	// and try to publish it
+	for (auto& slot : variants) {
+		uint8_t* expected = nullptr;
+		if (slot.compare_exchange_strong(expected, mine, std::memory_order_acq_rel)) {
+			return mine + hdr;
+		}
+		if (*reinterpret_cast<const uint16_t*>(expected) == delta) {
+			delete[] mine;
+			variant_bytes.fetch_sub(n, std::memory_order_relaxed);
+			return expected + hdr;
+		}
+	}
+
+	// no free slots
+	delete[] mine;
+	variant_bytes.fetch_sub(n, std::memory_order_relaxed);
+
+	return nullptr;
+}
+
 iovec Answer::data_offset_by(uint16_t offset, uint8_t* out) const
 {
 	// compression disabled, or offset matches minimal offset,
 	// or no compression data actually found
 	// - use pre-computer answer directly
-	if (!compressed() || (offset == fix_offset) || c_offsets.size() == 0) {
+	if (!compressed() || (offset == fix_offset) || n_offsets == 0) {
 		return iovec{buf, _size};
 	}
 
 	// adjust offset to account for excess
 	offset -= fix_offset;
 
-	// copy buffer
-	auto n = _size;
-	auto p = out;
-	auto q = buf;
-	while (n--) {
-		*p++ = *q++;
+	// use the shared pre-adjusted copy if there is one
+	auto p = variant(offset);
+	if (p) {
+		return iovec{const_cast<uint8_t*>(p), _size};
 	}
 
-	// adjust compression pointers
-	for (auto n : c_offsets) {
-		auto& p = *reinterpret_cast<uint16_t*>(out + n);
-		p = htons(ntohs(p) + offset);
-	}
+	// otherwise make a private copy
+	fixup(out, offset);
 
 	return iovec{out, _size};
 }
 
-Answer::Answer(const ldns_rdf* name, const RRList& an, const RRList& ns, const RRList& ar,
-	       Flags flags)
-    : flags(flags)
+Answer::Answer()
 {
+	for (auto& slot : variants) {
+		slot.store(nullptr, std::memory_order_relaxed);
+	}
+}
+
+Answer::Answer(const uint8_t* name, const RRList& an, const RRList& ns, const RRList& ar,
+	       Flags flags, size_t required)
+    : flags(flags), _required(required)
+{
+	for (auto& slot : variants) {
+		slot.store(nullptr, std::memory_order_relaxed);
+	}
+
+	auto& b = Builder::get();
+	b.reset();
+
 	// calculate likely size of response sections and pre-fill
 	// the compression table with the TLD in the question section
 	// (nb: may get adjusted later if the real question is longer)
 
-	if (name && ldns_rdf_size(name) > 1) {
-		put_name_pointer(name, 12);
-		fix_offset = 4 + ldns_rdf_size(name);
+	auto name_len = name ? ZoneData::name_length(name) : 0;
+	if (name_len > 1) {
+		const uint8_t* labels[128];
+		uint32_t       hashes[128];
+		suffix_hashes(name, labels, hashes);
+		b.insert(name, hashes[0], 12);
+		fix_offset = 4 + name_len;
 	} else {
 		fix_offset = 5;
 	}
 
-	size_t n = 4096;
-	auto   lbuf = ldns_buffer_new(n);
+	ancount = rrlist_to_wire(b, an);
+	nscount = rrlist_to_wire(b, ns);
+	b.ends[0] = b.pos;
+	if (ar.count() > Builder::max_rrs) {
+		throw std::runtime_error("answer too large");
+	}
+	arcount = rrlist_to_wire(b, ar, b.ends + 1) + 1; // EDNS record too
 
-	ancount = rrlist_to_wire(lbuf, an);
-	nscount = rrlist_to_wire(lbuf, ns);
-	arcount = rrlist_to_wire(lbuf, ar) + 1; // EDNS record too
+	// take a copy of the buffer, shrunk to fit, with room for EDNS on
+	// the end, preceded by the compression pointer offsets and the
+	// additional RR boundaries
+	auto len = b.pos;
+	_size = len + sizeof(edns_opt_rr);
+	n_offsets = b.n_offsets;
 
-	// compression table no longer needed
-	c_table.clear();
+	auto block = new uint8_t[index_size() + _size];
+	auto p = reinterpret_cast<uint16_t*>(block);
+	std::copy(b.offsets, b.offsets + n_offsets, p);
+	std::copy(b.ends, b.ends + arcount, p + n_offsets);
+	offsets = p;
 
-	// take a copy of the buffer, shrunk to fit, with room for EDNS on the end
-	auto lbsize = ldns_buffer_position(lbuf);
-	_size = lbsize + 11;
-	buf = new uint8_t[_size];
-	::memcpy(buf, ldns_buffer_begin(lbuf), lbsize);
-	ldns_buffer_free(lbuf);
+	buf = block + index_size();
+	::memcpy(buf, b.buf, len);
 
 	// populate the EDNS OPT RR
-	auto& opt = *reinterpret_cast<edns_opt_rr*>(buf + lbsize);
+	auto& opt = *reinterpret_cast<edns_opt_rr*>(buf + len);
 	opt.name = 0; // "."
 	opt.type = htons(LDNS_RR_TYPE_OPT);
-	opt.bufsize = htons(1480);
+	opt.bufsize = htons(edns_bufsize);
 	opt.ercode = 0;
 	opt.version = 0;
 	opt.flags = htons((flags & Flags::dnssec) ? 0x8000 : 0);
@@ -241,45 +482,206 @@ Answer::Answer(const ldns_rdf* name, const RRList& an, const RRList& ns, const R
 
 Answer::~Answer()
 {
-	delete[] buf;
+	for (auto& slot : variants) {
+		auto p = slot.load(std::memory_order_relaxed);
+		if (p) {
+			variant_bytes.fetch_sub(sizeof(uint16_t) + _size, std::memory_order_relaxed);
+			delete[] p;
+		}
+	}
+
+	if (!external) {
+		delete[] reinterpret_cast<const uint8_t*>(offsets);
+	}
+}
+
+size_t Answer::packed_size(const Answer& a)
+{
+	return sizeof(Answer) + a.index_size() + a._size;
+}
+
+Answer* Answer::pack(const Answer& a, Arena& arena)
+{
+	auto mem = arena.allocate(packed_size(a), alignof(Answer));
+	auto p = new (mem) Answer();
+
+	auto offsets = reinterpret_cast<uint16_t*>(p + 1);
+	std::copy(a.offsets, a.offsets + a.n_offsets + a.arcount, offsets);
+
+	auto buf = reinterpret_cast<uint8_t*>(offsets) + a.index_size();
+	::memcpy(buf, a.buf, a._size);
+
+	p->buf = buf;
+	p->offsets = offsets;
+	p->n_offsets = a.n_offsets;
+	p->_size = a._size;
+	p->fix_offset = a.fix_offset;
+	p->flags = a.flags;
+	p->_required = a._required;
+	p->ancount = a.ancount;
+	p->nscount = a.nscount;
+	p->arcount = a.arcount;
+	p->external = true;
+
+	// carry over the variants already made, so that an answer reused
+	// across a reload doesn't have to make them again
+	auto n = sizeof(uint16_t) + a._size;
+	auto slot = p->variants;
+	for (auto& from : a.variants) {
+		auto v = from.load(std::memory_order_acquire);
+		if (!v) break;
+		if (variant_bytes.fetch_add(n, std::memory_order_relaxed) + n > variant_limit) {
+			variant_bytes.fetch_sub(n, std::memory_order_relaxed);
+			break;
+		}
+		auto copy = new uint8_t[n];
+		::memcpy(copy, v, n);
+		(slot++)->store(copy, std::memory_order_relaxed);
+	}
+
+	return p;
+}
+
+uint64_t Answer::hash() const
+{
+	uint16_t meta[] = {_size, fix_offset, flags, _required, ancount, nscount, arcount, n_offsets};
+
+	auto h = fnv1a64(meta, sizeof meta);
+	h = fnv1a64(offsets, index_size(), h);
+	return fnv1a64(buf, _size, h);
+}
+
+bool Answer::same(const Answer& a) const
+{
+	return _size == a._size && fix_offset == a.fix_offset && flags == a.flags &&
+	       _required == a._required && ancount == a.ancount && nscount == a.nscount &&
+	       arcount == a.arcount && n_offsets == a.n_offsets &&
+	       std::equal(offsets, offsets + n_offsets + arcount, a.offsets) &&
+	       (!_size || ::memcmp(buf, a.buf, _size) == 0);
+}
+
+const Answer* AnswerIndex::find(const Answer* a)
+{
+	auto& result = seen[a];
+	if (result) {
+		return result;
+	}
+
+	auto h = a->hash();
+	auto range = content.equal_range(h);
+	for (auto iter = range.first; iter != range.second; ++iter) {
+		if (iter->second->same(*a)) {
+			return result = iter->second;
+		}
+	}
+
+	content.emplace(h, a);
+	return result = a;
 }
 
 // --------------------------------------------------------------------
 
 const Answer* AnswerSet::answer(Answer::Type type, bool do_bit) const
 {
-	Answer* a = nullptr;
+	const Answer* a = nullptr;
 
 	if (do_bit) {
-		a = dnssec[type];
+		a = dnssec[type].get();
 	} else {
-		a = plain[type];
+		a = plain[type].get();
 	}
 
 	return a ? a : Answer::empty;
 }
 
-static RRList find_glue(const ldns_dnssec_rrsets* rrset, const ldns_dnssec_zone* zone)
+// whether the name is at or below the zone name
+static bool in_domain(const uint8_t* name, const uint8_t* zone)
+{
+	for (auto p = name;; p += *p + 1) {
+		if (same_name(p, zone)) {
+			return true;
+		}
+		if (*p == 0) {
+			return false;
+		}
+	}
+}
+
+//
+// the glue for the NS records, with that for servers within the zone
+// first.  RFC 9471 requires all of that in a referral, whereas other
+// ("sibling") glue may be left out if there isn't room.
+//
+static RRList find_glue(const RRList& ns, const ZoneData& zone, const uint8_t* owner,
+			size_t& required)
+{
+	RRList inside, outside;
+
+	for (auto rr : ns.list()) {
+		if (rr->type != LDNS_RR_TYPE_NS) continue;
+		auto node = zone.find(rr->rdata);
+		if (node) {
+			auto& result = in_domain(rr->rdata, owner) ? inside : outside;
+			node->rrset(LDNS_RR_TYPE_A, result);
+			node->rrset(LDNS_RR_TYPE_AAAA, result);
+		}
+	}
+
+	required = inside.count();
+	return inside + outside;
+}
+
+// adds a record's owner, type, class, TTL and RDATA to the hash
+static uint64_t hash_rr(const Record& rr, uint64_t h)
 {
-	RRList result;
+	uint32_t meta[] = {rr.type, rr.klass, rr.ttl, rr.rdlen};
 
-	// temporary const_cast for older versions of ldns
-	auto _zone = const_cast<ldns_dnssec_zone*>(zone);
+	h = fnv1a64(rr.owner, ZoneData::name_length(rr.owner), h);
+	h = fnv1a64(meta, sizeof meta, h);
+	return fnv1a64(rr.rdata, rr.rdlen, h);
+}
 
-	if (rrset) {
-		auto rrs = rrset->rrs;
-		while (rrs) {
-			auto name = ldns_rr_ns_nsdname(rrs->rr);
-			result.append(ldns_dnssec_zone_find_rrset(_zone, name, LDNS_RR_TYPE_A));
-			result.append(ldns_dnssec_zone_find_rrset(_zone, name, LDNS_RR_TYPE_AAAA));
-			rrs = rrs->next;
+// adds the RRset of the given type and its signatures to the hash
+static uint64_t hash_rrset(const ZoneNode* node, uint16_t type, uint64_t h)
+{
+	for (auto rr : node->records) {
+		if (rr->covered() == type) {
+			h = hash_rr(*rr, h);
 		}
 	}
+	return h;
+}
+
+//
+// straight from the ZoneNodes, the same records that find_glue() and
+// generate_tld_answers() would gather
+//
+AnswerSet::Sources AnswerSet::hash_sources(const ZoneNode* name, const ZoneData& zone)
+{
+	auto	 apex = zone.apex();
+	uint64_t h = fnv1a64(nullptr, 0);
+	Sources	 result;
+
+	result.delegation = hash_rrset(name, LDNS_RR_TYPE_DS, hash_rrset(name, LDNS_RR_TYPE_NS, h));
+	for (auto rr : name->records) {
+		if (rr->type != LDNS_RR_TYPE_NS) continue;
+		auto node = zone.find(rr->rdata);
+		if (node) {
+			result.delegation = hash_rrset(node, LDNS_RR_TYPE_A, result.delegation);
+			result.delegation = hash_rrset(node, LDNS_RR_TYPE_AAAA, result.delegation);
+		}
+	}
+
+	result.negative = hash_rrset(apex, LDNS_RR_TYPE_SOA, h);
+	result.negative = hash_rrset(name, LDNS_RR_TYPE_NSEC, result.negative);
+	if (name != apex) {
+		result.negative = hash_rrset(apex, LDNS_RR_TYPE_NSEC, result.negative);
+	}
 
 	return result;
 }
 
-void AnswerSet::generate_root_answers(const ldns_dnssec_zone* zone, bool compress)
+void AnswerSet::generate_root_answers(const ZoneData& zone, bool compress)
 {
 	const auto nc = Answer::Flags::nocompress;
 
@@ -288,46 +690,64 @@ void AnswerSet::generate_root_answers(const ldns_dnssec_zone* zone, bool compres
 		flags |= nc;
 	}
 
-	auto name = zone->soa;
-	auto owner = ldns_dnssec_name_name(name);
+	auto name = zone.apex();
+	auto owner = name->name;
 
 	RRList empty;
-	RRList soa(ldns_dnssec_name_find_rrset(name, LDNS_RR_TYPE_SOA));
-	RRList ns(ldns_dnssec_name_find_rrset(name, LDNS_RR_TYPE_NS));
-	RRList dnskey(ldns_dnssec_name_find_rrset(name, LDNS_RR_TYPE_DNSKEY));
+	RRList soa = name->rrset(LDNS_RR_TYPE_SOA);
+	RRList ns = name->rrset(LDNS_RR_TYPE_NS);
+	RRList dnskey = name->rrset(LDNS_RR_TYPE_DNSKEY);
+	RRList nsec = name->rrset(LDNS_RR_TYPE_NSEC);
 
-	RRList nsec;
-	nsec.append(name->nsec);
-	nsec.append(name->nsec_signatures);
-
-	auto   ns_rrl = ldns_dnssec_name_find_rrset(name, LDNS_RR_TYPE_NS);
-	RRList glue = find_glue(ns_rrl, zone);
+	// none of it required, as these aren't referrals
+	size_t required;
+	RRList glue = find_glue(ns, zone, owner, required);
 
 	// unsigned authoritative answers
-	plain[Answer::Type::root_soa] = new Answer(owner, soa, ns, glue, flags);
-	plain[Answer::Type::root_ns] = new Answer(owner, ns, empty, glue, flags);
-	plain[Answer::Type::root_dnskey] = new Answer(owner, dnskey, empty, empty, flags);
-	plain[Answer::Type::root_nsec] = new Answer(owner, nsec, ns, glue, flags);
-	plain[Answer::Type::root_nodata] = new Answer(owner, empty, soa, empty, flags);
+	plain[Answer::Type::root_soa] = std::make_shared<Answer>(owner, soa, ns, glue, flags);
+	plain[Answer::Type::root_ns] = std::make_shared<Answer>(owner, ns, empty, glue, flags);
+	plain[Answer::Type::root_dnskey] =
+	    std::make_shared<Answer>(owner, dnskey, empty, empty, flags);
+	plain[Answer::Type::root_nsec] = std::make_shared<Answer>(owner, nsec, ns, glue, flags);
+	plain[Answer::Type::root_nodata] =
+	    std::make_shared<Answer>(owner, empty, soa, empty, flags);
 
 	// signed authoritative answers
 	flags |= Answer::Flags::dnssec;
-	dnssec[Answer::Type::root_soa] = new Answer(owner, soa, ns, glue, flags);
-	dnssec[Answer::Type::root_ns] = new Answer(owner, ns, empty, glue, flags);
-	dnssec[Answer::Type::root_dnskey] = new Answer(owner, dnskey, empty, empty, flags);
-	dnssec[Answer::Type::root_nsec] = new Answer(owner, nsec, ns, glue, flags);
+	dnssec[Answer::Type::root_soa] = std::make_shared<Answer>(owner, soa, ns, glue, flags);
+	dnssec[Answer::Type::root_ns] = std::make_shared<Answer>(owner, ns, empty, glue, flags);
+	dnssec[Answer::Type::root_dnskey] =
+	    std::make_shared<Answer>(owner, dnskey, empty, empty, flags);
+	dnssec[Answer::Type::root_nsec] = std::make_shared<Answer>(owner, nsec, ns, glue, flags);
 	dnssec[Answer::Type::root_nodata] =
-	    new Answer(owner, empty, soa, empty, flags | nc); // not compressed
+	    std::make_shared<Answer>(owner, empty, soa, empty, flags | nc); // not compressed
 
 	// query for '. ANY' always contains NS, NSEC, DNSKEY, RRSIGs etc
 	plain[Answer::Type::root_any] =
-	    new Answer(owner, soa + ns + nsec + dnskey, empty, glue, flags);
+	    std::make_shared<Answer>(owner, soa + ns + nsec + dnskey, empty, glue, flags);
 	dnssec[Answer::Type::root_any] =
-	    new Answer(owner, soa + ns + nsec + dnskey, empty, glue, flags);
+	    std::make_shared<Answer>(owner, soa + ns + nsec + dnskey, empty, glue, flags);
 }
 
-void AnswerSet::generate_tld_answers(const ldns_dnssec_name* name, const ldns_dnssec_zone* zone,
-				     bool compress)
+//
+// take both the signed and unsigned answer of the given type from the
+// previous version of this set if the data they depend on is unchanged
+//
+bool AnswerSet::reuse(Answer::Type type, bool same, const AnswerSet* previous)
+{
+	if (!same) {
+		return false;
+	}
+
+	plain[type] = previous->plain[type];
+	dnssec[type] = previous->dnssec[type];
+	_reused += 2;
+
+	return true;
+}
+
+void AnswerSet::generate_tld_answers(const ZoneNode* name, const ZoneData& zone, bool compress,
+				     const AnswerSet* previous)
 {
 	const auto nc = Answer::Flags::nocompress;
 	const auto auth = Answer::Flags::auth;
@@ -337,84 +757,234 @@ void AnswerSet::generate_tld_answers(const ldns_dnssec_name* name, const ldns_dn
 		flags |= nc;
 	}
 
-	// temporary const_cast for older versions of ldns
-	auto _name = const_cast<ldns_dnssec_name*>(name);
+	auto owner = name->name;
+	auto apex = zone.apex();
 
-	auto owner = ldns_dnssec_name_name(_name);
+	// find out which answers are unchanged since the last load, and
+	// only gather the records for those that aren't
+	bool same_delegation = previous && (previous->src.delegation == src.delegation);
+	bool same_negative = same_delegation && (previous->src.negative == src.negative);
 
 	RRList empty;
-	RRList soa(ldns_dnssec_name_find_rrset(zone->soa, LDNS_RR_TYPE_SOA));
-	RRList ns(ldns_dnssec_name_find_rrset(_name, LDNS_RR_TYPE_NS));
-	RRList ds(ldns_dnssec_name_find_rrset(_name, LDNS_RR_TYPE_DS));
+	RRList ns, ds, glue;
+	size_t required = 0;
+	if (!same_delegation) {
+		ns = name->rrset(LDNS_RR_TYPE_NS);
+		ds = name->rrset(LDNS_RR_TYPE_DS);
+		glue = find_glue(ns, zone, owner, required);
+	}
 
-	// fill out glue
-	auto   ns_rrl = ldns_dnssec_name_find_rrset(_name, LDNS_RR_TYPE_NS);
-	RRList glue = find_glue(ns_rrl, zone);
+	RRList soa, signed_soa, signed_nxd;
+	if (!same_negative) {
+		soa = apex->rrset(LDNS_RR_TYPE_SOA);
 
-	// create unsigned answers
-	if (ds.count()) {
-		plain[Answer::Type::tld_ds] = new Answer(owner, ds, empty, empty, flags | auth);
-	} else {
-		plain[Answer::Type::tld_ds] = new Answer(owner, empty, soa, empty, flags | auth);
-	}
-	plain[Answer::Type::tld_referral] = new Answer(owner, empty, ns, glue, flags);
-	plain[Answer::Type::nxdomain] =
-	    new Answer(owner, empty, soa, empty, flags | auth | nc); // not compressed
+		// signed SOA in NXD requires NSEC records
+		signed_soa = soa;
+		name->rrset(LDNS_RR_TYPE_NSEC, signed_soa);
 
-	// create signed answers
-	flags |= Answer::Flags::dnssec;
+		// NXD also requires NSEC covering wildcard label
+		signed_nxd = signed_soa;
+		if (name != apex) {
+			apex->rrset(LDNS_RR_TYPE_NSEC, signed_nxd);
+		}
+	}
 
-	// signed SOA in NXD requires NSEC records
-	RRList signed_soa = soa;
-	signed_soa.append(name->nsec);
-	signed_soa.append(name->nsec_signatures);
+	// DS, or NODATA if there isn't one
+	bool has_ds = name->has(LDNS_RR_TYPE_DS);
+	if (!reuse(Answer::Type::tld_ds, has_ds ? same_delegation : same_negative, previous)) {
+		if (has_ds) {
+			plain[Answer::Type::tld_ds] =
+			    std::make_shared<Answer>(owner, ds, empty, empty, flags | auth);
+			dnssec[Answer::Type::tld_ds] = std::make_shared<Answer>(
+			    owner, ds, empty, empty, flags | auth | Answer::Flags::dnssec);
+		} else {
+			plain[Answer::Type::tld_ds] =
+			    std::make_shared<Answer>(owner, empty, soa, empty, flags | auth);
+			dnssec[Answer::Type::tld_ds] = std::make_shared<Answer>(
+			    owner, empty, signed_soa, empty, flags | auth | Answer::Flags::dnssec);
+		}
+	}
 
-	// signed referral requires signed DS record
-	if (ds.count()) {
-		dnssec[Answer::Type::tld_ds] = new Answer(owner, ds, empty, empty, flags | auth);
-	} else {
-		dnssec[Answer::Type::tld_ds] =
-		    new Answer(owner, empty, signed_soa, empty, flags | auth);
+	// referral - signed referral requires signed DS record
+	if (!reuse(Answer::Type::tld_referral, same_delegation, previous)) {
+		plain[Answer::Type::tld_referral] =
+		    std::make_shared<Answer>(owner, empty, ns, glue, flags, required);
+		dnssec[Answer::Type::tld_referral] = std::make_shared<Answer>(
+		    owner, empty, ns + ds, glue, flags | Answer::Flags::dnssec, required);
 	}
-	dnssec[Answer::Type::tld_referral] = new Answer(owner, empty, ns + ds, glue, flags);
 
-	// NXD also requires NSEC covering wildcard label
-	if (ldns_dname_compare(owner, zone->soa->name) != 0) {
-		signed_soa.append(zone->soa->nsec);
-		signed_soa.append(zone->soa->nsec_signatures);
+	// NXDOMAIN (not compressed)
+	if (!reuse(Answer::Type::nxdomain, same_negative, previous)) {
+		plain[Answer::Type::nxdomain] =
+		    std::make_shared<Answer>(owner, empty, soa, empty, flags | auth | nc);
+		dnssec[Answer::Type::nxdomain] = std::make_shared<Answer>(
+		    owner, empty, signed_nxd, empty, flags | auth | nc | Answer::Flags::dnssec);
 	}
+}
 
-	dnssec[Answer::Type::nxdomain] =
-	    new Answer(owner, empty, signed_soa, empty, flags | auth | nc); // not compressed
+AnswerSet::AnswerSet(const ZoneNode* name, const ZoneData& zone, bool compressed,
+		     const AnswerSet* previous, const Sources* sources)
+    : src(sources ? *sources : hash_sources(name, zone))
+{
+	if (name == zone.apex()) {
+		generate_root_answers(zone, compressed);
+	}
+	generate_tld_answers(name, zone, compressed, previous);
 }
 
-AnswerSet::AnswerSet(const ldns_dnssec_name* name, const ldns_dnssec_zone* zone, bool compressed)
+size_t AnswerSet::count() const
 {
-	plain = new Answer*[Answer::Type::max];
-	dnssec = new Answer*[Answer::Type::max];
+	size_t n = 0;
+	for (auto t = 0U; t < Answer::Type::max; ++t) {
+		n += bool(plain[t]) + bool(dnssec[t]);
+	}
+	return n;
+}
+
+namespace {
 
-	for (auto i = 0U; i < Answer::Type::max; ++i) {
-		plain[i] = nullptr;
-		dnssec[i] = nullptr;
+// the arena and the answers constructed within it
+struct PackedAnswers {
+	Arena		     arena;
+	std::vector<Answer*> answers;
+
+	PackedAnswers(size_t size, bool hugepages, bool lock, int node)
+	    : arena(size, hugepages, lock, node)
+	{
 	}
 
-	if (name == zone->soa) {
-		generate_root_answers(zone, compressed);
+	~PackedAnswers()
+	{
+		for (auto a : answers) {
+			a->~Answer();
+		}
 	}
-	generate_tld_answers(name, zone, compressed);
+};
+
+} // namespace
+
+void AnswerSet::Stats::add(Answer::Type type, const Answer& a)
+{
+	++answers;
+	full[type] += a.length(a.arcount - 1);
+	minimal[type] += a.length(a.required());
 }
 
-AnswerSet::~AnswerSet()
+AnswerSet::Arenas AnswerSet::pack(std::vector<std::shared_ptr<const AnswerSet>>& sets,
+				  bool hugepages, bool lock, int node, Stats* stats,
+				  const Arenas& previous)
 {
-	for (int i = 0U; i < Answer::Type::max; ++i) {
-		if (plain[i]) {
-			delete plain[i];
+	// the distinct answers in first use order, each with the index of
+	// the previous arena it is in, or -1, and how much of each of
+	// those arenas they use
+	std::vector<std::pair<const Answer*, int>> distinct;
+	std::unordered_map<const Answer*, int>	   where;
+	std::vector<size_t>			   live(previous.size());
+	Stats					   counts;
+
+	for (const auto& set : sets) {
+		for (auto t = 0U; t < Answer::Type::max; ++t) {
+			for (auto a : {set->plain[t].get(), set->dnssec[t].get()}) {
+				if (!a) {
+					continue;
+				}
+				counts.add(Answer::Type(t), *a);
+				if (where.count(a)) {
+					continue;
+				}
+				int i = previous.size() - 1;
+				while (i >= 0 && !previous[i]->contains(a)) {
+					--i;
+				}
+				where.emplace(a, i);
+				distinct.emplace_back(a, i);
+				if (i >= 0) {
+					live[i] += Answer::packed_size(*a) + alignof(Answer);
+				}
+			}
+		}
+	}
+
+	// an arena that is mostly unused is emptied, so that it can go
+	std::vector<bool> keep(previous.size());
+	for (size_t i = 0; i < previous.size(); ++i) {
+		keep[i] = live[i] && live[i] * 2 >= previous[i]->allocated();
+	}
+
+	// find out how much space is required for the distinct new answers
+	AnswerIndex					 index;
+	std::unordered_map<const Answer*, const Answer*> packed;
+	size_t						 size = 0;
+
+	for (const auto& d : distinct) {
+		if (d.second >= 0 && keep[d.second]) {
+			counts.bytes += d.first->_size;
+			++counts.unique;
+			continue;
+		}
+		auto c = index.find(d.first);
+		if (packed.emplace(c, nullptr).second) {
+			size += Answer::packed_size(*c) + alignof(Answer);
+			counts.bytes += c->_size;
+			++counts.unique;
+		}
+	}
+
+	if (stats) {
+		*stats = counts;
+	}
+
+	Arenas			       result;
+	std::shared_ptr<PackedAnswers> holder;
+	if (!packed.empty()) {
+		holder = std::make_shared<PackedAnswers>(size, hugepages, lock, node);
+		holder->answers.reserve(packed.size());
+		result.emplace_back(holder, &holder->arena);
+	}
+	for (size_t i = 0; i < previous.size(); ++i) {
+		if (keep[i]) {
+			result.push_back(previous[i]);
+		}
+	}
+
+	// the new answers share ownership of the whole new arena
+	auto get = [&](const PAnswer& a) -> PAnswer {
+		if (!a) {
+			return nullptr;
 		}
-		if (dnssec[i]) {
-			delete dnssec[i];
+		auto i = where[a.get()];
+		if (i >= 0 && keep[i]) {
+			return a;
 		}
+		auto& p = packed[index.find(a.get())];
+		if (!p) {
+			auto copy = Answer::pack(*a, holder->arena);
+			holder->answers.push_back(copy);
+			p = copy;
+		}
+		return PAnswer(holder, p);
+	};
+
+	// a set whose answers all stay where they are is left as it is
+	for (auto& set : sets) {
+		PAnswer p[Answer::Type::max], d[Answer::Type::max];
+		bool	moved = false;
+		for (auto t = 0U; t < Answer::Type::max; ++t) {
+			p[t] = get(set->plain[t]);
+			d[t] = get(set->dnssec[t]);
+			moved |= (p[t] != set->plain[t]) || (d[t] != set->dnssec[t]);
+		}
+		if (!moved) {
+			continue;
+		}
+
+		auto copy = std::make_shared<AnswerSet>(*set);
+		for (auto t = 0U; t < Answer::Type::max; ++t) {
+			copy->plain[t] = std::move(p[t]);
+			copy->dnssec[t] = std::move(d[t]);
+		}
+		set = copy;
 	}
 
-	delete[] dnssec;
-	delete[] plain;
+	return result;
 }
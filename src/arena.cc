@@ -0,0 +1,89 @@
+/*
+ * Copyright (C) Internet Systems Consortium, Inc. ("ISC")
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ */
+
+#include <stdexcept>
+
+#include <sys/mman.h>
+#include <syslog.h>
+#include <unistd.h>
+
+#include "arena.h"
+#include "numa.h"
+#include "util.h"
+
+static const size_t huge_page_size = 2 * 1024 * 1024;
+
+static size_t round_up(size_t n, size_t unit)
+{
+	return (n + unit - 1) & ~(unit - 1);
+}
+
+void* Arena::allocate(size_t n, size_t align)
+{
+	auto offset = round_up(used, align);
+	if (offset > _size || n > _size - offset) {
+		throw std::runtime_error("arena exhausted");
+	}
+
+	used = offset + n;
+	return base + offset;
+}
+
+Arena::Arena(size_t size, bool hugepages, bool lock, int node)
+{
+	void* p = MAP_FAILED;
+
+	if (hugepages) {
+		_size = round_up(size ? size : 1, huge_page_size);
+		p = ::mmap(nullptr, _size, PROT_READ | PROT_WRITE,
+			   MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		_huge = (p != MAP_FAILED);
+	}
+
+	if (p == MAP_FAILED) {
+		_size = round_up(size ? size : 1, ::getpagesize());
+		p = ::mmap(nullptr, _size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1,
+			   0);
+		if (p == MAP_FAILED) {
+			throw_errno("mmap arena");
+		}
+#ifdef MADV_HUGEPAGE
+		// no reserved huge pages, so ask for transparent ones instead
+		if (hugepages) {
+			(void)::madvise(p, _size, MADV_HUGEPAGE);
+		}
+#endif
+	}
+
+	base = reinterpret_cast<uint8_t*>(p);
+
+	// the memory policy must be set before the pages are touched
+	if (node >= 0 && !numa_bind_range(base, _size, node)) {
+		syslog(LOG_WARNING, "could not bind arena to NUMA node %d: %m", node);
+	}
+
+	// prefault every page now rather than on first use
+	auto page = _huge ? huge_page_size : ::getpagesize();
+	for (size_t i = 0; i < _size; i += page) {
+		base[i] = 0;
+	}
+
+	if (lock) {
+		if (::mlock(base, _size) == 0) {
+			_locked = true;
+		} else {
+			syslog(LOG_WARNING, "could not lock %zu byte arena into memory: %m", _size);
+		}
+	}
+}
+
+Arena::~Arena()
+{
+	::munmap(base, _size);
+}
@@ -0,0 +1,58 @@
+/*
+ * Copyright (C) Internet Systems Consortium, Inc. ("ISC")
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ */
+
+#include <cstring>
+
+#include "cache.h"
+
+// FNV-1a, which is plenty good enough for short keys like these
+uint32_t ResponseCache::hash(const uint8_t* key, size_t len)
+{
+	uint32_t h = 2166136261U;
+	while (len--) {
+		h ^= *key++;
+		h *= 16777619U;
+	}
+	return h;
+}
+
+const ResponseCache::Entry* ResponseCache::find(const uint8_t* key, size_t len, uint32_t hash,
+						uint64_t generation, uint16_t bufsize)
+{
+	const auto& e = entries[hash & mask];
+
+	bool found = (e.generation == generation) && (e.hash == hash) && (e.key.size() == len) &&
+		     (::memcmp(e.key.data(), key, len) == 0) && e.fits(bufsize);
+
+	if (found) {
+		_hits.store(_hits.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+		return &e;
+	} else {
+		_misses.store(_misses.load(std::memory_order_relaxed) + 1,
+			      std::memory_order_relaxed);
+		return nullptr;
+	}
+}
+
+ResponseCache::Entry& ResponseCache::slot(uint32_t hash)
+{
+	return entries[hash & mask];
+}
+
+ResponseCache::ResponseCache(size_t size)
+{
+	// round up to a power of two
+	size_t n = 1;
+	while (n < size) {
+		n <<= 1;
+	}
+
+	entries.resize(n);
+	mask = n - 1;
+}
@@ -0,0 +1,74 @@
+/*
+ * Copyright (C) Internet Systems Consortium, Inc. ("ISC")
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ */
+
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+#include <thread>
+
+#include <unistd.h> // for getopt
+
+#include "zone.h"
+
+void usage(int result = EXIT_FAILURE)
+{
+	using namespace std;
+
+	cout << "froot-compile -f <zonefile> -o <imagefile> [-B <threads>] [-C] [-V]" << endl;
+	cout << "  -f the zone file to compile" << endl;
+	cout << "  -o the image file to write" << endl;
+	cout << "  -B the number of threads used to build the zone (default: min(4, ncpus))"
+	     << endl;
+	cout << "  -C disable name compression" << endl;
+	cout << "  -V verify the zone's ZONEMD digest and signatures first" << endl;
+
+	exit(result);
+}
+
+int app(int argc, char* argv[])
+{
+	const char* zfname = nullptr;
+	const char* outname = nullptr;
+	ZoneOptions options;
+
+	options.threads = std::min(4U, std::max(1U, std::thread::hardware_concurrency()));
+
+	int opt;
+	while ((opt = getopt(argc, argv, "f:o:B:CVh")) != -1) {
+		switch (opt) {
+		case 'f': zfname = optarg; break;
+		case 'o': outname = optarg; break;
+		case 'B': options.threads = atoi(optarg); break;
+		case 'C': options.compress = false; break;
+		case 'V': options.verify = true; break;
+		case 'h': usage(EXIT_SUCCESS);
+		default: usage();
+		}
+	}
+
+	if (optind < argc || !zfname || !outname) {
+		usage();
+	}
+
+	Zone zone;
+	zone.load(zfname, options, false);
+	zone.save(outname);
+
+	return EXIT_SUCCESS;
+}
+
+int main(int argc, char* argv[])
+{
+	try {
+		return app(argc, argv);
+	} catch (std::exception& e) {
+		std::cerr << "error: " << e.what() << std::endl;
+		return EXIT_FAILURE;
+	}
+}
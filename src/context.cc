@@ -7,6 +7,7 @@
  *
  */
 
+#include <algorithm>
 #include <arpa/inet.h>
 #include <cstring>
 #include <string>
@@ -24,6 +25,8 @@ struct dnshdr {
 	uint16_t arcount;
 };
 
+static const uint16_t edns_cookie = 10; // option code
+
 static bool valid_header(const dnshdr& h)
 {
 	// RCODE == 0
@@ -143,8 +146,15 @@ void Context::parse_edns(ReadBuffer& in)
 		return;
 	}
 
-	// skip the EDNS options
-	(void)in.read<uint8_t>(rdlen);
+	// skip the EDNS options, unless looking for a cookie
+	if (rdlen && cookies && peer) {
+		parse_options(ReadBuffer{in.read<uint8_t>(rdlen), rdlen});
+		if (rcode != LDNS_RCODE_NOERROR) {
+			return;
+		}
+	} else {
+		(void)in.read<uint8_t>(rdlen);
+	}
 
 	// we got a valid EDNS opt RR, so we need to return one
 	has_edns = true;
@@ -156,6 +166,39 @@ void Context::parse_edns(ReadBuffer& in)
 	}
 }
 
+// finds any COOKIE option (RFC 7873), ignoring the rest
+void Context::parse_options(ReadBuffer in)
+{
+	while (in.available() >= 4) {
+		auto code = ntohs(in.read<uint16_t>());
+		auto len = ntohs(in.read<uint16_t>());
+		if (in.available() < len) {
+			break;
+		}
+
+		auto data = len ? in.read<uint8_t>(len) : nullptr;
+		if (code != edns_cookie) {
+			continue;
+		}
+
+		// a client cookie, alone or with an 8 to 32 byte server cookie
+		if (len != CookieSecret::client_size &&
+		    (len < CookieSecret::client_size + 8 || len > CookieSecret::client_size + 32)) {
+			rcode = LDNS_RCODE_FORMERR;
+			cookie = nullptr;
+			return;
+		}
+		cookie = data;
+		cookie_len = len;
+	}
+
+	// a truncated option
+	if (in.available() > 0) {
+		rcode = LDNS_RCODE_FORMERR;
+		cookie = nullptr;
+	}
+}
+
 void Context::parse_question(ReadBuffer& in)
 {
 	qdstart = in.position();
@@ -218,8 +261,10 @@ const Answer* Context::perform_lookup()
 {
 	auto* set = zone.lookup(qname, match);
 	if (set) {
+		auto t = type();
 		rcode = match ? LDNS_RCODE_NOERROR : LDNS_RCODE_NXDOMAIN;
-		return set->answer(type(), do_bit);
+		identity = (reinterpret_cast<uintptr_t>(set) << 5) | t;
+		return set->answer(t, do_bit);
 	} else {
 		rcode = LDNS_RCODE_SERVFAIL;
 		return Answer::empty;
@@ -228,21 +273,56 @@ const Answer* Context::perform_lookup()
 
 void Context::build_response(ReadBuffer& in, const Answer* answer, std::vector<iovec>& out)
 {
-	// calculate the total length of the response packet (needed for TCP or truncation)
-	size_t total_len = sizeof(dnshdr) + qdsize + answer->size();
-	if (!has_edns) {
-		total_len -= sizeof(edns_opt_rr);
+	// the length of everything but the answer's records, plus any
+	// cookie, which is added to every response, even a truncated one
+	bool   with_cookie = has_edns && cookie;
+	size_t extra = with_cookie ? CookieSecret::option_size : 0;
+	size_t fixed = sizeof(dnshdr) + qdsize + (has_edns ? sizeof(edns_opt_rr) : 0);
+
+	// calculate the total length of the response packet (needed for TCP or truncation),
+	// a minimal response having only the additional RRs that are required
+	uint16_t kept = minimal ? answer->required() : answer->arcount - 1; // bar the OPT RR
+	size_t	 total_len = fixed + answer->length(kept);
+
+	// the buffer sizes that get the same response, as cached without
+	// the cookie, so in terms of the room left for everything else,
+	// which is no more than the payload limit allows
+	size_t room = std::min(bufsize, udp.payload) - extra;
+	min_bufsize = total_len;
+	max_bufsize = UINT16_MAX;
+
+	// handle truncation by dropping optional additional RRs from the
+	// end, setting TC only if even the required ones don't fit
+	bool tc_bit = false;
+	if (!tcp && total_len > room) {
+		while (kept > answer->required() && fixed + answer->length(kept) > room) {
+			--kept;
+		}
+		if (fixed + answer->length(kept) <= room) {
+			total_len = fixed + answer->length(kept);
+			min_bufsize = total_len;
+			max_bufsize = fixed + answer->length(kept + 1) - 1;
+		} else {
+			tc_bit = true;
+			min_bufsize = 0;
+			max_bufsize = fixed + answer->length(answer->required()) - 1;
+		}
 	}
 
-	// handle truncation
-	bool tc_bit = !tcp && (total_len > bufsize);
+	// or a response "slipped" by rate limiting
+	if (!tcp && limit == RateLimiter::slip) {
+		tc_bit = true;
+	} else {
+		clamped = bufsize - extra > max_bufsize;
+	}
 	if (tc_bit) {
 		answer = Answer::empty; // NB: initially includes OPT RR
+		kept = 0;
 	}
 
 	// output the framing header for TCP
 	if (tcp) {
-		(void)head.write<uint16_t>(htons(total_len));
+		(void)head.write<uint16_t>(htons(total_len + extra));
 	}
 
 	// craft response header
@@ -265,36 +345,341 @@ void Context::build_response(ReadBuffer& in, const Answer* answer, std::vector<i
 	tx_hdr.qdcount = htons(qdsize ? 1 : 0);
 	tx_hdr.ancount = htons(answer->ancount);
 	tx_hdr.nscount = htons(answer->nscount);
-	tx_hdr.arcount = htons(answer->arcount);
+	tx_hdr.arcount = htons(kept + has_edns);
 
 	// copy question section and save
 	::memcpy(head.reserve<uint8_t>(qdsize), &in[qdstart], qdsize);
 	out.push_back(head);
 
-	// get the data buffer for the answer
+	// get the data buffer for the answer, and its OPT RR
 	iovec payload =
 	    (answer == Answer::empty) ? *answer : answer->data_offset_by(qdsize, _an_buf);
+	auto* p = reinterpret_cast<uint8_t*>(payload.iov_base) + payload.iov_len -
+		  sizeof(edns_opt_rr);
+	auto& edns = *reinterpret_cast<edns_opt_rr*>(p);
+
+	// just the records kept
+	payload.iov_len = answer->length(kept);
+	out.push_back(payload);
+
+	if (with_cookie || (has_edns && edns.bufsize != htons(udp.advertise))) {
+		// the OPT RR is replaced by a copy with the option added, or
+		// with another buffer size
+		out.push_back(response_opt(edns));
+	} else if (has_edns) {
+		// Fixup the extended rcode, only writing if necessary since
+		// the answer may be shared or in read-only memory
+		if (edns.ercode != (rcode >> 4)) {
+			edns.ercode = (rcode >> 4);
+		}
+
+		// which usually still follows the records kept
+		if (kept == answer->arcount - 1) {
+			out.back().iov_len += sizeof(edns_opt_rr);
+		} else {
+			out.push_back(iovec{p, sizeof(edns_opt_rr)});
+		}
+	}
+}
+
+//
+// a copy of the response's OPT RR with the advertised buffer size and,
+// if the client sent one, the COOKIE option following: the client
+// cookie, and either the server cookie it sent back if that's still
+// fresh, or else a new one
+//
+iovec Context::response_opt(const edns_opt_rr& opt)
+{
+	WriteBuffer buf{_opt_buf, sizeof _opt_buf};
+
+	auto& rr = buf.write(opt);
+	rr.bufsize = htons(udp.advertise);
+	rr.ercode = (rcode >> 4);
+	if (!cookie) {
+		return buf;
+	}
+	rr.rdlen = htons(CookieSecret::option_size);
 
-	if (has_edns) {
-		// Fixup the extended rcode
-		auto* p = reinterpret_cast<uint8_t*>(payload.iov_base) + payload.iov_len -
-			  sizeof(edns_opt_rr);
-		auto& edns = *reinterpret_cast<edns_opt_rr*>(p);
-		edns.ercode = (rcode >> 4);
+	(void)buf.write<uint16_t>(htons(edns_cookie));
+	(void)buf.write<uint16_t>(htons(CookieSecret::client_size + CookieSecret::server_size));
+	auto* p = buf.reserve<uint8_t>(CookieSecret::client_size);
+	::memcpy(p, cookie, CookieSecret::client_size);
+
+	auto server = buf.reserve<uint8_t>(CookieSecret::server_size);
+	if (cookie_check == CookieSecret::fresh) {
+		::memcpy(server, cookie + CookieSecret::client_size, CookieSecret::server_size);
 	} else {
-		// remove the OPT RR from the payload and ARCOUNT
-		payload.iov_len -= sizeof(edns_opt_rr);
-		tx_hdr.arcount = htons(ntohs(tx_hdr.arcount) - 1);
+		cookies->make(cookie, *peer, cookie_time, server);
 	}
 
-	out.push_back(payload);
+	return buf;
+}
+
+// checks the server cookie, if any, just once per query
+void Context::check_cookie()
+{
+	if (cookie && cookie_check == CookieSecret::missing) {
+		cookie_time = CookieSecret::now();
+		cookie_check = cookies->check(cookie, cookie + CookieSecret::client_size,
+					      cookie_len - CookieSecret::client_size, *peer,
+					      cookie_time);
+	}
+}
+
+//
+// build the response cache key from the remainder of the packet, which
+// must contain a single uncompressed question optionally followed by an
+// OPT RR with no EDNS options, or just a COOKIE.  Anything else just
+// bypasses the cache.
+//
+bool Context::make_cache_key(ReadBuffer in)
+{
+	key_len = 0;
+
+	// lower-cased QNAME
+	while (true) {
+		if (in.available() < 1) return false;
+		auto c = in.read<uint8_t>();
+		_key_buf[key_len++] = c;
+		if (c == 0) break;
+
+		if (c & 0xc0) return false;
+		if (in.available() < c || key_len + c >= 255) return false;
+
+		auto p = in.read<uint8_t>(c);
+		for (auto i = 0U; i < c; ++i) {
+			_key_buf[key_len++] = lower(p[i]);
+		}
+	}
+
+	// QTYPE and QCLASS
+	if (in.available() < 4) return false;
+	::memcpy(&_key_buf[key_len], in.read<uint8_t>(4), 4);
+	key_len += 4;
+	key_qdsize = key_len;
+	key_bufsize = 512;
+
+	// no EDNS
+	if (in.available() == 0) {
+		return true;
+	}
+
+	// OPT RR, with the buffer size masked out
+	if (in.available() < sizeof(edns_opt_rr)) return false;
+	auto opt = in.read<edns_opt_rr>();
+	if (in.available() != ntohs(opt.rdlen)) return false;
+
+	// the EDNS options (e.g. padding) don't change the response, so
+	// are left out of the key, except that a COOKIE is looked for as
+	// in parse_options if cookies are enabled.  The cached responses
+	// have no cookie, so room is left for one.
+	const uint8_t* client_cookie = nullptr;
+	if (opt.rdlen && cookies && peer) {
+		ReadBuffer options{in.read<uint8_t>(in.available()), ntohs(opt.rdlen)};
+		while (options.available() >= 4) {
+			auto code = ntohs(options.read<uint16_t>());
+			auto len = ntohs(options.read<uint16_t>());
+			if (options.available() < len) return false;
+			auto data = len ? options.read<uint8_t>(len) : nullptr;
+			if (code != edns_cookie) continue;
+
+			// just one, of one of the usual sizes
+			if (client_cookie) return false;
+			if (len != CookieSecret::client_size &&
+			    len != CookieSecret::client_size + CookieSecret::server_size)
+				return false;
+			client_cookie = data;
+			cookie_len = len;
+		}
+
+		// the FORMERR is left to the full path
+		if (options.available() > 0) return false;
+	}
+	opt.rdlen = 0;
+
+	key_bufsize = std::max(uint16_t(512), ntohs(opt.bufsize));
+	if (client_cookie) {
+		key_bufsize -= CookieSecret::option_size;
+	}
+	opt.bufsize = 0;
+	::memcpy(&_key_buf[key_len], &opt, sizeof opt);
+	key_len += sizeof opt;
+	cookie = client_cookie;
+
+	return true;
+}
+
+bool Context::cached_response(ReadBuffer& in, std::vector<iovec>& out)
+{
+	if (!make_cache_key(in)) {
+		key_len = 0;
+		return false;
+	}
+
+	// nothing to cache until the zone is loaded
+	key_generation = zone.generation();
+	if (!key_generation) {
+		return false;
+	}
+
+	key_hash = ResponseCache::hash(_key_buf, key_len);
+
+	// with the room the payload limit leaves, as in build_response
+	size_t extra = cookie ? CookieSecret::option_size : 0;
+	auto   room = std::min(key_bufsize, uint16_t(udp.payload - extra));
+
+	auto e = cache->find(_key_buf, key_len, key_hash, key_generation, room);
+	if (!e) {
+		return false;
+	}
+
+	rcode = e->flags & 0x0f;
+
+	if (rcode == LDNS_RCODE_NXDOMAIN && shedding(LoadShedder::nxdomain)) {
+		discard = true;
+		return false;
+	}
+
+	// a limited response is left to the full path, which has to
+	// build a truncated one for a slip
+	check_cookie();
+	if (rrl && client && !verified()) {
+		identity = e->identity;
+		rate_limit();
+		if (limit != RateLimiter::pass) {
+			return false;
+		}
+	}
+
+	// patch in the ID and the RD + CD bits from the query
+	auto& tx_hdr = head.reserve<dnshdr>();
+	tx_hdr.id = rx_id;
+	tx_hdr.flags = htons(e->flags | (rx_flags & 0x0110));
+	tx_hdr.qdcount = htons(1);
+	tx_hdr.ancount = htons(e->ancount);
+	tx_hdr.nscount = htons(e->nscount);
+	tx_hdr.arcount = htons(e->arcount);
+
+	// and the question section, with its original case
+	::memcpy(head.reserve<uint8_t>(key_qdsize), &in[in.position()], key_qdsize);
+	out.push_back(head);
+
+	if (cookie) {
+		auto len = e->data.size() - sizeof(edns_opt_rr);
+		auto opt = reinterpret_cast<const edns_opt_rr*>(&e->data[len]);
+		out.push_back(iovec{const_cast<uint8_t*>(e->data.data()), len});
+		out.push_back(response_opt(*opt));
+	} else {
+		out.push_back(iovec{const_cast<uint8_t*>(e->data.data()), e->data.size()});
+	}
+	clamped = key_bufsize > e->max_bufsize;
+
+	return true;
+}
+
+void Context::cache_response(const std::vector<iovec>& out, size_t first)
+{
+	auto& e = cache->slot(key_hash);
+	auto& tx_hdr = *reinterpret_cast<const dnshdr*>(out[first].iov_base);
+	auto  flags = ntohs(tx_hdr.flags);
+
+	e.generation = key_generation;
+	e.hash = key_hash;
+	e.identity = identity;
+	e.flags = flags & ~0x0110;
+	e.ancount = ntohs(tx_hdr.ancount);
+	e.nscount = ntohs(tx_hdr.nscount);
+	e.arcount = ntohs(tx_hdr.arcount);
+	e.min_bufsize = min_bufsize;
+	e.max_bufsize = max_bufsize;
+	e.key.assign(_key_buf, _key_buf + key_len);
+
+	e.data.clear();
+	for (auto i = first + 1; i < out.size(); ++i) {
+		auto p = reinterpret_cast<const uint8_t*>(out[i].iov_base);
+		e.data.insert(e.data.end(), p, p + out[i].iov_len);
+	}
+
+	// less the COOKIE option, which is only for this client
+	if (has_edns && cookie) {
+		e.data.resize(e.data.size() - CookieSecret::option_size);
+		auto p = &e.data[e.data.size() - sizeof(edns_opt_rr)];
+		reinterpret_cast<edns_opt_rr*>(p)->rdlen = 0;
+	}
+}
+
+//
+// Responses are limited per client and identity: positive answers by
+// the AnswerSet and type, whereas NXDOMAIN and errors are keyed just on
+// the RCODE so that a flood of random names all share one bucket.
+//
+void Context::rate_limit()
+{
+	auto category = RateLimiter::errors;
+	if (rcode == LDNS_RCODE_NOERROR) {
+		category = RateLimiter::responses;
+	} else if (rcode == LDNS_RCODE_NXDOMAIN) {
+		category = RateLimiter::nxdomains;
+		identity = rcode;
+	} else {
+		identity = rcode;
+	}
+
+	limit = rrl->check(*client, identity, category);
+	limited = true;
+}
+
+// whether to drop the query unanswered to relieve overload
+bool Context::shedding(LoadShedder::Class c) const
+{
+	return shed && !tcp && shed->shed(c);
+}
+
+//
+// a quick look at the question and any OPT RR, for shedding queries
+// before the full parse.  Anything odd is left for that to deal with.
+//
+bool Context::shed_query(ReadBuffer in) const
+{
+	while (true) {
+		if (in.available() < 1) return false;
+		auto c = in.read<uint8_t>();
+		if (c == 0) break;
+		if ((c & 0xc0) || in.available() < c) return false;
+		(void)in.read<uint8_t>(c);
+	}
+
+	if (in.available() < 4) return false;
+	auto type = ntohs(in.read<uint16_t>());
+	(void)in.read<uint16_t>();
+
+	bool edns = false, dnssec = false;
+	if (in.available() >= sizeof(edns_opt_rr)) {
+		auto opt = in.read<edns_opt_rr>();
+		edns = (opt.name == 0 && ntohs(opt.type) == LDNS_RR_TYPE_OPT);
+		dnssec = edns && (ntohs(opt.flags) & 0x8000);
+	}
+
+	return (type == LDNS_RR_TYPE_ANY && !dnssec && shedding(LoadShedder::any)) ||
+	       (!edns && shedding(LoadShedder::noedns)) ||
+	       (dnssec && shedding(LoadShedder::dnssec));
 }
 
-bool Context::execute(ReadBuffer& in, std::vector<iovec>& out, bool _tcp)
+bool Context::execute(ReadBuffer& in, std::vector<iovec>& out, bool _tcp, const in6_addr* _client)
 {
 	// clear the context state
 	reset();
 
+	// unwanted clients are dropped before even looking at the query
+	auto access = (acl && _client) ? acl->lookup(*_client) : ClientACL::allow;
+	if (access == ClientACL::drop) {
+		return false;
+	}
+
+	// only UDP responses are rate limited
+	client = (rrl && !_tcp) ? _client : nullptr;
+	peer = _client;
+
 	// handle TCP framing
 	tcp = _tcp;
 	if (tcp) {
@@ -324,9 +709,26 @@ bool Context::execute(ReadBuffer& in, std::vector<iovec>& out, bool _tcp)
 		return false;
 	}
 
+	// under overload, drop the least valuable queries before any real work
+	if (shed && !tcp && shed->shedding() && shed_query(in)) {
+		return false;
+	}
+
 	// point of no return - anything beyond here will generate a response
 
-	if (!valid_header(rx_hdr)) {
+	bool valid = valid_header(rx_hdr);
+
+	// try the response cache for well-formed UDP queries
+	bool cacheable = cache && !tcp && valid && ((rx_flags & 0x7800) == 0) &&
+			 (access == ClientACL::allow);
+	if (cacheable && cached_response(in, out)) {
+		return true;
+	}
+	if (limit == RateLimiter::drop || discard) {
+		return false;
+	}
+
+	if (!valid) {
 		rcode = LDNS_RCODE_FORMERR;
 	} else {
 		uint8_t opcode = (rx_flags >> 11) & 0x0f;
@@ -335,17 +737,67 @@ bool Context::execute(ReadBuffer& in, std::vector<iovec>& out, bool _tcp)
 		} else {
 			parse_packet(in);
 			if (rcode == LDNS_RCODE_NOERROR) {
-				answer = perform_lookup();
+				if (access == ClientACL::refuse) {
+					rcode = LDNS_RCODE_REFUSED;
+				} else {
+					answer = perform_lookup();
+				}
 			}
 		}
 	}
 
+	// whether a name exists is only known after the lookup
+	if (rcode == LDNS_RCODE_NXDOMAIN && shedding(LoadShedder::nxdomain)) {
+		return false;
+	}
+
+	// apply rate limiting, unless already done on a cache hit or the
+	// client has shown with a valid cookie that it's not spoofed
+	check_cookie();
+	if (client && !limited && !verified()) {
+		rate_limit();
+	}
+	if (limit == RateLimiter::drop) {
+		return false;
+	}
+
 	// put it all together
+	auto first = out.size();
 	build_response(in, answer, out);
 
+	// and remember it for next time
+	if (cacheable && key_len && key_generation && limit == RateLimiter::pass &&
+	    (rcode == LDNS_RCODE_NOERROR || rcode == LDNS_RCODE_NXDOMAIN)) {
+		cache_response(out, first);
+	}
+
 	return true;
 }
 
+bool Context::tld(const uint8_t*& label, size_t& len) const
+{
+	// parsed in full
+	if (qdsize) {
+		label = reinterpret_cast<const uint8_t*>(qname.data());
+		len = qname.size();
+		return true;
+	}
+
+	// or answered from the cache, whose key starts with the QNAME
+	if (key_len) {
+		size_t pos = 0, last = 0;
+		while (_key_buf[pos]) {
+			last = pos;
+			pos += _key_buf[pos] + 1;
+		}
+		label = &_key_buf[last + 1];
+		len = pos ? _key_buf[last] : 0;
+		return true;
+	}
+
+	return false;
+}
+
 Answer::Type Context::type() const
 {
 	if (!match) {
@@ -387,12 +839,30 @@ void Context::reset()
 	qlabels = 0;
 	rx_id = 0;
 	rx_flags = 0;
+	min_bufsize = 0;
+	max_bufsize = 0;
 	match = false;
 	has_edns = false;
 	do_bit = false;
 	tcp = false;
+	clamped = false;
 	rcode = 0;
 
+	key_generation = 0;
+	key_len = 0;
+
+	client = nullptr;
+	identity = 0;
+	limit = RateLimiter::pass;
+	limited = false;
+	discard = false;
+
+	peer = nullptr;
+	cookie = nullptr;
+	cookie_len = 0;
+	cookie_time = 0;
+	cookie_check = CookieSecret::missing;
+
 	// clear buffer positions
 	head.reset();
 }
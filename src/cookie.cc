@@ -0,0 +1,183 @@
+/*
+ * Copyright (C) Internet Systems Consortium, Inc. ("ISC")
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ */
+
+#include <cstring>
+#include <endian.h>
+#include <time.h>
+
+#include <sys/random.h>
+
+#include "cookie.h"
+#include "util.h"
+
+static const uint32_t max_age = 3600;	  // seconds
+static const uint32_t max_skew = 300;	  // into the future
+static const uint32_t refresh_age = 1800; // after which a new one is sent
+
+const unsigned CookieSecret::rollover;
+
+static uint64_t load64(const uint8_t* p)
+{
+	uint64_t v;
+	::memcpy(&v, p, sizeof v);
+	return le64toh(v);
+}
+
+static inline uint64_t rotl(uint64_t x, unsigned b)
+{
+	return (x << b) | (x >> (64 - b));
+}
+
+//
+// the SipHash state, all inlined so that it stays in registers even
+// without -O3
+//
+struct SipState {
+	uint64_t v0, v1, v2, v3;
+
+	SipState(uint64_t k0, uint64_t k1)
+	    : v0(k0 ^ 0x736f6d6570736575ULL), v1(k1 ^ 0x646f72616e646f6dULL),
+	      v2(k0 ^ 0x6c7967656e657261ULL), v3(k1 ^ 0x7465646279746573ULL)
+	{
+	}
+
+	__attribute__((always_inline)) void round()
+	{
+		v0 += v1;
+		v1 = rotl(v1, 13);
+		v1 ^= v0;
+		v0 = rotl(v0, 32);
+		v2 += v3;
+		v3 = rotl(v3, 16);
+		v3 ^= v2;
+		v0 += v3;
+		v3 = rotl(v3, 21);
+		v3 ^= v0;
+		v2 += v1;
+		v1 = rotl(v1, 17);
+		v1 ^= v2;
+		v2 = rotl(v2, 32);
+	}
+
+	__attribute__((always_inline)) void compress(uint64_t m)
+	{
+		v3 ^= m;
+		round();
+		round();
+		v0 ^= m;
+	}
+
+	__attribute__((always_inline)) uint64_t finish()
+	{
+		v2 ^= 0xff;
+		round();
+		round();
+		round();
+		round();
+		return v0 ^ v1 ^ v2 ^ v3;
+	}
+};
+
+//
+// SipHash-2-4 of the client cookie, the version, reserved bytes and
+// timestamp (as a little-endian word, already in wire order) and the
+// client address, which is always 20 or 32 bytes.  Being a fixed
+// shape, the message is fed in as whole words with no buffering, and
+// the final word holding the length is a constant.
+//
+uint64_t CookieSecret::siphash(const Key& key, const uint8_t* client, uint64_t header,
+			       const in6_addr& addr)
+{
+	SipState s(key.k0, key.k1);
+
+	s.compress(load64(client));
+	s.compress(header);
+
+	if (IN6_IS_ADDR_V4MAPPED(&addr)) {
+		uint32_t a;
+		::memcpy(&a, &addr.s6_addr[12], sizeof a);
+		s.compress(le32toh(a) | (uint64_t(20) << 56));
+	} else {
+		s.compress(load64(&addr.s6_addr[0]));
+		s.compress(load64(&addr.s6_addr[8]));
+		s.compress(uint64_t(32) << 56);
+	}
+
+	return s.finish();
+}
+
+CookieSecret::Check CookieSecret::check(const uint8_t* client, const uint8_t* server,
+					size_t server_len, const in6_addr& addr,
+					uint32_t now) const
+{
+	if (!server_len) {
+		return missing;
+	}
+
+	// only our own version 1 cookies are recognised
+	if (server_len != server_size || server[0] != 1) {
+		return invalid;
+	}
+
+	uint32_t stamp;
+	::memcpy(&stamp, &server[4], sizeof stamp);
+	stamp = be32toh(stamp);
+
+	// in serial number arithmetic, as the timestamp wraps
+	auto age = int32_t(now - stamp);
+	if (age > int32_t(max_age) || age < -int32_t(max_skew)) {
+		return invalid;
+	}
+
+	auto header = load64(server);
+	auto hash = load64(&server[8]);
+
+	if (siphash(current, client, header, addr) == hash) {
+		return (age < int32_t(refresh_age)) ? fresh : valid;
+	}
+	if (siphash(previous, client, header, addr) == hash) {
+		return valid;
+	}
+
+	return invalid;
+}
+
+void CookieSecret::make(const uint8_t* client, const in6_addr& addr, uint32_t now,
+			uint8_t* out) const
+{
+	out[0] = 1; // version
+	out[1] = out[2] = out[3] = 0;
+
+	auto stamp = htobe32(now);
+	::memcpy(&out[4], &stamp, sizeof stamp);
+
+	auto hash = htole64(siphash(current, client, load64(out), addr));
+	::memcpy(&out[8], &hash, sizeof hash);
+}
+
+uint32_t CookieSecret::now()
+{
+	timespec ts;
+	clock_gettime(CLOCK_REALTIME_COARSE, &ts);
+	return ts.tv_sec;
+}
+
+CookieSecret::CookieSecret(const uint8_t* key, const CookieSecret* prior)
+{
+	uint8_t random[16];
+	if (!key) {
+		if (::getrandom(random, sizeof random, 0) != sizeof random) {
+			throw_errno("getrandom");
+		}
+		key = random;
+	}
+
+	current = {load64(key), load64(key + 8)};
+	previous = prior ? prior->current : current;
+}
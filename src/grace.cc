@@ -0,0 +1,84 @@
+/*
+ * Copyright (C) Internet Systems Consortium, Inc. ("ISC")
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ */
+
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "grace.h"
+
+namespace {
+
+// a reader thread's sequence number, odd while it is in a Reader, and
+// padded so that no two threads share a cache line
+struct Slot {
+	std::atomic<uint64_t> seq{0};
+	uint8_t		      pad[64 - sizeof(seq)];
+};
+
+std::mutex			   slots_mutex;
+std::vector<std::unique_ptr<Slot>> slots; // never freed, threads being few
+
+// the calling thread's slot, registered on first use
+std::atomic<uint64_t>& thread_seq()
+{
+	thread_local Slot* slot = nullptr;
+
+	if (!slot) {
+		std::lock_guard<std::mutex> lock(slots_mutex);
+		slots.emplace_back(new Slot());
+		slot = slots.back().get();
+	}
+
+	return slot->seq;
+}
+
+} // namespace
+
+//
+// The fence after entering pairs with the one at the start of wait():
+// either wait() sees this thread inside, or this thread's subsequent
+// loads see whatever was published before wait() was called.
+//
+GracePeriod::Reader::Reader() : seq(thread_seq())
+{
+	seq.store(seq.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+}
+
+GracePeriod::Reader::~Reader()
+{
+	seq.store(seq.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+void GracePeriod::wait()
+{
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+
+	// the threads inside a Reader now, and where they were
+	std::vector<std::pair<const std::atomic<uint64_t>*, uint64_t>> busy;
+	{
+		std::lock_guard<std::mutex> lock(slots_mutex);
+		for (const auto& slot : slots) {
+			auto seq = slot->seq.load(std::memory_order_acquire);
+			if (seq & 1) {
+				busy.emplace_back(&slot->seq, seq);
+			}
+		}
+	}
+
+	// each has only one packet to finish
+	for (const auto& b : busy) {
+		while (b.first->load(std::memory_order_acquire) == b.second) {
+			std::this_thread::yield();
+		}
+	}
+}
@@ -0,0 +1,354 @@
+/*
+ * Copyright (C) Internet Systems Consortium, Inc. ("ISC")
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ */
+
+#include <cstring>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "image.h"
+#include "util.h"
+
+static const char image_magic[8] = {'F', 'R', 'O', 'O', 'T', 'I', 'M', 'G'};
+static const uint32_t byte_order = 0x01020304;
+
+static void align(std::vector<uint8_t>& out, size_t n)
+{
+	out.resize((out.size() + n - 1) & ~(n - 1));
+}
+
+template <typename T> static void put(std::vector<uint8_t>& out, size_t offset, const T& v)
+{
+	::memcpy(out.data() + offset, &v, sizeof v);
+}
+
+// --------------------------------------------------------------------
+
+bool ZoneImage::is_image(const std::string& filename)
+{
+	char magic[sizeof image_magic];
+
+	auto fd = ::open(filename.c_str(), O_RDONLY);
+	if (fd < 0) {
+		return false;
+	}
+
+	auto n = ::read(fd, magic, sizeof magic);
+	::close(fd);
+
+	return n == sizeof magic && ::memcmp(magic, image_magic, sizeof magic) == 0;
+}
+
+//
+// serialise the given AnswerSets, which must be in key order.  Answers
+// with identical content, whether in different sets or the signed and
+// unsigned halves of one set, are only stored once.
+//
+void ZoneImage::write(const std::string& filename, const Sets& sets, uint32_t serial,
+		      bool compress)
+{
+	std::vector<uint8_t> out(sizeof(Header));
+
+	auto names = out.size();
+	out.resize(names + sets.size() * sizeof(Name));
+
+	// keys
+	auto strings = out.size();
+	std::vector<Name> table(sets.size());
+	for (size_t i = 0; i < sets.size(); ++i) {
+		const auto& key = sets[i].first;
+		table[i].key = out.size();
+		table[i].key_len = key.size();
+		out.insert(out.end(), key.cbegin(), key.cend());
+	}
+	auto strings_size = out.size() - strings;
+
+	// answers
+	align(out, 8);
+	auto arena = out.size();
+
+	AnswerIndex				    index;
+	std::unordered_map<const Answer*, uint32_t> stored;
+
+	auto store = [&](const Answer* a) -> uint32_t {
+		if (!a) {
+			return 0;
+		}
+
+		a = index.find(a);
+		auto iter = stored.find(a);
+		if (iter != stored.end()) {
+			return iter->second;
+		}
+
+		align(out, 8);
+		auto offset = out.size();
+
+		AnswerRecord rec;
+		rec.size = a->_size;
+		rec.fix_offset = a->fix_offset;
+		rec.flags = a->flags;
+		rec.ancount = a->ancount;
+		rec.nscount = a->nscount;
+		rec.arcount = a->arcount;
+		rec.n_offsets = a->n_offsets;
+		rec.required = a->_required;
+
+		out.resize(offset + sizeof rec + a->index_size());
+		put(out, offset, rec);
+		if (a->index_size()) {
+			::memcpy(out.data() + offset + sizeof rec, a->offsets, a->index_size());
+		}
+		out.insert(out.end(), a->buf, a->buf + a->_size);
+
+		if (out.size() > UINT32_MAX) {
+			throw std::runtime_error("zone image too large");
+		}
+
+		stored[a] = offset;
+		return offset;
+	};
+
+	for (size_t i = 0; i < sets.size(); ++i) {
+		auto set = sets[i].second;
+		for (auto t = 0U; t < Answer::Type::max; ++t) {
+			table[i].plain[t] = store(set->plain[t].get());
+			table[i].dnssec[t] = store(set->dnssec[t].get());
+		}
+	}
+
+	align(out, 8);
+	auto arena_size = out.size() - arena;
+
+	::memcpy(out.data() + names, table.data(), table.size() * sizeof(Name));
+
+	// finally the header, including the checksum of everything else
+	Header hdr;
+	::memset(&hdr, 0, sizeof hdr);
+	::memcpy(hdr.magic, image_magic, sizeof hdr.magic);
+	hdr.version = version;
+	hdr.byte_order = byte_order;
+	hdr.size = out.size();
+	hdr.serial = serial;
+	hdr.flags = compress ? Flags::compressed : 0;
+	hdr.name_count = sets.size();
+	hdr.names = names;
+	hdr.strings = strings;
+	hdr.strings_size = strings_size;
+	hdr.arena = arena;
+	hdr.arena_size = arena_size;
+	hdr.checksum = fnv1a64(out.data() + sizeof hdr, out.size() - sizeof hdr);
+	put(out, 0, hdr);
+
+	// write to a temporary file and rename it into place, so that
+	// a running server never sees a partially written image
+	auto tmpname = filename + ".tmp";
+	auto fd = ::open(tmpname.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		throw_errno("creating zone image: " + tmpname);
+	}
+
+	size_t done = 0;
+	while (done < out.size()) {
+		auto n = ::write(fd, out.data() + done, out.size() - done);
+		if (n < 0) {
+			::close(fd);
+			::unlink(tmpname.c_str());
+			throw_errno("writing zone image");
+		}
+		done += n;
+	}
+
+	if (::fsync(fd) < 0 || ::close(fd) < 0) {
+		::unlink(tmpname.c_str());
+		throw_errno("writing zone image");
+	}
+
+	if (::rename(tmpname.c_str(), filename.c_str()) < 0) {
+		::unlink(tmpname.c_str());
+		throw_errno("renaming zone image");
+	}
+}
+
+// --------------------------------------------------------------------
+
+void ZoneImage::check(bool ok, const char* what) const
+{
+	if (!ok) {
+		throw std::runtime_error(std::string("invalid zone image: ") + what);
+	}
+}
+
+static bool in_bounds(uint64_t offset, uint64_t len, uint64_t size)
+{
+	return offset <= size && len <= size - offset;
+}
+
+void ZoneImage::verify() const
+{
+	check(size >= sizeof(Header), "truncated");
+
+	const auto& hdr = header();
+	check(::memcmp(hdr.magic, image_magic, sizeof hdr.magic) == 0, "bad magic");
+	check(hdr.byte_order == byte_order, "wrong byte order");
+	check(hdr.version == version, "unsupported version");
+	check(hdr.size == size, "size mismatch");
+	check(fnv1a64(base + sizeof hdr, size - sizeof hdr) == hdr.checksum, "checksum mismatch");
+
+	check(in_bounds(hdr.names, uint64_t(hdr.name_count) * sizeof(Name), size), "names");
+	check(hdr.names % alignof(Name) == 0, "names alignment");
+	check(in_bounds(hdr.strings, hdr.strings_size, size), "strings");
+	check(in_bounds(hdr.arena, hdr.arena_size, size), "arena");
+	check(hdr.name_count > 0, "no names");
+
+	for (size_t i = 0; i < hdr.name_count; ++i) {
+		const auto& n = name(i);
+		check(n.key >= hdr.strings && in_bounds(n.key - hdr.strings, n.key_len,
+							hdr.strings_size),
+		      "key");
+	}
+}
+
+const ZoneImage::Name& ZoneImage::name(size_t i) const
+{
+	return reinterpret_cast<const Name*>(base + header().names)[i];
+}
+
+std::shared_ptr<const Answer> ZoneImage::answer(uint32_t offset,
+						std::shared_ptr<const ZoneImage> self) const
+{
+	const auto& hdr = header();
+
+	check(offset % alignof(AnswerRecord) == 0, "answer alignment");
+	check(offset >= hdr.arena && in_bounds(offset - hdr.arena, sizeof(AnswerRecord),
+					       hdr.arena_size),
+	      "answer");
+
+	const auto& rec = *reinterpret_cast<const AnswerRecord*>(base + offset);
+	auto	    offsets = reinterpret_cast<const uint16_t*>(&rec + 1);
+	auto	    ends = offsets + rec.n_offsets;
+	auto	    data = reinterpret_cast<const uint8_t*>(ends + rec.arcount);
+	auto	    end = base + hdr.arena + hdr.arena_size;
+
+	check(data <= end && rec.size <= size_t(end - data), "answer data");
+	check(rec.size >= sizeof(edns_opt_rr), "answer size");
+	check(rec.arcount >= 1 && rec.required < rec.arcount, "answer ARCOUNT");
+
+	// the answer object refers directly to the mapped data
+	auto a = std::shared_ptr<Answer>(new Answer());
+	a->buf = const_cast<uint8_t*>(data);
+	a->_size = rec.size;
+	a->fix_offset = rec.fix_offset;
+	a->flags = static_cast<Answer::Flags>(rec.flags);
+	a->ancount = rec.ancount;
+	a->nscount = rec.nscount;
+	a->arcount = rec.arcount;
+	a->offsets = offsets;
+	a->n_offsets = rec.n_offsets;
+	a->_required = rec.required;
+	a->external = true;
+	a->storage = self;
+
+	for (auto i = 0U; i < rec.n_offsets; ++i) {
+		check(offsets[i] + sizeof(uint16_t) <= rec.size, "compression offset");
+	}
+	for (auto i = 1U; i < rec.arcount; ++i) {
+		check(ends[i - 1] <= ends[i], "additional RR boundary");
+	}
+	check(ends[rec.arcount - 1] == rec.size - sizeof(edns_opt_rr), "additional section");
+
+	return a;
+}
+
+void ZoneImage::load(std::shared_ptr<const ZoneImage> image,
+		     std::vector<std::pair<std::string, std::shared_ptr<const AnswerSet>>>& out,
+		     AnswerSet::Stats* stats)
+{
+	std::unordered_map<uint32_t, std::shared_ptr<const Answer>> answers;
+	AnswerSet::Stats					    counts;
+
+	auto get = [&](uint32_t offset, Answer::Type type) -> std::shared_ptr<const Answer> {
+		if (!offset) {
+			return nullptr;
+		}
+		auto& a = answers[offset];
+		if (!a) {
+			a = image->answer(offset, image);
+			counts.bytes += a->size();
+			++counts.unique;
+		}
+		counts.add(type, *a);
+		return a;
+	};
+
+	out.clear();
+	out.reserve(image->count());
+
+	for (size_t i = 0; i < image->count(); ++i) {
+		const auto& n = image->name(i);
+
+		auto set = std::shared_ptr<AnswerSet>(new AnswerSet());
+		for (auto t = 0U; t < Answer::Type::max; ++t) {
+			set->plain[t] = get(n.plain[t], Answer::Type(t));
+			set->dnssec[t] = get(n.dnssec[t], Answer::Type(t));
+		}
+
+		auto key = reinterpret_cast<const char*>(image->base + n.key);
+		out.emplace_back(std::string(key, n.key_len), set);
+	}
+
+	if (stats) {
+		*stats = counts;
+	}
+}
+
+ZoneImage::ZoneImage(const std::string& filename)
+{
+	auto fd = ::open(filename.c_str(), O_RDONLY);
+	if (fd < 0) {
+		throw_errno("opening zone image: " + filename);
+	}
+
+	struct stat st;
+	if (::fstat(fd, &st) < 0) {
+		::close(fd);
+		throw_errno("fstat: " + filename);
+	}
+
+	size = st.st_size;
+	if (size < sizeof(Header)) {
+		::close(fd);
+		throw std::runtime_error("invalid zone image: truncated");
+	}
+
+	// shared, so that all processes serving the same image share
+	// the same pages of the page cache
+	auto p = ::mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+	::close(fd);
+
+	if (p == MAP_FAILED) {
+		throw_errno("mmap: " + filename);
+	}
+	base = reinterpret_cast<const uint8_t*>(p);
+
+	try {
+		verify();
+	} catch (...) {
+		::munmap(p, size);
+		throw;
+	}
+}
+
+ZoneImage::~ZoneImage()
+{
+	::munmap(const_cast<uint8_t*>(base), size);
+}
@@ -0,0 +1,92 @@
+/*
+ * Copyright (C) Internet Systems Consortium, Inc. ("ISC")
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <netinet/in.h>
+
+//
+// A client access list, compiled into a read-only longest prefix match
+// structure for each address family: a multibit trie with a 16 bit
+// first stride and 8 bit strides thereafter, with the rules pushed down
+// to the leaves.  A lookup is one memory access for prefixes up to /16,
+// plus one more per further byte of the longest matching rule.
+//
+// The rules are read from a file of "<prefix> <action>" lines, where
+// the action is "allow", "refuse" or "drop", and a client not matching
+// any rule is allowed.  Later rules for the same prefix win.
+//
+class ClientACL {
+
+public:
+	enum Action : uint8_t { allow, refuse, drop };
+
+	struct Rule {
+		uint8_t	 addr[16]; // IPv4 in the last four bytes
+		unsigned bits;
+		bool	 ipv4;
+		Action	 action;
+	};
+
+private:
+	static const uint32_t child = 0x80000000U; // else the entry is an Action
+
+	std::vector<uint32_t> v4;
+	std::vector<uint32_t> v6;
+	std::vector<Rule>     list; // shortest first
+
+	static void insert(std::vector<uint32_t>& trie, const Rule& rule);
+	void	    compile(std::vector<Rule>& rules);
+
+public:
+	Action lookup(const in6_addr& client) const;
+
+	const std::vector<Rule>& rules() const
+	{
+		return list;
+	}
+	size_t size() const
+	{
+		return list.size();
+	}
+	size_t memory() const
+	{
+		return (v4.size() + v6.size()) * sizeof(uint32_t);
+	}
+
+	static std::shared_ptr<const ClientACL> load(const std::string& filename);
+
+public:
+	ClientACL();
+};
+
+//--  implementation  -------------------------------------------------
+
+inline ClientACL::Action ClientACL::lookup(const in6_addr& client) const
+{
+	auto	    p = client.s6_addr;
+	const auto* trie = v6.data();
+
+	if (IN6_IS_ADDR_V4MAPPED(&client)) {
+		p += 12;
+		trie = v4.data();
+	}
+
+	auto entry = trie[(p[0] << 8) | p[1]];
+	for (p += 2; entry & child; ++p) {
+		entry = trie[(entry & ~child) + *p];
+	}
+
+	return static_cast<Action>(entry);
+}
@@ -9,9 +9,11 @@
 
 #pragma once
 
-#include <map>
+#include <atomic>
 #include <memory>
+#include <string>
 #include <type_traits>
+#include <unordered_map>
 #include <vector>
 
 #include <ldns/ldns.h>
@@ -19,6 +21,7 @@
 
 #include "buffer.h"
 #include "rrlist.h"
+#include "zonedata.h"
 
 //
 //  Wire format for an EDNS OPT RR
@@ -33,33 +36,23 @@ struct __attribute__((__packed__)) edns_opt_rr {
 	uint16_t rdlen;
 };
 
-//
-// comparison functor for comparing ldns_rdf* objects
-//
+class Arena;
+class ZoneImage;
 
 class Answer {
 
-private:
-	typedef std::shared_ptr<const ldns_rdf> RDFPtr;
-
-	struct DNameCompare {
-		bool operator()(RDFPtr a, RDFPtr b) const
-		{
-			return ldns_dname_compare(a.get(), b.get()) < 0;
-		}
-	};
+	friend class AnswerSet;
+	friend class AnswerIndex;
+	friend class ZoneImage;
 
 private:
-	uint16_t get_name_pointer(const ldns_rdf* name) const;
-	void     put_name_pointer(const ldns_rdf* name, uint16_t offset);
-
-	void   dname_to_wire(ldns_buffer* lbuf, const ldns_rdf* name);
-	void   rr_to_wire(ldns_buffer* lbuf, const ldns_rr* rr);
-	size_t rrlist_to_wire(ldns_buffer* lbuf, const RRList& rrs);
+	// per-thread scratch space used while compiling an answer
+	struct Builder;
 
 private:
-	typedef std::map<RDFPtr, uint16_t, DNameCompare> CompressTable;
-	typedef std::vector<uint16_t>			 CompressOffsets;
+	void   dname_to_wire(Builder& b, const uint8_t* name);
+	void   rr_to_wire(Builder& b, const Record& rr);
+	size_t rrlist_to_wire(Builder& b, const RRList& rrs, uint16_t* ends = nullptr);
 
 public:
 	// flags passed to the constructor
@@ -80,21 +73,64 @@ public:
 	};
 
 private:
-	uint8_t*	buf;
-	size_t		_size;
-	uint16_t	fix_offset;
-	Flags		flags;
-	CompressTable   c_table;
-	CompressOffsets c_offsets;
+	uint8_t*	buf = nullptr;
+	const uint16_t* offsets = nullptr; // positions of the compression pointers in buf
+	uint16_t	n_offsets = 0;
+	uint16_t	_size = 0;
+	uint16_t	fix_offset = 5;
+	Flags		flags = Flags::none;
+	uint16_t	_required = 0; // additional RRs that can't be left out
+
+	// the compression offsets are followed by the start of the
+	// additional section and the end of each RR in it bar the OPT RR,
+	// one per ARCOUNT
+	const uint16_t* ends() const
+	{
+		return offsets + n_offsets;
+	}
+	size_t index_size() const
+	{
+		return (n_offsets + arcount) * sizeof(uint16_t);
+	}
+
+	// set if buf and offsets belong to something else, e.g. an arena
+	// or a mapped image, the latter being kept alive by "storage"
+	bool			    external = false;
+	std::shared_ptr<const void> storage;
+
+	// lazily created copies of the answer with the compression
+	// pointers already adjusted for a longer question section
+	static const size_t	   max_variants = 4;
+	mutable std::atomic<uint8_t*> variants[max_variants];
+
+	static const size_t	variant_limit = 16 * 1024 * 1024;
+	static std::atomic<size_t> variant_bytes;
+
+	void	   fixup(uint8_t* out, uint16_t delta) const;
+	const uint8_t* variant(uint16_t delta) const;
 
 public:
 	uint16_t ancount = 0;
 	uint16_t nscount = 0;
 	uint16_t arcount = 0;
 
+private:
+	Answer();
+
+	// make a copy of an answer inside the given arena, with its
+	// metadata and compression offsets immediately before the data
+	static Answer* pack(const Answer& a, Arena& arena);
+	static size_t  packed_size(const Answer& a);
+
+	// a hash and comparison of everything that makes up the answer
+	uint64_t hash() const;
+	bool	 same(const Answer& a) const;
+
 public:
-	Answer(const ldns_rdf* name, const RRList& an, const RRList& ns, const RRList& ar,
-	       Flags flags = none);
+	// the first "required" RRs of "ar" are the glue that a referral
+	// must include (RFC 9471), the rest may be dropped to fit
+	Answer(const uint8_t* name, const RRList& an, const RRList& ns, const RRList& ar,
+	       Flags flags = none, size_t required = 0);
 	~Answer();
 
 	operator iovec() const
@@ -115,10 +151,24 @@ public:
 		return !(flags & Flags::nocompress);
 	};
 
+	// the length of the answer without its OPT RR and with only the
+	// first n additional RRs, which must be at least required()
+	uint16_t length(uint16_t n) const
+	{
+		return ends()[n];
+	};
+	uint16_t required() const
+	{
+		return _required;
+	};
+
 	iovec data_offset_by(uint16_t offset, uint8_t* out) const;
 
 public:
 	static const Answer* empty;
+
+	// the UDP payload size advertised in the OPT RR (DNS Flag Day 2020)
+	static const uint16_t edns_bufsize = 1232;
 };
 
 // convenience operator for combining Flags returning 'Flags'
@@ -139,19 +189,107 @@ constexpr inline void operator|=(Answer::Flags& lhs, Answer::Flags rhs)
 
 class AnswerSet {
 
+	friend class ZoneImage;
+
+public:
+	// hashes of the zone data that each group of answers was built
+	// from, used to find unchanged answers on reload
+	struct Sources {
+		uint64_t delegation = 0; // NS, DS and glue
+		uint64_t negative = 0;	 // SOA and NSEC
+
+		bool operator==(const Sources& other) const
+		{
+			return delegation == other.delegation && negative == other.negative;
+		}
+	};
+
+	typedef std::vector<std::shared_ptr<const Arena>> Arenas;
+
 private:
-	Answer** plain;
-	Answer** dnssec;
+	typedef std::shared_ptr<const Answer> PAnswer;
+
+public:
+	// the number of answers in a collection of sets, before and after
+	// identical answers are merged
+	struct Stats {
+		size_t answers = 0; // non-empty answer slots
+		size_t unique = 0;  // distinct answers stored
+		size_t bytes = 0;   // of distinct answer data
+
+		// the length of all the answers of each type, with and
+		// without the additional RRs that aren't required
+		size_t full[Answer::Type::max] = {};
+		size_t minimal[Answer::Type::max] = {};
+
+		void add(Answer::Type type, const Answer& a);
+	};
 
 private:
-	void generate_root_answers(const ldns_dnssec_zone* zone, bool compress);
-	void generate_tld_answers(const ldns_dnssec_name* name, const ldns_dnssec_zone* zone,
-				  bool compress);
+	PAnswer plain[Answer::Type::max];
+	PAnswer dnssec[Answer::Type::max];
+	Sources src;
+	size_t	_reused = 0;
+
+private:
+	void generate_root_answers(const ZoneData& zone, bool compress);
+	void generate_tld_answers(const ZoneNode* name, const ZoneData& zone, bool compress,
+				  const AnswerSet* previous);
+
+	bool reuse(Answer::Type type, bool same, const AnswerSet* previous);
+
+	AnswerSet() = default;
 
 public:
-	AnswerSet(const ldns_dnssec_name* name, const ldns_dnssec_zone* zone, bool compress = true);
-	~AnswerSet();
+	// "sources" must be those of the name, if given
+	AnswerSet(const ZoneNode* name, const ZoneData& zone, bool compress = true,
+		  const AnswerSet* previous = nullptr, const Sources* sources = nullptr);
 
 public:
 	const Answer* answer(Answer::Type type, bool do_bit) const;
+
+	// the number of answers shared with the previous version of this set
+	size_t reused() const
+	{
+		return _reused;
+	};
+
+	// the number of answers in the set
+	size_t count() const;
+
+	const Sources& sources() const
+	{
+		return src;
+	};
+
+	// hashes the records that a name's answers would be built from,
+	// without building them
+	static Sources hash_sources(const ZoneNode* name, const ZoneData& zone);
+
+	// replace each set whose answers aren't all in the "previous"
+	// arenas with a copy whose answers are, apart from the new ones,
+	// which are packed into one new arena (on the given NUMA node, if
+	// any).  Answers in a previous arena that is now less than half in
+	// use are moved to the new one too, so that it can be freed.  The
+	// arenas that the sets now use are returned.  Identical new
+	// answers are only stored once.
+	static Arenas pack(std::vector<std::shared_ptr<const AnswerSet>>& sets, bool hugepages,
+			   bool lock, int node = -1, Stats* stats = nullptr,
+			   const Arenas& previous = Arenas());
+};
+
+//
+// Maps each answer to the first answer seen with exactly the same
+// content, so that identical answers in different AnswerSets (e.g.
+// the NXDOMAIN and NODATA answers, or referrals to the same servers)
+// may share storage.
+//
+class AnswerIndex {
+
+private:
+	std::unordered_map<const Answer*, const Answer*> seen;
+	std::unordered_multimap<uint64_t, const Answer*> content;
+
+public:
+	const Answer* find(const Answer* a);
 };
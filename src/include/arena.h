@@ -0,0 +1,61 @@
+/*
+ * Copyright (C) Internet Systems Consortium, Inc. ("ISC")
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+//
+// A single fixed-size block of anonymous memory which is carved up
+// sequentially and only released as a whole.  It is optionally backed
+// by 2 MiB huge pages (falling back to transparent huge pages if none
+// are reserved), is always prefaulted, and may be locked into RAM.
+// If a NUMA node is given the pages are placed on that node.
+//
+class Arena {
+
+private:
+	uint8_t* base = nullptr;
+	size_t	 _size = 0;
+	size_t	 used = 0;
+	bool	 _huge = false;
+	bool	 _locked = false;
+
+public:
+	void* allocate(size_t n, size_t align = 8);
+
+	size_t size() const
+	{
+		return _size;
+	};
+	size_t allocated() const
+	{
+		return used;
+	};
+	bool huge() const
+	{
+		return _huge;
+	};
+	bool locked() const
+	{
+		return _locked;
+	};
+	bool contains(const void* p) const
+	{
+		return p >= base && p < base + _size;
+	};
+
+public:
+	Arena(size_t size, bool hugepages = false, bool lock = false, int node = -1);
+	~Arena();
+
+	Arena(const Arena&) = delete;
+	Arena& operator=(const Arena&) = delete;
+};
@@ -0,0 +1,80 @@
+/*
+ * Copyright (C) Internet Systems Consortium, Inc. ("ISC")
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+#include <sys/socket.h> // for iovec
+
+//
+// A small direct-mapped cache of fully built responses, keyed on the
+// lower-cased wire format of the question section plus the EDNS OPT RR
+// (with the UDP buffer size masked out).
+//
+// Each entry holds the response header flags and section counts and a
+// contiguous copy of everything after the question section.  The
+// message ID, RD/CD bits and the original case of the question are
+// patched back in from the query on a hit.
+//
+// Each worker thread owns its own cache, so no locking is required.
+// The hit and miss counters are atomic only so that they can be read
+// by the statistics thread.
+//
+class ResponseCache {
+
+public:
+	struct Entry {
+		uint64_t	     generation = 0; // zone generation, 0 == empty
+		uint64_t	     identity = 0;   // for rate limiting
+		uint32_t	     hash = 0;
+		uint16_t	     flags = 0; // response flags, excluding RD + CD
+		uint16_t	     ancount = 0;
+		uint16_t	     nscount = 0;
+		uint16_t	     arcount = 0;
+		uint16_t	     min_bufsize = 0; // for which this is the response,
+		uint16_t	     max_bufsize = 0; // as it may be cut down to fit
+		std::vector<uint8_t> key;
+		std::vector<uint8_t> data;
+
+		bool fits(uint16_t bufsize) const
+		{
+			return bufsize >= min_bufsize && bufsize <= max_bufsize;
+		}
+	};
+
+private:
+	std::vector<Entry> entries;
+	size_t		   mask;
+
+	std::atomic<uint64_t> _hits{0};
+	std::atomic<uint64_t> _misses{0};
+
+public:
+	static uint32_t hash(const uint8_t* key, size_t len);
+
+	const Entry* find(const uint8_t* key, size_t len, uint32_t hash, uint64_t generation,
+			  uint16_t bufsize);
+	Entry&	     slot(uint32_t hash);
+
+public:
+	uint64_t hits() const
+	{
+		return _hits.load(std::memory_order_relaxed);
+	};
+	uint64_t misses() const
+	{
+		return _misses.load(std::memory_order_relaxed);
+	};
+
+public:
+	ResponseCache(size_t size);
+};
@@ -13,29 +13,65 @@
 #include <sys/types.h> // for iovec
 #include <vector>
 
+#include "acl.h"
 #include "answer.h"
 #include "buffer.h"
+#include "cache.h"
+#include "cookie.h"
+#include "rrl.h"
+#include "shed.h"
 
 class Zone;
 
+// the largest UDP response sent whatever the client's buffer size, to
+// avoid IP fragmentation, and the buffer size advertised in responses
+struct UDPLimits {
+	uint16_t payload = 1232;
+	uint16_t advertise = Answer::edns_bufsize;
+};
+
 class Context {
 
 private:
 	void	  reset();
 	void	  parse_edns(ReadBuffer& in);
+	void	  parse_options(ReadBuffer in);
 	void	  parse_question(ReadBuffer& in);
 	void	  parse_packet(ReadBuffer& in);
 	const Answer* perform_lookup();
 	void	  build_response(ReadBuffer& in, const Answer* answer, std::vector<iovec>& iov);
+	iovec	  response_opt(const edns_opt_rr& opt);
+
+	bool make_cache_key(ReadBuffer in);
+	bool cached_response(ReadBuffer& in, std::vector<iovec>& out);
+	void cache_response(const std::vector<iovec>& out, size_t first);
+
+	void rate_limit();
+	bool shedding(LoadShedder::Class c) const;
+	bool shed_query(ReadBuffer in) const;
+	void check_cookie();
+	bool verified() const
+	{
+		return cookie_check >= CookieSecret::valid;
+	}
 
 private:
 	uint8_t _an_buf[4096];
 	uint8_t _head_buf[512];
+	uint8_t _key_buf[255 + 4 + sizeof(edns_opt_rr)];
+	uint8_t _opt_buf[sizeof(edns_opt_rr) + CookieSecret::option_size];
 
 	WriteBuffer head{_head_buf, sizeof(_head_buf)};
 
 private:
-	const Zone& zone;
+	const Zone&	 zone;
+	ResponseCache*	 cache;
+	RateLimiter*	 rrl;
+	const ClientACL* acl;
+	LoadShedder*	 shed;
+	const CookieSecret* cookies;
+	UDPLimits	    udp;
+	bool		    minimal; // leave out glue that isn't required
 
 private:
 	std::string qname;
@@ -46,15 +82,61 @@ private:
 	uint16_t    rcode;
 	uint16_t    rx_id;
 	uint16_t    rx_flags;
+	uint16_t    min_bufsize; // the range of buffer sizes that would
+	uint16_t    max_bufsize; // get the same response, for the cache
 	uint8_t     qlabels;
 	bool	match;
 	bool	has_edns;
 	bool	do_bit;
 	bool	tcp;
+	bool	clamped; // cut down only by the payload limit
+
+private:
+	uint64_t key_generation;
+	uint32_t key_hash;
+	uint16_t key_len;
+	uint16_t key_qdsize;
+	uint16_t key_bufsize;
+
+private:
+	const in6_addr*	    client;
+	uint64_t	    identity; // of the response, for rate limiting
+	RateLimiter::Action limit;
+	bool		    limited; // whether limit has been determined
+	bool		    discard; // shed after the cache lookup
+
+private:
+	const in6_addr*	    peer;   // whoever sent the query, if known
+	const uint8_t*	    cookie; // the COOKIE option's data, if any
+	uint8_t		    cookie_len;
+	uint32_t	    cookie_time;
+	CookieSecret::Check cookie_check;
 
 public:
-	Context(const Zone& zone) : zone(zone){};
+	Context(const Zone& zone, ResponseCache* cache = nullptr, RateLimiter* rrl = nullptr,
+		const ClientACL* acl = nullptr, LoadShedder* shed = nullptr,
+		const CookieSecret* cookies = nullptr, UDPLimits udp = UDPLimits(),
+		bool minimal = false)
+	    : zone(zone), cache(cache), rrl(rrl), acl(acl), shed(shed), cookies(cookies), udp(udp),
+	      minimal(minimal){};
 
-	bool	 execute(ReadBuffer& in, std::vector<iovec>& iov, bool tcp = false);
+	// the client address is only needed for rate limiting, the ACL
+	// and cookies
+	bool	 execute(ReadBuffer& in, std::vector<iovec>& iov, bool tcp = false,
+			 const in6_addr* client = nullptr);
 	Answer::Type type() const;
+
+	// for traffic statistics, the response's RCODE and the query's
+	// lower-cased TLD label, if it got as far as having one
+	uint16_t response_code() const
+	{
+		return rcode;
+	}
+
+	// whether the client would have got more in a fragmented response
+	bool clamped_response() const
+	{
+		return clamped;
+	}
+	bool tld(const uint8_t*& label, size_t& len) const;
 };
@@ -0,0 +1,66 @@
+/*
+ * Copyright (C) Internet Systems Consortium, Inc. ("ISC")
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include <netinet/in.h>
+
+//
+// DNS Cookies (RFC 7873), with server cookies made as in RFC 9018: a
+// version, a timestamp and a SipHash-2-4 of those, the client cookie
+// and the client's address under a server secret.
+//
+// A secret is immutable, and holds the current key plus the one it
+// replaced, so that cookies issued just before a change stay valid.
+// The server makes a new one every "rollover" seconds, and publishes
+// it as it does the client ACL.
+//
+class CookieSecret {
+
+public:
+	static const size_t client_size = 8;
+	static const size_t server_size = 16;
+	static const size_t option_size = 4 + client_size + server_size; // as sent
+
+	// how often the server replaces its secret
+	static const unsigned rollover = 24 * 3600;
+
+	// the client's server cookie, if any
+	enum Check : uint8_t { missing, invalid, valid, fresh };
+
+private:
+	struct Key {
+		uint64_t k0, k1;
+	};
+
+	Key current;
+	Key previous;
+
+	static uint64_t siphash(const Key& key, const uint8_t* client, uint64_t header,
+				const in6_addr& addr);
+
+public:
+	// "fresh" means made with the current key less than half an hour
+	// ago, in which case it can just be sent back
+	Check check(const uint8_t* client, const uint8_t* server, size_t server_len,
+		    const in6_addr& addr, uint32_t now) const;
+
+	// writes a new server cookie
+	void make(const uint8_t* client, const in6_addr& addr, uint32_t now, uint8_t* out) const;
+
+	static uint32_t now(); // seconds since the epoch
+
+public:
+	// the given 16 byte key, or else a random one, replacing the prior
+	// secret's current key, if any
+	CookieSecret(const uint8_t* key = nullptr, const CookieSecret* prior = nullptr);
+};
@@ -0,0 +1,44 @@
+/*
+ * Copyright (C) Internet Systems Consortium, Inc. ("ISC")
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+//
+// A grace period for objects that the worker threads read through an
+// atomic pointer (the zone snapshot, the client ACL, the cookie
+// secret).  Each worker handles a packet within a Reader, and whoever
+// replaces such an object calls wait() after publishing the new one,
+// which returns once every Reader that might have seen the old one is
+// finished, so that it can then be freed.
+//
+// A Reader costs one store and a fence.  Workers that are idle, or
+// between packets, never hold up a wait().
+//
+class GracePeriod {
+
+public:
+	// a critical section, which must not be nested or call wait()
+	class Reader {
+	private:
+		std::atomic<uint64_t>& seq;
+
+	public:
+		Reader();
+		~Reader();
+
+		Reader(const Reader&) = delete;
+		Reader& operator=(const Reader&) = delete;
+	};
+
+	// returns once every Reader that existed when it was called is gone
+	static void wait();
+};
@@ -0,0 +1,126 @@
+/*
+ * Copyright (C) Internet Systems Consortium, Inc. ("ISC")
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ */
+
+#pragma once
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "answer.h"
+
+//
+// A precompiled zone snapshot, as written by froot-compile.  The image
+// is position independent (all references are byte offsets from the
+// start of the file) so that it can be mapped read-only and the answer
+// data served directly from the page cache, shared between processes.
+//
+// Layout:
+//
+//   Header
+//   Name[name_count]	  one per AnswerSet, sorted by key, which serves
+//			  both as the index and for predecessor lookups
+//   strings		  the (lower case) keys
+//   arena		  AnswerRecords, each 8 byte aligned
+//
+class ZoneImage {
+
+public:
+	static const uint32_t version = 2;
+
+	struct Header {
+		char	 magic[8];   // "FROOTIMG"
+		uint32_t version;
+		uint32_t byte_order; // 0x01020304, in the writer's byte order
+		uint64_t size;	     // of the whole file
+		uint64_t checksum;   // FNV-1a of everything after the header
+		uint32_t serial;
+		uint32_t flags;
+		uint32_t name_count;
+		uint32_t names;
+		uint32_t strings;
+		uint32_t strings_size;
+		uint32_t arena;
+		uint32_t arena_size;
+	};
+
+	enum Flags : uint32_t { compressed = 1 };
+
+	struct Name {
+		uint32_t key; // offset of the key in strings
+		uint32_t key_len;
+		uint32_t plain[Answer::Type::max]; // offset of each AnswerRecord, 0 if none
+		uint32_t dnssec[Answer::Type::max];
+	};
+
+	// an Answer, followed by its compression pointer offsets, its
+	// additional RR boundaries (one per ARCOUNT) and data
+	struct AnswerRecord {
+		uint16_t size;
+		uint16_t fix_offset;
+		uint16_t flags;
+		uint16_t ancount;
+		uint16_t nscount;
+		uint16_t arcount;
+		uint16_t n_offsets;
+		uint16_t required;
+	};
+
+	typedef std::vector<std::pair<std::string, const AnswerSet*>> Sets;
+
+private:
+	const uint8_t* base = nullptr;
+	size_t	       size = 0;
+
+private:
+	void check(bool ok, const char* what) const;
+	void verify() const;
+
+	const Header& header() const
+	{
+		return *reinterpret_cast<const Header*>(base);
+	};
+	const Name& name(size_t i) const;
+
+	std::shared_ptr<const Answer> answer(uint32_t offset,
+					     std::shared_ptr<const ZoneImage> self) const;
+
+public:
+	static bool is_image(const std::string& filename);
+	static void write(const std::string& filename, const Sets& sets, uint32_t serial,
+			  bool compress);
+
+	// create an AnswerSet for every name, in key order, sharing this
+	// image's memory
+	static void load(std::shared_ptr<const ZoneImage> image,
+			 std::vector<std::pair<std::string, std::shared_ptr<const AnswerSet>>>& out,
+			 AnswerSet::Stats* stats = nullptr);
+
+	uint32_t serial() const
+	{
+		return header().serial;
+	};
+	bool compress() const
+	{
+		return header().flags & Flags::compressed;
+	};
+	size_t count() const
+	{
+		return header().name_count;
+	};
+
+public:
+	ZoneImage(const std::string& filename);
+	~ZoneImage();
+
+	ZoneImage(const ZoneImage&) = delete;
+	ZoneImage& operator=(const ZoneImage&) = delete;
+};
@@ -0,0 +1,30 @@
+/*
+ * Copyright (C) Internet Systems Consortium, Inc. ("ISC")
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+//
+// Minimal NUMA support, using the topology in sysfs and the mbind(2)
+// system call directly rather than depending on libnuma.  On systems
+// without NUMA everything is reported as being on node 0.
+//
+
+extern unsigned		     numa_nodes();
+extern unsigned		     numa_cpu_to_node(unsigned cpu);
+extern std::vector<unsigned> numa_node_cpus(unsigned node);
+
+// prefer the given node for the (not yet faulted) pages in the range
+extern bool numa_bind_range(void* p, size_t len, unsigned node);
+
+// restrict the calling thread to the CPUs of the given node, keeping
+// to those it's already allowed to use if there are any
+extern void numa_pin_thread(unsigned node);
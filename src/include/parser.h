@@ -0,0 +1,87 @@
+/*
+ * Copyright (C) Internet Systems Consortium, Inc. ("ISC")
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ */
+
+#pragma once
+
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "zonedata.h"
+
+//
+// A streaming parser for RFC 1035 master files.  The file is mapped
+// into memory and each RR is converted directly into uncompressed wire
+// format and passed to the callback, without building any intermediate
+// per-RR objects.
+//
+// Only the RR types that can appear in the root zone have presentation
+// format parsers, but any type can be loaded using the RFC 3597 generic
+// syntax.  $ORIGIN and $TTL are supported, $INCLUDE is not.
+//
+class ZoneParser {
+
+public:
+	typedef std::function<void(const Record&)> Callback;
+
+	struct Token {
+		const char* p;
+		size_t	    n;
+		bool	    quoted;
+	};
+
+private:
+	const char* base = nullptr;
+	size_t	    size = 0;
+
+	// parser state
+	const char*	     pos = nullptr;
+	size_t		     line = 1;
+	size_t		     record_line = 1;
+	unsigned	     depth = 0;
+	std::vector<uint8_t> origin;
+	std::vector<uint8_t> owner;
+	uint32_t	     default_ttl;
+	uint32_t	     last_ttl;
+	bool		     have_ttl = false;
+
+	// scratch space for the current RR
+	std::vector<Token>   tokens;
+	std::vector<uint8_t> rdata;
+	std::vector<uint8_t> name;
+
+private:
+	bool next_record(bool& has_owner);
+	void directive();
+	void record(bool has_owner, const Callback& callback);
+	void rdata_from_text(uint16_t type, size_t i);
+	void rdata_generic(uint16_t type, size_t i);
+
+	void error(const std::string& msg) const;
+
+	void parse_name(const Token& t, std::vector<uint8_t>& out) const;
+	void parse_hex(size_t i, std::vector<uint8_t>& out) const;
+	void parse_base64(size_t i, std::vector<uint8_t>& out) const;
+	void parse_string(const Token& t, std::vector<uint8_t>& out) const;
+	void parse_bitmap(size_t i, std::vector<uint8_t>& out) const;
+
+	uint32_t parse_int(const Token& t, uint32_t max) const;
+	uint32_t parse_ttl(const Token& t) const;
+	uint32_t parse_time(const Token& t) const;
+	uint16_t parse_type(const Token& t) const;
+
+public:
+	void parse(const Callback& callback);
+
+	static bool type_from_string(const std::string& s, uint16_t& type);
+
+public:
+	ZoneParser(const std::string& filename, uint32_t default_ttl = 3600);
+	~ZoneParser();
+};
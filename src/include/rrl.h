@@ -0,0 +1,102 @@
+/*
+ * Copyright (C) Internet Systems Consortium, Inc. ("ISC")
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <netinet/in.h>
+
+//
+// Response Rate Limiting, along the lines of BIND's RRL.  Responses
+// are accounted to a token bucket per client prefix (/24 for IPv4,
+// /56 for IPv6 by default) and response identity: the AnswerSet and
+// answer type for positive answers and referrals, or just the RCODE
+// for NXDOMAIN and errors, so that random names can't evade the limit.
+//
+// A client over its rate has its responses dropped, except that every
+// "slip"th one is sent truncated (TC=1) so that a genuine client can
+// retry over TCP.  The bucket's debt is capped at "window" seconds, so
+// a client stays limited for at most that long once a flood stops.
+//
+// Each worker thread owns its own limiter, so no locking is required,
+// and enforces the full configured rates: a client's queries mostly
+// reach one worker (the NIC hashes its address), so sharing the rate
+// out would limit it to a fraction of that.  A client whose queries
+// are spread across N workers gets at most N times the rate.  The
+// counters are atomic only so that they can be read by the statistics
+// thread.
+//
+class RateLimiter {
+
+public:
+	enum Action : uint8_t { pass, drop, slip };
+	enum Category : uint8_t { responses, nxdomains, errors, categories };
+
+	struct Config {
+		unsigned rate[categories] = {0, 0, 0}; // per second, 0 == unlimited
+		unsigned slip = 2;
+		unsigned window = 15;	   // seconds
+		unsigned ipv4_prefix = 24; // bits
+		unsigned ipv6_prefix = 56;
+		unsigned size = 65536; // buckets per thread
+
+		bool enabled() const
+		{
+			return rate[responses] || rate[nxdomains] || rate[errors];
+		}
+
+		// "<rate>" or "name=value,..." (responses, nxdomains,
+		// errors, slip, window, ipv4-prefix, ipv6-prefix, size)
+		static Config parse(const std::string& spec);
+	};
+
+private:
+	struct Bucket {
+		uint64_t key = 0;
+		int64_t	 tat = 0;  // when the bucket would be full again, in ns
+		uint32_t slips = 0; // responses limited, for slipping
+	};
+
+	static const unsigned ways = 4; // buckets per hash set
+
+	std::vector<Bucket> buckets;
+	size_t		    mask;
+	int64_t		    interval[categories]; // ns per response, 0 == unlimited
+	int64_t		    burst;		  // ns
+	int64_t		    window;		  // ns
+	unsigned	    slip_every;
+	uint64_t	    ipv4_mask;
+	uint64_t	    ipv6_mask;
+
+	std::atomic<uint64_t> _dropped{0};
+	std::atomic<uint64_t> _slipped{0};
+
+	uint64_t key(const in6_addr& client, uint64_t identity) const;
+	Bucket&	 find(uint64_t key, int64_t now);
+
+public:
+	Action check(const in6_addr& client, uint64_t identity, Category category, int64_t now);
+	Action check(const in6_addr& client, uint64_t identity, Category category);
+
+	uint64_t dropped() const
+	{
+		return _dropped.load(std::memory_order_relaxed);
+	}
+	uint64_t slipped() const
+	{
+		return _slipped.load(std::memory_order_relaxed);
+	}
+
+public:
+	RateLimiter(const Config& config);
+};
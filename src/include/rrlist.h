@@ -9,22 +9,27 @@
 
 #pragma once
 
-#include <ldns/ldns.h>
-#include <memory>
+#include <cstddef>
 #include <vector>
 
+struct Record;
+
+//
+// an ordered list of (non-owning) references to records held
+// in a ZoneData object
+//
 class RRList {
 
 public:
-	typedef std::vector<std::shared_ptr<ldns_rr>> List;
+	typedef std::vector<const Record*> List;
 
 private:
 	List _list;
 
 public:
-	void append(const ldns_rr* rr);
-	void append(const ldns_dnssec_rrs* rrs);
-	void append(const ldns_dnssec_rrsets* rrset);
+	void append(const Record* rr);
+	void append(const RRList& rrs);
+	void reserve(size_t n);
 
 	RRList operator+(const RRList& rhs) const;
 
@@ -40,7 +45,7 @@ public:
 public:
 	RRList() = default;
 
-	RRList(const ldns_dnssec_rrsets* rrs);
-	RRList(const RRList& rhs);
-	RRList(RRList&& rhs);
+	RRList(const RRList& rhs) = default;
+	RRList(RRList&& rhs) = default;
+	RRList& operator=(const RRList& rhs) = default;
 };
@@ -9,7 +9,21 @@
 
 #pragma once
 
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "acl.h"
+#include "cache.h"
+#include "context.h"
+#include "cookie.h"
 #include "netserver/netserver.h"
+#include "rrl.h"
+#include "shed.h"
+#include "sketch.h"
+#include "xdp.h"
+#include "xfr.h"
 #include "zone.h"
 
 class DNSServer : public NetserverLayer {
@@ -17,8 +31,59 @@ class DNSServer : public NetserverLayer {
 private:
 	Zone zone;
 
+	size_t						    cache_size = 0;
+	mutable std::mutex				    cache_mutex;
+	mutable std::vector<std::unique_ptr<ResponseCache>> caches;
+
+	RateLimiter::Config				  rrl_config;
+	mutable std::vector<std::unique_ptr<RateLimiter>> limiters; // under cache_mutex
+
+	LoadShedder::Config				  shed_config;
+	mutable std::vector<std::unique_ptr<LoadShedder>> shedders; // ditto
+
+	size_t						      top_count = 0;
+	mutable std::vector<std::unique_ptr<TrafficRecorder>> recorders; // ditto
+
+	// each worker's count of responses cut down by the payload limit,
+	// padded so that the workers don't share cache lines
+	struct ClampCount {
+		std::atomic<uint64_t> count{0};
+		uint8_t		      pad[64 - sizeof(count)];
+	};
+
+	UDPLimits					 udp_limits;
+	bool						 minimal = false;
+	mutable std::vector<std::unique_ptr<ClampCount>> clamp_counts; // ditto
+
+	// the client ACL as seen by the worker threads, and its owner,
+	// with a replaced one freed after a grace period (see grace.h)
+	std::string			 acl_file;
+	std::atomic<const ClientACL*>	 acl{nullptr};
+	std::shared_ptr<const ClientACL> acl_current;
+
+	std::unique_ptr<XDPFilter> xdp;
+
+	// the server cookie secret, replaced every CookieSecret::rollover
+	// seconds and otherwise handled as the ACL is
+	std::atomic<const CookieSecret*>    cookies{nullptr};
+	std::shared_ptr<const CookieSecret> cookies_current;
+
 private:
-	void loader_thread(std::string filename, bool compress);
+	ResponseCache* cache() const;
+	RateLimiter*   rate_limiter() const;
+	LoadShedder*   shedder() const;
+	TrafficRecorder* recorder() const;
+	ClampCount*	 clamp_count() const;
+
+	void log_traffic(const TrafficSketch& traffic) const;
+	void reload_acl();
+	void update_blocklist();
+	void roll_cookie_secret();
+
+	void loader_thread(std::string filename, ZoneOptions options);
+	void transfer_thread(std::vector<ZoneTransfer::Primary> primaries, ZoneOptions options);
+	void stats_thread(unsigned int interval);
+	void cookie_thread();
 
 public:
 	void recv(NetserverPacket& p) const;
@@ -28,6 +93,19 @@ public:
 	}
 
 public:
-	void load(const std::string& filename, bool compress);
-	void load_sync(const std::string& filename, bool compress);
+	void load(const std::string& filename, const ZoneOptions& options);
+	void transfer(const std::vector<ZoneTransfer::Primary>& primaries,
+		      const ZoneOptions&			  options);
+	void load_sync(const std::string& filename, const ZoneOptions& options);
+
+	void set_cache_size(size_t size);
+	void set_rate_limit(const RateLimiter::Config& config);
+	void set_shedding(const LoadShedder::Config& config);
+	void set_top_count(size_t count);
+	void set_udp_limits(const UDPLimits& limits);
+	void set_minimal_responses(bool enable);
+	void set_acl(const std::string& filename);
+	void set_xdp(std::unique_ptr<XDPFilter> filter);
+	void enable_cookies();
+	void stats(unsigned int interval);
 };
@@ -0,0 +1,88 @@
+/*
+ * Copyright (C) Internet Systems Consortium, Inc. ("ISC")
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+//
+// Overload shedding.  Each worker is told how much of its receive ring
+// is waiting behind the packet in hand, and as that passes each class's
+// watermark the queries of that class are dropped unanswered, the least
+// valuable first: ANY without DO, then queries without EDNS, those for
+// non-existent names and finally those with DO.  ARP, neighbour
+// discovery, ICMP and TCP are never shed, so the server stays reachable
+// and clients that fall back to TCP are still answered.
+//
+// Like RateLimiter there is one per worker thread, with counters that
+// are atomic only for the statistics thread's sake.
+//
+class LoadShedder {
+
+public:
+	enum Class : uint8_t { any, noedns, nxdomain, dnssec, classes };
+
+	struct Config {
+		unsigned watermark[classes] = {0, 0, 0, 0}; // % of the ring, 0 == never
+
+		bool enabled() const
+		{
+			return watermark[any] || watermark[noedns] || watermark[nxdomain] ||
+			       watermark[dnssec];
+		}
+
+		// "<percent>", the others following at even steps up to 100%,
+		// or "name=value,..." (any, noedns, nxdomain, do)
+		static Config parse(const std::string& spec);
+	};
+
+private:
+	unsigned watermark[classes];
+	unsigned active = 0; // bitmap of the classes being shed
+
+	std::atomic<uint64_t> _shed[classes];
+
+public:
+	void set_backlog(unsigned percent)
+	{
+		active = 0;
+		for (auto i = 0U; i < classes; ++i) {
+			if (watermark[i] && percent >= watermark[i]) {
+				active |= 1U << i;
+			}
+		}
+	}
+
+	bool shedding() const
+	{
+		return active;
+	}
+
+	// whether to drop a query of this class, counting it if so
+	bool shed(Class c)
+	{
+		if (!(active & (1U << c))) {
+			return false;
+		}
+		// only this worker writes the count, so no locked increment
+		_shed[c].store(_shed[c].load(std::memory_order_relaxed) + 1,
+			       std::memory_order_relaxed);
+		return true;
+	}
+
+	uint64_t shed_count(Class c) const
+	{
+		return _shed[c].load(std::memory_order_relaxed);
+	}
+
+public:
+	LoadShedder(const Config& config);
+};
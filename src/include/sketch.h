@@ -0,0 +1,112 @@
+/*
+ * Copyright (C) Internet Systems Consortium, Inc. ("ISC")
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <netinet/in.h>
+
+//
+// Fixed size summaries of the query stream, used to find the heaviest
+// clients, client networks, queried TLDs and non-existent TLDs.
+//
+// Each stream has a Count-Min sketch, which gives an overestimate of
+// any key's count, plus a small table of the keys with the highest
+// estimates seen so far.  A key that can't displace the smallest of
+// those costs just its hash and the sketch update.  Sketches of the
+// same shape can be merged by adding their counters and pooling their
+// candidate keys.
+//
+class TrafficSketch {
+
+public:
+	enum Stream : uint8_t { clients, prefixes, tlds, nxdomains, streams };
+
+	static const size_t capacity = 32; // candidate keys per stream
+
+	struct Key {
+		uint8_t len = 0;
+		uint8_t data[63]; // an IPv6 address or a DNS label
+	};
+
+	struct Item {
+		uint64_t hash = 0;
+		uint64_t count = 0;
+		Key	 key;
+	};
+
+private:
+	static const size_t depth = 4;
+	static const size_t width = 1024;
+
+	struct Summary {
+		uint32_t	  counts[depth * width];
+		std::vector<Item> items;
+		uint64_t	  min = 0; // smallest count in a full table
+
+		uint64_t estimate(uint64_t hash) const;
+		uint64_t increment(uint64_t hash);
+		void	 offer(uint64_t hash, uint64_t count, const void* key, size_t len);
+	};
+
+	Summary	 summary[streams];
+	uint64_t _total = 0;
+
+	void add(Stream stream, const void* key, size_t len);
+
+public:
+	// records one query, the TLD label being lower-cased and the
+	// client address IPv4-mapped if necessary
+	void record(const in6_addr& client, const uint8_t* tld, size_t len, bool nxdomain);
+
+	void merge(const TrafficSketch& other);
+	void clear();
+
+	uint64_t	  total() const
+	{
+		return _total;
+	}
+	std::vector<Item> top(Stream stream, size_t n) const;
+
+	static std::string text(Stream stream, const Key& key);
+
+public:
+	TrafficSketch();
+};
+
+//
+// A worker thread's sketch, double buffered so that the statistics
+// thread can take it away without stopping the worker.  The worker
+// only ever loads the active pointer; collect() swaps it and then
+// waits out a grace period, so record() must be called within a
+// GracePeriod::Reader.
+//
+class TrafficRecorder {
+
+private:
+	std::unique_ptr<TrafficSketch> buffers[2];
+	std::atomic<TrafficSketch*>    active;
+
+public:
+	void record(const in6_addr& client, const uint8_t* tld, size_t len, bool nxdomain)
+	{
+		active.load(std::memory_order_acquire)->record(client, tld, len, nxdomain);
+	}
+
+	// adds everything recorded since the last call to "into"
+	void collect(TrafficSketch& into);
+
+public:
+	TrafficRecorder();
+};
@@ -9,7 +9,25 @@
 
 #pragma once
 
+#include <string>
 #include <thread>
+#include <vector>
+
+typedef std::vector<unsigned> CPUList;
+
+// parses (and formats) a CPU list such as "0,2-5", as used by taskset(1)
+extern CPUList	   cpu_list(const std::string& spec);
+extern std::string cpu_list_text(const CPUList& cpus);
 
 extern void thread_setcpu(std::thread& t, unsigned int n);
 extern void thread_setname(std::thread& t, const std::string& name);
+
+//
+// Housekeeping threads (the zone loader, statistics and the like) are
+// kept on their own CPUs, away from the workers, with SCHED_BATCH (or
+// SCHED_IDLE) and a positive nice value.  Any threads that they start,
+// e.g. to build a zone, inherit the same settings.
+//
+extern void housekeeping_configure(const CPUList& cpus, bool idle, int nice);
+extern void housekeeping_enter(); // applies them to the calling thread
+extern void housekeeping_pin();	  // just the CPUs, keeping the normal priority
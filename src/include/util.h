@@ -15,8 +15,10 @@
 #include <string>
 
 extern void	throw_errno(const std::string& what);
+extern uint8_t	lower(uint8_t c);
 extern std::string strlower(const uint8_t* buf, size_t n);
 extern void	hexdump(std::ostream&, const void* buf, size_t n);
+extern uint64_t	fnv1a64(const void* buf, size_t n, uint64_t h = 14695981039346656037ULL);
 
 extern std::string inet_ntop(const in_addr& addr);
 extern std::string inet_ntop(const in6_addr& addr);
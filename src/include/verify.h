@@ -0,0 +1,48 @@
+/*
+ * Copyright (C) Internet Systems Consortium, Inc. ("ISC")
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ */
+
+#pragma once
+
+#include <ctime>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "zonedata.h"
+
+//
+// Checks a zone before it is published: its ZONEMD digest (RFC 8976)
+// and the RRSIGs over every authoritative RRset, against the zone's
+// own DNSKEYs.  The names are shared out between a pool of threads,
+// the first of which also computes the digest.
+//
+class ZoneVerifier {
+
+private:
+	struct Key; // a DNSKEY and the corresponding OpenSSL public key
+
+	const ZoneData&			  zone;
+	std::vector<std::unique_ptr<Key>> keys;
+	uint32_t			  now;
+
+	void   load_keys();
+	void   check_digest() const;
+	size_t check_signatures(const ZoneNode& node) const;
+	bool   check_signature(const Record& sig, const std::vector<const Record*>& rrset,
+			       std::string& why) const;
+
+public:
+	// returns the number of signatures checked, or throws if the
+	// zone fails verification
+	size_t verify(unsigned threads);
+
+public:
+	ZoneVerifier(const ZoneData& zone, time_t now = ::time(nullptr));
+	~ZoneVerifier();
+};
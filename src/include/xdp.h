@@ -0,0 +1,73 @@
+/*
+ * Copyright (C) Internet Systems Consortium, Inc. ("ISC")
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include <netinet/in.h>
+
+#include "acl.h"
+
+struct bpf_object;
+struct bpf_link;
+
+//
+// The optional XDP pre-filter (see xdpfilter.bpf.c), which drops
+// blocklisted, malformed and over-rate queries in the driver.  It is
+// only available when built with "make XDP=1", otherwise constructing
+// one throws.
+//
+// The program stays attached only while this object exists, so it
+// can't outlive the server.
+//
+class XDPFilter {
+
+public:
+	struct Counters {
+		uint64_t blocked = 0;
+		uint64_t malformed = 0;
+		uint64_t limited = 0;
+		uint64_t passed = 0;
+	};
+
+private:
+	bpf_object* obj = nullptr;
+	bpf_link*   link = nullptr;
+
+	int config_fd = -1;
+	int blocklist4_fd = -1;
+	int blocklist6_fd = -1;
+	int counters_fd = -1;
+
+	in_addr	 addr;
+	in6_addr addr6;
+	uint16_t port;
+
+	void close();
+
+public:
+	// per /24 or /56 source prefix, or zero for no limit
+	void set_rate(unsigned rate);
+
+	// drops everything from the clients that the ACL drops
+	void set_blocklist(const ClientACL& acl);
+
+	Counters counters() const;
+
+public:
+	// IPv6 isn't filtered if addr6 is the unspecified address
+	XDPFilter(const std::string& object, const std::string& ifname, const in_addr& addr,
+		  const in6_addr& addr6, uint16_t port);
+	~XDPFilter();
+
+	XDPFilter(const XDPFilter&) = delete;
+	XDPFilter& operator=(const XDPFilter&) = delete;
+};
@@ -0,0 +1,45 @@
+/*
+ * Copyright (C) Internet Systems Consortium, Inc. ("ISC")
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ */
+
+#pragma once
+
+//
+// The maps shared between the XDP pre-filter (xdpfilter.bpf.c) and
+// XDPFilter, so this has to stay plain C.
+//
+
+#include <linux/types.h>
+
+#define XDP_BLOCKLIST_SIZE 65536 // prefixes per address family
+#define XDP_SOURCES_SIZE 262144	 // rate limited source prefixes
+
+// the "counters" map, by reason for the packet's fate
+enum xdp_counter { xdp_blocked, xdp_malformed, xdp_limited, xdp_passed, xdp_counters };
+
+// the single entry of the "config" map
+struct xdp_config {
+	__u32 addr;		// the server's IPv4 address, in network order
+	__u16 port;		// the DNS port, in network order
+	__u16 has_addr6;	// zero if IPv6 is passed unfiltered
+	__u32 addr6[4];		// the server's IPv6 address, in network order
+	__u64 interval;		// ns per query from a source prefix, or 0 for no limit
+	__u64 burst;		// ns that a source prefix may run ahead by
+};
+
+// the "blocklist4" and "blocklist6" LPM keys, whose value is non-zero
+// if the prefix is to be dropped
+struct xdp_key4 {
+	__u32 bits;
+	__u8  addr[4];
+};
+
+struct xdp_key6 {
+	__u32 bits;
+	__u8  addr[16];
+};
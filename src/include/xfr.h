@@ -0,0 +1,80 @@
+/*
+ * Copyright (C) Internet Systems Consortium, Inc. ("ISC")
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ */
+
+#pragma once
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <sys/socket.h>
+
+#include "zonedata.h"
+
+//
+// A zone transfer client for the root zone.  It keeps its own copy of
+// the zone's records, which it updates with IXFR (RFC 1995) when the
+// primary's SOA serial changes, falling back to AXFR (RFC 5936) if the
+// primary can't supply the differences.  Each primary is tried in turn.
+//
+class ZoneTransfer {
+
+public:
+	struct Primary {
+		sockaddr_storage addr;
+		socklen_t	 addrlen;
+		std::string	 name;
+	};
+
+	// parses "address" or "address#port"
+	static Primary primary(const std::string& spec);
+
+private:
+	// the records, each in uncompressed wire format, keyed on their
+	// lower-cased owner, type, class and RDATA (i.e. not the TTL)
+	typedef std::map<std::string, std::string> Records;
+
+	std::vector<Primary> primaries;
+	Records		     records;
+	std::string	     soa; // the zone's SOA record
+	bool		     loaded = false;
+
+	// the result of the last transfer, until it is committed
+	Records	    pending_records;
+	std::string pending_soa; // empty if there's nothing pending
+
+	static std::string key(const std::string& rr);
+
+	int		  connect(const Primary& p) const;
+	std::vector<std::string> exchange(const Primary& p, uint16_t qtype) const;
+
+	uint32_t query_serial(const Primary& p) const;
+	bool	 apply(const std::vector<std::string>& rrs);
+	bool	 transfer(const Primary& p, bool incremental);
+
+public:
+	// fetch any changes from the first primary that responds, returning
+	// true if the zone has changed.  The changes are pending until
+	// commit() is called, and are discarded by the next refresh(), so
+	// that a zone that fails to load is transferred again.
+	bool refresh();
+	void commit();
+
+	// builds a ZoneData from the pending records, if any, otherwise
+	// from the current ones
+	std::shared_ptr<ZoneData> zone() const;
+
+	uint32_t serial() const;
+	uint32_t refresh_interval() const; // from the SOA, in seconds
+	uint32_t retry_interval() const;
+
+public:
+	ZoneTransfer(const std::vector<Primary>& primaries);
+};
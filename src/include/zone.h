@@ -9,41 +9,128 @@
 
 #pragma once
 
+#include <atomic>
 #include <map>
 #include <memory>
 #include <string>
+#include <thread>
 #include <unordered_map>
+#include <vector>
 
-#include <ldns/ldns.h>
-
+#include "answer.h"
 #include "context.h"
+#include "zonedata.h"
+
+class Arena;
 
-class AnswerSet;
+struct ZoneOptions {
+	bool	 compress = true;   // use name compression in answers
+	unsigned threads = 1;	    // number of threads used to build answers
+	bool	 hugepages = false; // put the answer arena in huge pages
+	bool	 lock = false;	    // lock the answer arena into memory
+	bool	 numa = false;	    // keep a copy of the answers on each NUMA node
+	bool	 lazy = false;	    // publish first, compile answers on first use
+	bool	 background = false; // and compile the rest in the background
+	bool	 verify = false;     // check ZONEMD and signatures before publishing
+};
 
 class Zone {
 
 private:
-	typedef std::map<std::string, std::shared_ptr<const AnswerSet>>		  Data;
-	typedef std::unordered_map<std::string, std::shared_ptr<const AnswerSet>> Aux;
+	// the AnswerSet for one name, which if the snapshot was loaded
+	// lazily is only compiled (by whichever thread first needs it)
+	// from the ZoneNode the first time it is used
+	struct Entry {
+		std::atomic<const AnswerSet*>	 set{nullptr};
+		std::shared_ptr<const AnswerSet> owned; // if compiled up front
+		const ZoneNode*			 node = nullptr;
+
+		Entry(std::shared_ptr<const AnswerSet> set);
+		Entry(const ZoneNode* node);
+		~Entry();
+	};
+
+	typedef std::shared_ptr<Entry>			      PEntry;
+	typedef std::map<std::string, PEntry>		      Data;
+	typedef std::unordered_map<std::string, PEntry> Aux;
+
+	struct Snapshot {
+		Data	 data;
+		Aux	 aux;
+		bool	 compress;
+		uint32_t serial;
+		size_t	 reused; // answers shared with the previous snapshot
+
+		AnswerSet::Stats stats; // answers before and after merging duplicates
+
+		AnswerSet::Arenas arenas; // empty if loaded from an image or lazily
+
+		// the source of the answers, if loaded lazily
+		std::shared_ptr<const ZoneData> zone;
+
+		// node-local copies of this snapshot, indexed by NUMA node
+		std::vector<std::shared_ptr<const Snapshot>> replicas;
+	};
 
-	typedef std::shared_ptr<Data> PData;
-	typedef std::shared_ptr<Aux>  PAux;
+	typedef std::shared_ptr<const Snapshot> PSnapshot;
 
 private:
-	PData data;
-	PAux  aux;
-	bool  loaded = false;
+	// the published snapshot, as seen by the worker threads
+	std::atomic<const Snapshot*> snapshot{nullptr};
+
+	// ownership of the current snapshot.  The previous one is only
+	// released once no worker thread can still be using it (grace.h).
+	PSnapshot current;
+
+	std::atomic<uint64_t> _generation{0};
+
+	// compiles the rest of a lazily built snapshot (-W), stopping once
+	// it's no longer the published one
+	std::thread completer;
 
 private:
-	void build_answers(PData& data, PAux& aux, const ldns_dnssec_zone* zone,
-			   const ldns_dnssec_name* name, bool compress);
-	void check_zone(const ldns_dnssec_zone* zone);
-	void build_zone(const ldns_dnssec_zone* zone, bool compress);
+	typedef std::vector<const ZoneNode*>		      Names;
+	typedef std::vector<std::shared_ptr<const AnswerSet>> Sets;
+
+	static std::string key(const ZoneNode* name);
+
+	size_t build_answers(Sets& sets, const Names& names, const ZoneData& zone,
+			     const ZoneOptions& options, const Snapshot* previous);
+	void check_zone(const ZoneData& zone);
+	void verify_zone(const ZoneData& zone, const ZoneOptions& options);
+	void build_zone(const ZoneData& zone, const ZoneOptions& options);
+	void build_lazy(std::shared_ptr<const ZoneData> zone, const ZoneOptions& options);
+	void complete(PSnapshot snapshot);
+
+	static const AnswerSet* materialise(const Snapshot& snapshot, Entry& entry);
+	bool unchanged(uint32_t serial, bool force) const;
+	bool load_image(const std::string& filename, const ZoneOptions& options, bool notice,
+			bool force);
+	void replicate(Snapshot& snapshot, const ZoneOptions& options);
+	void publish(PSnapshot snapshot);
 
 public:
-	void		 load(const std::string& filename, bool compress, bool notice = true);
+	// loads either a master file or a compiled image (see image.h).
+	// Unless forced, nothing is compiled or published if the SOA serial
+	// is the same as that of the current snapshot, returning false.
+	bool		 load(const std::string& filename, const ZoneOptions& options,
+			      bool notice = true, bool force = true);
+
+	// as above, from zone data that has already been parsed
+	bool load(std::shared_ptr<const ZoneData> zone, const ZoneOptions& options,
+		  bool notice = true, bool force = true);
+	void		 save(const std::string& filename) const;
 	const AnswerSet* lookup(const std::string& qname, bool& match) const;
 
+	// sets the NUMA node whose replica the calling thread will use
+	static void set_numa_node(unsigned node);
+
+	// incremented each time a new version of the zone is published
+	uint64_t generation() const
+	{
+		return _generation.load(std::memory_order_acquire);
+	};
+
 public:
 	Zone();
 	~Zone();
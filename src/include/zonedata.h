@@ -0,0 +1,99 @@
+/*
+ * Copyright (C) Internet Systems Consortium, Inc. ("ISC")
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "rrlist.h"
+
+//
+// A resource record in uncompressed wire format.  The owner name and
+// RDATA point into storage owned by whoever emitted the record.
+//
+struct Record {
+	const uint8_t* owner;
+	const uint8_t* rdata;
+	uint32_t       ttl;
+	uint16_t       type;
+	uint16_t       klass;
+	uint16_t       rdlen;
+
+	// for RRSIGs, the type covered, otherwise the type itself
+	uint16_t covered() const;
+};
+
+//
+// all of the records at a single owner name, sorted into canonical
+// order with duplicates removed
+//
+struct ZoneNode {
+	const uint8_t*		   name;
+	std::vector<const Record*> records;
+	bool			   glue = false;
+
+	// the RRset of the given type, followed by its signatures
+	RRList rrset(uint16_t type) const;
+	void   rrset(uint16_t type, RRList& out) const; // appends to out
+	bool   has(uint16_t type) const;
+};
+
+//
+// A compact in-memory representation of a zone, as emitted by the
+// master file parser (or a zone transfer) and consumed by the answer
+// compiler.
+//
+class ZoneData {
+
+private:
+	typedef std::vector<uint8_t> Chunk;
+
+	std::deque<Chunk>			  storage;
+	std::deque<Record>			  records;
+	std::unordered_map<std::string, ZoneNode> nodes;
+	std::vector<const ZoneNode*>		  sorted;
+	const ZoneNode*				  _apex = nullptr;
+
+private:
+	uint8_t* allocate(size_t n);
+
+public:
+	void add(const Record& rr);
+	void finish();
+
+	const ZoneNode* find(const uint8_t* name) const;
+
+	const ZoneNode* apex() const
+	{
+		return _apex;
+	};
+	const std::vector<const ZoneNode*>& names() const
+	{
+		return sorted;
+	};
+	size_t count() const
+	{
+		return records.size();
+	};
+
+	uint32_t serial() const;
+
+public:
+	static size_t	   name_length(const uint8_t* name);
+	static std::string name_key(const uint8_t* name);
+	static int	   name_compare(const uint8_t* a, const uint8_t* b);
+	static bool	   is_subdomain(const uint8_t* name, const uint8_t* parent);
+	static std::string rr_to_string(const Record& rr);
+	static void	   rr_append(std::string& out, const Record& rr);
+};
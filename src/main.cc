@@ -7,14 +7,21 @@
  *
  */
 
+#include <algorithm>
 #include <cstdlib>
+#include <cstring>
 #include <iostream>
+#include <memory>
 #include <thread>
 #include <vector>
 
 #include <arpa/inet.h>
+#include <net/if.h>
 #include <netinet/in.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
 #include <syslog.h>
+#include <unistd.h>
 
 #include "netserver/afpacket.h"
 #include "netserver/arp.h"
@@ -25,6 +32,7 @@
 #include "netserver/tcp.h"
 #include "netserver/udp.h"
 
+#include "numa.h"
 #include "server.h"
 #include "thread.h"
 #include "util.h"
@@ -33,6 +41,27 @@
 #define TO_STRING(x) STRINGIFY(x)
 static const char prefix[] = TO_STRING(PREFIX);
 
+// the IPv6 link-local address that the workers answer on, as they derive it
+static in6_addr link_local(const char* ifname)
+{
+	ifreq ifr = {};
+	::strncpy(ifr.ifr_name, ifname, IFNAMSIZ - 1);
+
+	auto fd = ::socket(AF_INET, SOCK_DGRAM, 0);
+	if (fd < 0) {
+		throw_errno("socket(AF_INET)");
+	}
+	auto res = ::ioctl(fd, SIOCGIFHWADDR, &ifr);
+	::close(fd);
+	if (res < 0) {
+		throw_errno("ioctl(SIOCGIFHWADDR)");
+	}
+
+	ether_addr hwaddr;
+	::memcpy(&hwaddr, &ifr.ifr_hwaddr.sa_data, sizeof hwaddr);
+	return Netserver_IPv6::ether_to_link_local(hwaddr);
+}
+
 void usage(int result = EXIT_FAILURE)
 {
 	using namespace std;
@@ -42,7 +71,38 @@ void usage(int result = EXIT_FAILURE)
 	cout << "  -s the IP address to answer on" << endl;
 	cout << "  -p the UDP port to listen on (default: 53)" << endl;
 	cout << "  -f the zone file to load (default: " << prefix << "/etc/root.zone)" << endl;
-	cout << "  -T the number of threads to run (default: ncpus)" << endl;
+	cout << "  -X transfer the zone from this primary (<addr>[#port], may be repeated)"
+	     << endl;
+	cout << "  -T the number of threads to run (default: ncpus, or one per -c CPU)" << endl;
+	cout << "  -c the CPUs to run the worker threads on, e.g. 2-7 (default: 0..threads-1)"
+	     << endl;
+	cout << "  -k the CPUs for housekeeping threads (default: those not used by workers)"
+	     << endl;
+	cout << "  -n the nice value of housekeeping threads (default: 10)" << endl;
+	cout << "  -I run housekeeping threads with SCHED_IDLE rather than SCHED_BATCH" << endl;
+	cout << "  -B the number of threads used to build the zone (default: min(4, ncpus))" << endl;
+	cout << "  -C disable name compression" << endl;
+	cout << "  -H put compiled answers in huge pages" << endl;
+	cout << "  -L lock compiled answers into memory" << endl;
+	cout << "  -N keep a copy of the compiled answers on each NUMA node" << endl;
+	cout << "  -Z compile answers on first use instead of at load time" << endl;
+	cout << "  -W as -Z, then compile the remaining answers in the background" << endl;
+	cout << "  -V verify the zone's ZONEMD digest and signatures before serving it" << endl;
+	cout << "  -q the per-thread response cache size (default: 1024, 0 to disable)" << endl;
+	cout << "  -A the client ACL file, of \"<prefix> allow|refuse|drop\" lines" << endl;
+	cout << "  -R rate limit responses, e.g. 20 or responses=20,nxdomains=10,slip=2"
+	     << endl;
+	cout << "  -x load the XDP pre-filter from this object (needs make XDP=1)" << endl;
+	cout << "  -r with -x, drop queries per /24 or /56 above this rate (default: off)" << endl;
+	cout << "  -K send DNS cookies, and don't rate limit clients that return them" << endl;
+	cout << "  -U the largest UDP response to send, to avoid fragmentation (default: 1232)"
+	     << endl;
+	cout << "  -E the UDP buffer size to advertise in responses (default: 1232)" << endl;
+	cout << "  -M minimal responses, with only the glue that referrals require" << endl;
+	cout << "  -O shed queries when the receive ring is this % full, e.g. 50 or" << endl;
+	cout << "     any=50,noedns=60,nxdomain=70,do=80" << endl;
+	cout << "  -S the statistics logging interval in seconds (default: off)" << endl;
+	cout << "  -t log the top N clients, networks and TLDs with the statistics" << endl;
 
 	exit(result);
 }
@@ -52,20 +112,67 @@ int app(int argc, char* argv[])
 	const char* zfname = TO_STRING(PREFIX) "/etc/root.zone";
 	const char* ifname = nullptr;
 	const char* ipaddr = nullptr;
+	const char* aclname = nullptr;
+	const char* xdpname = nullptr;
+	unsigned    xdp_rate = 0;
 	uint16_t    port = 53;
 	auto	max_threads = std::thread::hardware_concurrency();
-	auto	threads = max_threads;
-	auto	compress = true;
+	unsigned    threads = 0; // default: one per worker CPU, or ncpus
+	size_t      cache_size = 1024;
+	unsigned    stats_interval = 0;
+	size_t      top_count = 0;
+	bool	    cookies = false;
+	bool	    minimal = false;
+	unsigned    udp_payload = 1232;
+	unsigned    edns_bufsize = Answer::edns_bufsize;
+
+	std::vector<ZoneTransfer::Primary> primaries;
+
+	CPUList worker_cpus;
+	CPUList housekeeping_cpus;
+	int	housekeeping_nice = 10;
+	bool	housekeeping_idle = false;
+
+	RateLimiter::Config rrl_config;
+	LoadShedder::Config shed_config;
+
+	ZoneOptions zone_options;
+	zone_options.threads = std::min(4U, max_threads);
 
 	int opt;
-	while ((opt = getopt(argc, argv, "i:f:s:p:T:Ch")) != -1) {
+	while ((opt = getopt(argc, argv, "i:f:s:p:T:B:q:S:X:c:k:n:R:t:A:x:r:O:U:E:KMCHLNZWVIh")) !=
+	       -1) {
 		switch (opt) {
 		case 'i': ifname = optarg; break;
 		case 'f': zfname = optarg; break;
 		case 's': ipaddr = optarg; break;
 		case 'p': port = atoi(optarg); break;
 		case 'T': threads = atoi(optarg); break;
-		case 'C': compress = false; break;
+		case 'c': worker_cpus = cpu_list(optarg); break;
+		case 'k': housekeeping_cpus = cpu_list(optarg); break;
+		case 'n': housekeeping_nice = atoi(optarg); break;
+		case 'I': housekeeping_idle = true; break;
+		case 'q': cache_size = atoi(optarg); break;
+		case 'S': stats_interval = atoi(optarg); break;
+		case 't': top_count = atoi(optarg); break;
+		case 'A': aclname = optarg; break;
+		case 'x': xdpname = optarg; break;
+		case 'r': xdp_rate = atoi(optarg); break;
+		case 'R': rrl_config = RateLimiter::Config::parse(optarg); break;
+		case 'K': cookies = true; break;
+		case 'M': minimal = true; break;
+		case 'U': udp_payload = atoi(optarg); break;
+		case 'E': edns_bufsize = atoi(optarg); break;
+		case 'O': shed_config = LoadShedder::Config::parse(optarg); break;
+		case 'X': primaries.push_back(ZoneTransfer::primary(optarg)); break;
+		case 'B': zone_options.threads = atoi(optarg); break;
+		case 'C': zone_options.compress = false; break;
+		case 'H': zone_options.hugepages = true; break;
+		case 'L': zone_options.lock = true; break;
+		case 'N': zone_options.numa = true; break;
+		case 'Z': zone_options.lazy = true; break;
+		case 'W': zone_options.background = true; break;
+		case 'V': zone_options.verify = true; break;
 		case 'h': usage(EXIT_SUCCESS);
 		default: usage();
 		}
@@ -81,16 +188,125 @@ int app(int argc, char* argv[])
 		return EXIT_FAILURE;
 	}
 
+	if (udp_payload < 512 || udp_payload > UINT16_MAX || edns_bufsize < 512 ||
+	    edns_bufsize > UINT16_MAX) {
+		std::cerr << "UDP sizes must be from 512 to 65535" << std::endl;
+		return EXIT_FAILURE;
+	}
+	UDPLimits udp_limits;
+	udp_limits.payload = udp_payload;
+	udp_limits.advertise = edns_bufsize;
+
 	// configure syslog
 	openlog("froot", LOG_PID | LOG_CONS, LOG_DAEMON);
 
-	DNSServer server;
-	server.load(zfname, compress);
-
 	// limit thread range
+	if (!threads) {
+		threads = worker_cpus.empty() ? max_threads : worker_cpus.size();
+	}
 	threads = std::min(threads, max_threads);
 	threads = std::max(1U, threads);
 
+	if (worker_cpus.empty()) {
+		for (auto i = 0U; i < threads; ++i) {
+			worker_cpus.push_back(i);
+		}
+	}
+
+	// housekeeping gets every CPU that the workers don't use
+	if (housekeeping_cpus.empty()) {
+		for (auto cpu = 0U; cpu < max_threads; ++cpu) {
+			if (!std::binary_search(worker_cpus.begin(), worker_cpus.end(), cpu)) {
+				housekeeping_cpus.push_back(cpu);
+			}
+		}
+	}
+
+	housekeeping_configure(housekeeping_cpus, housekeeping_idle, housekeeping_nice);
+	syslog(LOG_NOTICE, "workers on CPUs %s, housekeeping on CPUs %s (%s, nice %d)",
+	       cpu_list_text(worker_cpus).c_str(),
+	       housekeeping_cpus.empty() ? "any" : cpu_list_text(housekeeping_cpus).c_str(),
+	       housekeeping_idle ? "SCHED_IDLE" : "SCHED_BATCH", housekeeping_nice);
+
+	DNSServer server;
+	server.set_cache_size(cache_size);
+	if (aclname) {
+		server.set_acl(aclname);
+	}
+	if (xdpname) {
+		std::unique_ptr<XDPFilter> xdp(
+		    new XDPFilter(xdpname, ifname, host, link_local(ifname), port));
+		xdp->set_rate(xdp_rate);
+		server.set_xdp(std::move(xdp));
+		syslog(LOG_NOTICE, "XDP pre-filter attached to %s", ifname);
+	}
+	server.set_rate_limit(rrl_config);
+	if (rrl_config.enabled()) {
+		syslog(LOG_NOTICE,
+		       "rate limiting to %u responses, %u NXDOMAIN and %u errors per second "
+		       "(slip %u, window %us, /%u and /%u prefixes)",
+		       rrl_config.rate[RateLimiter::responses], rrl_config.rate[RateLimiter::nxdomains],
+		       rrl_config.rate[RateLimiter::errors], rrl_config.slip, rrl_config.window,
+		       rrl_config.ipv4_prefix, rrl_config.ipv6_prefix);
+	}
+	server.set_udp_limits(udp_limits);
+	syslog(LOG_NOTICE, "UDP responses limited to %u bytes, advertising %u", udp_payload,
+	       edns_bufsize);
+	server.set_minimal_responses(minimal);
+	if (minimal) {
+		syslog(LOG_NOTICE, "minimal responses enabled");
+	}
+	if (cookies) {
+		server.enable_cookies();
+		syslog(LOG_NOTICE, "DNS cookies enabled");
+	}
+	server.set_shedding(shed_config);
+	if (shed_config.enabled()) {
+		syslog(LOG_NOTICE,
+		       "shedding ANY at %u%%, non-EDNS at %u%%, NXDOMAIN at %u%% and DO at %u%% "
+		       "of the receive ring",
+		       shed_config.watermark[LoadShedder::any],
+		       shed_config.watermark[LoadShedder::noedns],
+		       shed_config.watermark[LoadShedder::nxdomain],
+		       shed_config.watermark[LoadShedder::dnssec]);
+	}
+	if (primaries.empty()) {
+		server.load(zfname, zone_options);
+	} else {
+		server.transfer(primaries, zone_options);
+	}
+
+	if (stats_interval) {
+		server.set_top_count(top_count);
+		server.stats(stats_interval);
+	}
+
+	// ARP, ICMP and neighbour discovery have a socket of their own, so
+	// that the service stays reachable however busy the workers are
+	auto control = std::thread([&]() {
+		housekeeping_pin();
+
+		auto raw = Netserver_AFPacket(ifname, Netserver_AFPacket::control);
+		auto arp = Netserver_ARP(raw.gethwaddr(), host);
+
+		const in6_addr ll = Netserver_IPv6::ether_to_link_local(raw.gethwaddr());
+		auto	       ipv6 = Netserver_IPv6({ll});
+		auto	       ipv4 = Netserver_IPv4(host);
+
+		auto icmp4 = Netserver_ICMP();
+		auto icmp6 = Netserver_ICMPv6(raw.gethwaddr());
+
+		arp.attach(raw);
+		ipv4.attach(raw);
+		ipv6.attach(raw);
+
+		icmp4.attach(ipv4);
+		icmp6.attach(ipv6);
+
+		raw.loop();
+	});
+	thread_setname(control, "control");
+
 	syslog(LOG_NOTICE, "starting %d worker threads", threads);
 	std::vector<std::thread> workers(threads);
 
@@ -98,27 +314,22 @@ int app(int argc, char* argv[])
 
 		workers[i] = std::thread(
 		    [&](int n) {
-			    auto raw = Netserver_AFPacket(ifname);
-			    auto arp = Netserver_ARP(raw.gethwaddr(), host);
+			    // use the zone replica local to the CPU this thread is pinned to
+			    Zone::set_numa_node(numa_cpu_to_node(worker_cpus[n % worker_cpus.size()]));
+
+			    auto raw = Netserver_AFPacket(ifname, Netserver_AFPacket::data);
 
 			    const in6_addr ll =
 				Netserver_IPv6::ether_to_link_local(raw.gethwaddr());
 			    auto ipv6 = Netserver_IPv6({ll});
 			    auto ipv4 = Netserver_IPv4(host);
 
-			    auto icmp4 = Netserver_ICMP();
-			    auto icmp6 = Netserver_ICMPv6(raw.gethwaddr());
-
 			    auto udp = Netserver_UDP();
 			    auto tcp = Netserver_TCP();
 
-			    arp.attach(raw);
 			    ipv4.attach(raw);
 			    ipv6.attach(raw);
 
-			    icmp4.attach(ipv4);
-			    icmp6.attach(ipv6);
-
 			    udp.attach(ipv4);
 			    udp.attach(ipv6);
 
@@ -139,13 +350,14 @@ int app(int argc, char* argv[])
 		    },
 		    i);
 
-		thread_setcpu(workers[i], i);
+		thread_setcpu(workers[i], worker_cpus[i % worker_cpus.size()]);
 		thread_setname(workers[i], "worker" + std::to_string(i));
 	}
 
 	for (auto i = 0U; i < threads; ++i) {
 		workers[i].join();
 	}
+	control.join();
 
 	return 0;
 }
@@ -7,6 +7,7 @@
  *
  */
 
+#include <cerrno>
 #include <cstring>
 #include <iostream>
 #include <stdexcept>
@@ -18,14 +19,16 @@
 #include <unistd.h>
 
 #include <arpa/inet.h>
+#include <linux/filter.h>
 #include <linux/if.h>
 #include <linux/if_ether.h>
 #include <linux/if_packet.h>
+#include <netinet/in.h>
 
 #include "afpacket.h"
 #include "util.h"
 
-Netserver_AFPacket::Netserver_AFPacket(const std::string& ifname)
+Netserver_AFPacket::Netserver_AFPacket(const std::string& ifname, Role role)
 {
 	fd = ::socket(AF_PACKET, SOCK_DGRAM, htons(ETH_P_ALL));
 	if (fd < 0) {
@@ -33,11 +36,42 @@ Netserver_AFPacket::Netserver_AFPacket(const std::string& ifname)
 	}
 	pfd = {fd, POLLIN, 0};
 
-	bind(ifname);
+	filter(role);
+	bind(ifname, role);
 	rxring(11, 128);
 }
 
-void Netserver_AFPacket::bind(const std::string& ifname)
+//
+// splits the traffic between the control and data sockets.  With
+// SOCK_DGRAM the filter sees the packet from its network header, so
+// the ethertype comes from the packet's metadata instead.
+//
+void Netserver_AFPacket::filter(Role role)
+{
+	uint32_t all = 0x40000, none = 0;
+	uint32_t ctrl = (role == control) ? all : none;
+	uint32_t other = (role == control) ? none : all;
+
+	sock_filter code[] = {
+	    BPF_STMT(BPF_LD | BPF_H | BPF_ABS, uint32_t(SKF_AD_OFF + SKF_AD_PROTOCOL)),
+	    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ETH_P_ARP, 6, 0),
+	    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ETH_P_IP, 0, 2),
+	    BPF_STMT(BPF_LD | BPF_B | BPF_ABS, 9), // IPv4 protocol
+	    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, IPPROTO_ICMP, 3, 4),
+	    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ETH_P_IPV6, 0, 3),
+	    BPF_STMT(BPF_LD | BPF_B | BPF_ABS, 6), // IPv6 next header
+	    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, IPPROTO_ICMPV6, 0, 1),
+	    BPF_STMT(BPF_RET | BPF_K, ctrl),
+	    BPF_STMT(BPF_RET | BPF_K, other),
+	};
+
+	sock_fprog prog = {sizeof code / sizeof code[0], code};
+	if (setsockopt(fd, SOL_SOCKET, SO_ATTACH_FILTER, &prog, sizeof prog) < 0) {
+		throw_errno("setsockopt(SO_ATTACH_FILTER)");
+	}
+}
+
+void Netserver_AFPacket::bind(const std::string& ifname, Role role)
 {
 	ifreq ifr;
 	auto  n = ifname.copy(ifr.ifr_name, IFNAMSIZ);
@@ -80,6 +114,11 @@ void Netserver_AFPacket::bind(const std::string& ifname)
 		throw_errno("setsockopt(PACKET_ADD_MEMBERSHIP)");
 	}
 
+	// the control socket is the only one of its kind
+	if (role == control) {
+		return;
+	}
+
 	// set the AF_PACKET socket's fanout mode
 	uint32_t fanout = (getpid() & 0xffff) | (PACKET_FANOUT_CPU << 16);
 	if (setsockopt(fd, SOL_PACKET, PACKET_FANOUT, &fanout, sizeof fanout) < 0) {
@@ -163,7 +202,9 @@ bool Netserver_AFPacket::next(int timeout)
 
 	if ((hdr.tp_status & TP_STATUS_USER) == 0) {
 		int res = ::poll(&pfd, 1, timeout);
-		if (res < 0) {
+		if (res < 0 && errno == EINTR) {
+			return false; // e.g. SIGHUP to reload the zone
+		} else if (res < 0) {
 			throw_errno("poll");
 		} else if (res == 0) {
 			return false;
@@ -175,10 +216,16 @@ bool Netserver_AFPacket::next(int timeout)
 		return false;
 	}
 
+	// the backlog only changes slowly, so isn't measured every time
+	if ((rx_current & 7) == 0) {
+		load = backlog();
+	}
+
 	try {
 		NetserverPacket packet(frame + hdr.tp_net, hdr.tp_len,
 				       reinterpret_cast<const sockaddr*>(frame + ll_offset),
 				       sizeof(sockaddr_ll));
+		packet.backlog = load;
 
 		recv(packet);
 
@@ -192,6 +239,41 @@ bool Netserver_AFPacket::next(int timeout)
 	return true;
 }
 
+// whether the frame this many after the current one is waiting to be read
+bool Netserver_AFPacket::ready(uint32_t ahead) const
+{
+	auto  frame = map + ((rx_current + ahead) % req.tp_frame_nr) * req.tp_frame_size;
+	auto& status = reinterpret_cast<const volatile tpacket_hdr*>(frame)->tp_status;
+	return status & TP_STATUS_USER;
+}
+
+//
+// the percentage of the ring that's waiting to be read.  The kernel
+// fills the frames in order, so this finds the first empty one after
+// the current frame by doubling then bisecting, which takes just one
+// or two looks at the ring while the server is keeping up.
+//
+unsigned Netserver_AFPacket::backlog() const
+{
+	uint32_t lo = 0, hi = 1; // frame lo is ready, frame hi might not be
+	while (hi < req.tp_frame_nr && ready(hi)) {
+		lo = hi;
+		hi *= 2;
+	}
+	hi = std::min(hi, req.tp_frame_nr);
+
+	while (hi - lo > 1) {
+		auto mid = (lo + hi) / 2;
+		if (ready(mid)) {
+			lo = mid;
+		} else {
+			hi = mid;
+		}
+	}
+
+	return (100 * lo) / req.tp_frame_nr;
+}
+
 void Netserver_AFPacket::loop()
 {
 	while (true) {
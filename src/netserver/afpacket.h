@@ -20,8 +20,17 @@
 
 #include "netserver.h"
 
+//
+// An AF_PACKET socket on the interface, for either the data plane,
+// i.e. DNS, with the worker sockets sharing the traffic by fanout, or
+// the control plane, i.e. ARP, ICMP and ICMPv6, on a socket of its own
+// so that neighbour discovery never waits behind a flood of queries.
+//
 class Netserver_AFPacket : public NetserverRoot {
 
+public:
+	enum Role : uint8_t { data, control };
+
 private:
 	int	 fd = -1;
 	pollfd      pfd;
@@ -30,14 +39,18 @@ private:
 	uint8_t*  map = nullptr;
 	uint32_t  rx_current = 0;
 	ptrdiff_t ll_offset;
+	uint8_t	  load = 0; // the last measured backlog
 
 	int	ifindex;
 	size_t     mtu;
 	ether_addr hwaddr;
 
 private:
-	void bind(const std::string& ifnam);
+	void bind(const std::string& ifnam, Role role);
+	void filter(Role role);
 	bool next(int timeout);
+	bool ready(uint32_t ahead) const;
+	unsigned backlog() const;
 	void rxring(size_t frame_bits, size_t frame_nr);
 
 private:
@@ -47,7 +60,7 @@ public:
 	void send(NetserverPacket& p, const std::vector<iovec>& iovs, size_t iovlen) const override;
 
 public:
-	Netserver_AFPacket(const std::string& ifname);
+	Netserver_AFPacket(const std::string& ifname, Role role = data);
 	~Netserver_AFPacket();
 
 public:
@@ -139,6 +139,10 @@ void Netserver_IPv4::recv(NetserverPacket& p) const
 		}
 	}
 
+	// note the sender, as a v4-mapped address
+	p.source.s6_addr[10] = p.source.s6_addr[11] = 0xff;
+	::memcpy(&p.source.s6_addr[12], &ip4_in.ip_src, sizeof(in_addr));
+
 	// IPv4 header creation
 	ip ip4_out;
 	ip4_out.ip_v = 4;
@@ -252,6 +252,8 @@ void Netserver_IPv6::recv(NetserverPacket& p) const
 	// ignore if the next protocol isn't registered
 	if (!registered(next)) return;
 
+	p.source = ip6_in.ip6_src;
+
 	// IPv6 header, allowing space for a fragment EH to be added
 	uint8_t     buffer[sizeof(ip6_hdr) + sizeof(ip6_frag)];
 	WriteBuffer out(buffer, sizeof buffer);
@@ -11,6 +11,7 @@
 
 #include <cstdint>
 #include <map>
+#include <netinet/in.h>
 #include <sys/socket.h>
 #include <vector>
 
@@ -35,6 +36,8 @@ public:
 	uint16_t	   l3 = 0;
 	uint8_t		   l4 = 0;
 	int8_t		   current = 0;
+	in6_addr	   source{}; // the sender, IPv4 as v4-mapped
+	uint8_t		   backlog = 0; // % of the receive ring waiting behind it
 
 public:
 	NetserverPacket(const uint8_t* buf, size_t buflen, const sockaddr* addr, socklen_t addrlen);
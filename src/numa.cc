@@ -0,0 +1,132 @@
+/*
+ * Copyright (C) Internet Systems Consortium, Inc. ("ISC")
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ */
+
+#include <cstdio>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <string>
+
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "numa.h"
+
+static const char* sysfs_node = "/sys/devices/system/node";
+
+// the map of node number to CPU list, read once from sysfs
+static const std::map<unsigned, std::vector<unsigned>>& topology()
+{
+	static std::map<unsigned, std::vector<unsigned>> nodes;
+	static std::once_flag				  once;
+
+	std::call_once(once, [&]() {
+		auto dir = ::opendir(sysfs_node);
+		if (!dir) {
+			return;
+		}
+
+		while (auto ent = ::readdir(dir)) {
+			unsigned node;
+			char	 extra;
+			if (::sscanf(ent->d_name, "node%u%c", &node, &extra) != 1) {
+				continue;
+			}
+
+			std::ifstream file(std::string(sysfs_node) + "/" + ent->d_name + "/cpulist");
+			std::string   list;
+			std::getline(file, list);
+
+			// e.g. "0-15,32-47"
+			auto& cpus = nodes[node];
+			size_t pos = 0;
+			while (pos < list.size()) {
+				unsigned lo, hi;
+				auto	 n = ::sscanf(list.c_str() + pos, "%u-%u", &lo, &hi);
+				if (n < 1) break;
+				if (n == 1) hi = lo;
+				for (auto cpu = lo; cpu <= hi; ++cpu) {
+					cpus.push_back(cpu);
+				}
+				pos = list.find(',', pos);
+				if (pos == std::string::npos) break;
+				++pos;
+			}
+		}
+
+		::closedir(dir);
+	});
+
+	return nodes;
+}
+
+unsigned numa_nodes()
+{
+	const auto& nodes = topology();
+	return nodes.empty() ? 1 : nodes.rbegin()->first + 1;
+}
+
+unsigned numa_cpu_to_node(unsigned cpu)
+{
+	for (const auto& node : topology()) {
+		for (auto c : node.second) {
+			if (c == cpu) {
+				return node.first;
+			}
+		}
+	}
+	return 0;
+}
+
+std::vector<unsigned> numa_node_cpus(unsigned node)
+{
+	const auto& nodes = topology();
+	auto	    iter = nodes.find(node);
+	return (iter != nodes.end()) ? iter->second : std::vector<unsigned>();
+}
+
+bool numa_bind_range(void* p, size_t len, unsigned node)
+{
+	const int     mpol_preferred = 1;
+	const size_t  bits = 8 * sizeof(unsigned long);
+	unsigned long mask[16] = {0};
+
+	if (node >= bits * 16) {
+		return false;
+	}
+	mask[node / bits] = 1UL << (node % bits);
+
+	return ::syscall(SYS_mbind, p, len, mpol_preferred, mask, bits * 16 + 1, 0) == 0;
+}
+
+void numa_pin_thread(unsigned node)
+{
+	auto cpus = numa_node_cpus(node);
+	if (cpus.empty()) {
+		return;
+	}
+
+	// stay within the thread's current CPUs (e.g. the housekeeping
+	// set) if any of them are on the node
+	cpu_set_t current;
+	CPU_ZERO(&current);
+	pthread_getaffinity_np(pthread_self(), sizeof(current), &current);
+
+	cpu_set_t set, within;
+	CPU_ZERO(&set);
+	for (auto cpu : cpus) {
+		CPU_SET(cpu, &set);
+	}
+	CPU_AND(&within, &set, &current);
+
+	auto& use = CPU_COUNT(&within) ? within : set;
+	pthread_setaffinity_np(pthread_self(), sizeof(use), &use);
+}
@@ -0,0 +1,837 @@
+/*
+ * Copyright (C) Internet Systems Consortium, Inc. ("ISC")
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ */
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <stdexcept>
+#include <unordered_map>
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "parser.h"
+#include "util.h"
+
+enum : uint16_t {
+	TYPE_A = 1,
+	TYPE_NS = 2,
+	TYPE_CNAME = 5,
+	TYPE_SOA = 6,
+	TYPE_PTR = 12,
+	TYPE_MX = 15,
+	TYPE_TXT = 16,
+	TYPE_AAAA = 28,
+	TYPE_DNAME = 39,
+	TYPE_DS = 43,
+	TYPE_RRSIG = 46,
+	TYPE_NSEC = 47,
+	TYPE_DNSKEY = 48,
+	TYPE_CDS = 59,
+	TYPE_CDNSKEY = 60,
+	TYPE_ZONEMD = 63,
+};
+
+static const std::unordered_map<std::string, uint16_t> type_names = {
+    {"A", 1},	    {"NS", 2},		{"CNAME", 5},	  {"SOA", 6},	    {"PTR", 12},
+    {"HINFO", 13},  {"MX", 15},		{"TXT", 16},	  {"AAAA", 28},	    {"SRV", 33},
+    {"NAPTR", 35},  {"DNAME", 39},	{"DS", 43},	  {"SSHFP", 44},    {"RRSIG", 46},
+    {"NSEC", 47},   {"DNSKEY", 48},	{"NSEC3", 50},	  {"NSEC3PARAM", 51}, {"TLSA", 52},
+    {"SMIMEA", 53}, {"CDS", 59},	{"CDNSKEY", 60},  {"OPENPGPKEY", 61}, {"CSYNC", 62},
+    {"ZONEMD", 63}, {"SVCB", 64},	{"HTTPS", 65},	  {"CAA", 257},
+};
+
+static std::string upper(const char* p, size_t n)
+{
+	std::string s(p, n);
+	std::transform(s.begin(), s.end(), s.begin(), ::toupper);
+	return s;
+}
+
+static bool is_digits(const char* p, size_t n)
+{
+	if (n == 0) {
+		return false;
+	}
+	while (n--) {
+		if (!isdigit(static_cast<uint8_t>(*p++))) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static void put8(std::vector<uint8_t>& out, uint8_t v)
+{
+	out.push_back(v);
+}
+
+static void put16(std::vector<uint8_t>& out, uint16_t v)
+{
+	out.push_back(v >> 8);
+	out.push_back(v & 0xff);
+}
+
+static void put32(std::vector<uint8_t>& out, uint32_t v)
+{
+	put16(out, v >> 16);
+	put16(out, v & 0xffff);
+}
+
+// days since 1970-01-01 for a date in the proleptic Gregorian calendar
+static int64_t days_from_civil(int64_t y, unsigned m, unsigned d)
+{
+	y -= m <= 2;
+	int64_t	 era = (y >= 0 ? y : y - 399) / 400;
+	unsigned yoe = static_cast<unsigned>(y - era * 400);
+	unsigned doy = (153 * (m > 2 ? m - 3 : m + 9) + 2) / 5 + d - 1;
+	unsigned doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+	return era * 146097 + static_cast<int64_t>(doe) - 719468;
+}
+
+// --------------------------------------------------------------------
+
+void ZoneParser::error(const std::string& msg) const
+{
+	throw std::runtime_error("zone file line " + std::to_string(record_line) + ": " + msg);
+}
+
+bool ZoneParser::type_from_string(const std::string& s, uint16_t& type)
+{
+	auto u = upper(s.data(), s.size());
+
+	auto iter = type_names.find(u);
+	if (iter != type_names.end()) {
+		type = iter->second;
+		return true;
+	}
+
+	if (u.size() > 4 && u.compare(0, 4, "TYPE") == 0 && u.size() <= 9 &&
+	    is_digits(u.data() + 4, u.size() - 4)) {
+		auto v = std::stoul(u.substr(4));
+		if (v <= 65535) {
+			type = v;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+uint16_t ZoneParser::parse_type(const Token& t) const
+{
+	uint16_t type;
+	if (t.quoted || !type_from_string(std::string(t.p, t.n), type)) {
+		error("unknown RR type " + std::string(t.p, t.n));
+	}
+	return type;
+}
+
+uint32_t ZoneParser::parse_int(const Token& t, uint32_t max) const
+{
+	if (t.quoted || !is_digits(t.p, t.n) || t.n > 10) {
+		error("bad number " + std::string(t.p, t.n));
+	}
+
+	uint64_t v = 0;
+	for (auto i = 0U; i < t.n; ++i) {
+		v = v * 10 + (t.p[i] - '0');
+	}
+
+	if (v > max) {
+		error("number out of range " + std::string(t.p, t.n));
+	}
+
+	return v;
+}
+
+//
+// a TTL, either as a plain number of seconds or in BIND's "1h30m" style
+//
+uint32_t ZoneParser::parse_ttl(const Token& t) const
+{
+	if (t.quoted || t.n == 0 || !isdigit(static_cast<uint8_t>(t.p[0]))) {
+		error("bad TTL " + std::string(t.p, t.n));
+	}
+
+	uint64_t total = 0, v = 0;
+	bool	 digits = false;
+
+	for (auto i = 0U; i < t.n; ++i) {
+		auto c = static_cast<uint8_t>(t.p[i]);
+		if (isdigit(c)) {
+			v = v * 10 + (c - '0');
+			digits = true;
+		} else {
+			uint64_t mult;
+			switch (tolower(c)) {
+			case 's': mult = 1; break;
+			case 'm': mult = 60; break;
+			case 'h': mult = 3600; break;
+			case 'd': mult = 86400; break;
+			case 'w': mult = 604800; break;
+			default: mult = 0; break;
+			}
+			if (!mult || !digits) {
+				error("bad TTL " + std::string(t.p, t.n));
+			}
+			total += v * mult;
+			v = 0;
+			digits = false;
+		}
+		if (v > 0xffffffffULL || total > 0xffffffffULL) {
+			error("TTL out of range " + std::string(t.p, t.n));
+		}
+	}
+
+	total += v;
+	if (total > 0xffffffffULL) {
+		error("TTL out of range " + std::string(t.p, t.n));
+	}
+
+	return total;
+}
+
+//
+// an RRSIG timestamp, either YYYYMMDDHHmmSS or seconds since the epoch
+//
+uint32_t ZoneParser::parse_time(const Token& t) const
+{
+	if (t.n != 14 || !is_digits(t.p, t.n)) {
+		return parse_int(t, 0xffffffff);
+	}
+
+	auto field = [&](size_t off, size_t len) {
+		unsigned v = 0;
+		for (auto i = off; i < off + len; ++i) {
+			v = v * 10 + (t.p[i] - '0');
+		}
+		return v;
+	};
+
+	auto year = field(0, 4);
+	auto mon = field(4, 2);
+	auto day = field(6, 2);
+	auto hour = field(8, 2);
+	auto min = field(10, 2);
+	auto sec = field(12, 2);
+
+	if (mon < 1 || mon > 12 || day < 1 || day > 31 || hour > 23 || min > 59 || sec > 60) {
+		error("bad timestamp " + std::string(t.p, t.n));
+	}
+
+	int64_t secs = days_from_civil(year, mon, day) * 86400 + hour * 3600 + min * 60 + sec;
+
+	// serial number arithmetic (RFC 4034 section 3.1.5)
+	return static_cast<uint32_t>(secs);
+}
+
+//
+// convert a (possibly relative) domain name to uncompressed wire
+// format, handling the RFC 1035 escape sequences
+//
+void ZoneParser::parse_name(const Token& t, std::vector<uint8_t>& out) const
+{
+	if (t.quoted || t.n == 0) {
+		error("bad domain name");
+	}
+
+	if (t.n == 1 && t.p[0] == '@') {
+		out.insert(out.end(), origin.cbegin(), origin.cend());
+		return;
+	}
+
+	auto start = out.size();
+
+	if (t.n == 1 && t.p[0] == '.') {
+		out.push_back(0);
+		return;
+	}
+
+	auto label = out.size();
+	out.push_back(0);
+
+	auto p = t.p;
+	auto end = t.p + t.n;
+	bool absolute = false;
+
+	while (p < end) {
+		uint8_t c = *p++;
+		if (c == '.') {
+			if (out.size() - label == 1) {
+				error("empty label in " + std::string(t.p, t.n));
+			}
+			if (p == end) {
+				absolute = true;
+				break;
+			}
+			label = out.size();
+			out.push_back(0);
+			continue;
+		}
+
+		if (c == '\\') {
+			if (p == end) {
+				error("bad escape in " + std::string(t.p, t.n));
+			}
+			if (isdigit(static_cast<uint8_t>(*p))) {
+				if (end - p < 3 || !is_digits(p, 3)) {
+					error("bad escape in " + std::string(t.p, t.n));
+				}
+				unsigned v = (p[0] - '0') * 100 + (p[1] - '0') * 10 + (p[2] - '0');
+				if (v > 255) {
+					error("bad escape in " + std::string(t.p, t.n));
+				}
+				c = v;
+				p += 3;
+			} else {
+				c = *p++;
+			}
+		}
+
+		out.push_back(c);
+		auto len = out.size() - label - 1;
+		if (len > 63) {
+			error("label too long in " + std::string(t.p, t.n));
+		}
+		out[label] = len;
+	}
+
+	if (absolute) {
+		out.push_back(0);
+	} else {
+		out.insert(out.end(), origin.cbegin(), origin.cend());
+	}
+
+	if (out.size() - start > 255) {
+		error("domain name too long");
+	}
+}
+
+//
+// hex and base64 fields may be split over several tokens
+//
+void ZoneParser::parse_hex(size_t i, std::vector<uint8_t>& out) const
+{
+	auto digit = [&](char c) -> uint8_t {
+		if (c >= '0' && c <= '9') return c - '0';
+		if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+		if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+		error("bad hex digit");
+		return 0;
+	};
+
+	bool	high = true;
+	uint8_t v = 0;
+
+	for (; i < tokens.size(); ++i) {
+		const auto& t = tokens[i];
+		for (auto j = 0U; j < t.n; ++j) {
+			if (high) {
+				v = digit(t.p[j]) << 4;
+			} else {
+				out.push_back(v | digit(t.p[j]));
+			}
+			high = !high;
+		}
+	}
+
+	if (!high) {
+		error("odd number of hex digits");
+	}
+}
+
+void ZoneParser::parse_base64(size_t i, std::vector<uint8_t>& out) const
+{
+	auto digit = [&](char c) -> uint32_t {
+		if (c >= 'A' && c <= 'Z') return c - 'A';
+		if (c >= 'a' && c <= 'z') return c - 'a' + 26;
+		if (c >= '0' && c <= '9') return c - '0' + 52;
+		if (c == '+') return 62;
+		if (c == '/') return 63;
+		error("bad base64 data");
+		return 0;
+	};
+
+	uint32_t acc = 0;
+	unsigned bits = 0;
+	size_t	 count = 0, pad = 0;
+
+	for (; i < tokens.size(); ++i) {
+		const auto& t = tokens[i];
+		for (auto j = 0U; j < t.n; ++j, ++count) {
+			if (t.p[j] == '=') {
+				++pad;
+				continue;
+			}
+			if (pad) {
+				error("bad base64 data");
+			}
+			acc = ((acc << 6) | digit(t.p[j])) & 0xffffff;
+			bits += 6;
+			if (bits >= 8) {
+				bits -= 8;
+				out.push_back((acc >> bits) & 0xff);
+			}
+		}
+	}
+
+	if (count == 0 || (count % 4) != 0 || pad > 2) {
+		error("bad base64 data");
+	}
+}
+
+void ZoneParser::parse_string(const Token& t, std::vector<uint8_t>& out) const
+{
+	auto len = out.size();
+	out.push_back(0);
+
+	auto p = t.p;
+	auto end = t.p + t.n;
+	while (p < end) {
+		uint8_t c = *p++;
+		if (c == '\\' && p < end) {
+			if (isdigit(static_cast<uint8_t>(*p))) {
+				if (end - p < 3 || !is_digits(p, 3)) {
+					error("bad escape in string");
+				}
+				unsigned v = (p[0] - '0') * 100 + (p[1] - '0') * 10 + (p[2] - '0');
+				if (v > 255) {
+					error("bad escape in string");
+				}
+				c = v;
+				p += 3;
+			} else {
+				c = *p++;
+			}
+		}
+		out.push_back(c);
+	}
+
+	auto n = out.size() - len - 1;
+	if (n > 255) {
+		error("character string too long");
+	}
+	out[len] = n;
+}
+
+// the NSEC type bitmap (RFC 4034 section 4.1.2)
+void ZoneParser::parse_bitmap(size_t i, std::vector<uint8_t>& out) const
+{
+	std::vector<uint16_t> types;
+	for (; i < tokens.size(); ++i) {
+		types.push_back(parse_type(tokens[i]));
+	}
+
+	std::sort(types.begin(), types.end());
+	types.erase(std::unique(types.begin(), types.end()), types.end());
+
+	size_t k = 0;
+	while (k < types.size()) {
+		uint8_t window = types[k] >> 8;
+		uint8_t bitmap[32] = {0};
+		size_t	len = 0;
+
+		while (k < types.size() && (types[k] >> 8) == window) {
+			uint8_t lo = types[k] & 0xff;
+			bitmap[lo / 8] |= 0x80 >> (lo % 8);
+			len = lo / 8 + 1;
+			++k;
+		}
+
+		out.push_back(window);
+		out.push_back(len);
+		out.insert(out.end(), bitmap, bitmap + len);
+	}
+}
+
+// --------------------------------------------------------------------
+
+//
+// gather the tokens that make up the next logical record, which
+// may span several lines if parentheses are used.  Sets "has_owner"
+// if the first token started at the beginning of a line.
+//
+bool ZoneParser::next_record(bool& has_owner)
+{
+	auto end = base + size;
+
+	tokens.clear();
+	has_owner = false;
+
+	while (pos < end) {
+		auto c = *pos;
+
+		if (c == '\n') {
+			++line;
+			++pos;
+			if (depth == 0 && !tokens.empty()) {
+				return true;
+			}
+		} else if (c == ' ' || c == '\t' || c == '\r') {
+			++pos;
+		} else if (c == ';') {
+			while (pos < end && *pos != '\n') {
+				++pos;
+			}
+		} else if (c == '(') {
+			++depth;
+			++pos;
+		} else if (c == ')') {
+			if (!depth) {
+				record_line = line;
+				error("unbalanced parentheses");
+			}
+			--depth;
+			++pos;
+		} else {
+			auto first = pos;
+			if (tokens.empty()) {
+				record_line = line;
+				has_owner = (first == base || first[-1] == '\n');
+			}
+
+			if (c == '"') {
+				auto start = ++pos;
+				while (pos < end && *pos != '"') {
+					if (*pos == '\\' && pos + 1 < end) {
+						++pos;
+					}
+					if (*pos == '\n') {
+						++line;
+					}
+					++pos;
+				}
+				if (pos >= end) {
+					error("unterminated quoted string");
+				}
+				tokens.push_back(Token{start, size_t(pos - start), true});
+				++pos;
+			} else {
+				while (pos < end) {
+					c = *pos;
+					if (c == '\\' && pos + 1 < end) {
+						if (pos[1] == '\n') {
+							++line;
+						}
+						pos += 2;
+						continue;
+					}
+					if (c == ' ' || c == '\t' || c == '\r' || c == '\n' || c == ';' ||
+					    c == '(' || c == ')' || c == '"') {
+						break;
+					}
+					++pos;
+				}
+				tokens.push_back(Token{first, size_t(pos - first), false});
+			}
+		}
+	}
+
+	if (depth) {
+		record_line = line;
+		error("unbalanced parentheses");
+	}
+
+	return !tokens.empty();
+}
+
+void ZoneParser::directive()
+{
+	auto d = upper(tokens[0].p, tokens[0].n);
+
+	if (d == "$ORIGIN") {
+		if (tokens.size() != 2) {
+			error("bad $ORIGIN directive");
+		}
+		name.clear();
+		parse_name(tokens[1], name);
+		origin = name;
+	} else if (d == "$TTL") {
+		if (tokens.size() != 2) {
+			error("bad $TTL directive");
+		}
+		default_ttl = parse_ttl(tokens[1]);
+		have_ttl = true;
+	} else if (d == "$INCLUDE") {
+		error("$INCLUDE is not supported");
+	} else {
+		error("unknown directive " + d);
+	}
+}
+
+//
+// RDATA in RFC 3597 "\# <length> <hex>" format
+//
+void ZoneParser::rdata_generic(uint16_t type, size_t i)
+{
+	// the answer compiler relies on the embedded names being valid
+	switch (type) {
+	case TYPE_NS:
+	case TYPE_CNAME:
+	case TYPE_SOA:
+	case TYPE_PTR:
+	case TYPE_MX:
+	case TYPE_DNAME:
+	case TYPE_RRSIG:
+	case TYPE_NSEC:
+		error("generic RDATA not supported for this RR type");
+	}
+
+	if (i >= tokens.size()) {
+		error("missing RDATA length");
+	}
+
+	auto len = parse_int(tokens[i], 65535);
+	parse_hex(i + 1, rdata);
+
+	if (rdata.size() != len) {
+		error("RDATA length mismatch");
+	}
+}
+
+void ZoneParser::rdata_from_text(uint16_t type, size_t i)
+{
+	auto n = tokens.size();
+
+	auto need = [&](size_t k) {
+		if (n - i < k) {
+			error("too few RDATA fields");
+		}
+	};
+
+	auto exact = [&](size_t k) {
+		need(k);
+		if (n - i > k) {
+			error("too many RDATA fields");
+		}
+	};
+
+	auto address = [&](int af, size_t len) {
+		exact(1);
+		uint8_t addr[16];
+		std::string s(tokens[i].p, tokens[i].n);
+		if (tokens[i].quoted || ::inet_pton(af, s.c_str(), addr) != 1) {
+			error("bad address " + s);
+		}
+		rdata.insert(rdata.end(), addr, addr + len);
+	};
+
+	switch (type) {
+	case TYPE_A:
+		address(AF_INET, 4);
+		break;
+
+	case TYPE_AAAA:
+		address(AF_INET6, 16);
+		break;
+
+	case TYPE_NS:
+	case TYPE_CNAME:
+	case TYPE_PTR:
+	case TYPE_DNAME:
+		exact(1);
+		parse_name(tokens[i], rdata);
+		break;
+
+	case TYPE_MX:
+		exact(2);
+		put16(rdata, parse_int(tokens[i], 65535));
+		parse_name(tokens[i + 1], rdata);
+		break;
+
+	case TYPE_SOA:
+		exact(7);
+		parse_name(tokens[i], rdata);
+		parse_name(tokens[i + 1], rdata);
+		put32(rdata, parse_int(tokens[i + 2], 0xffffffff));
+		for (auto j = 3U; j < 7; ++j) {
+			put32(rdata, parse_ttl(tokens[i + j]));
+		}
+		break;
+
+	case TYPE_TXT:
+		need(1);
+		for (; i < n; ++i) {
+			parse_string(tokens[i], rdata);
+		}
+		break;
+
+	case TYPE_DS:
+	case TYPE_CDS:
+		need(4);
+		put16(rdata, parse_int(tokens[i], 65535));
+		put8(rdata, parse_int(tokens[i + 1], 255));
+		put8(rdata, parse_int(tokens[i + 2], 255));
+		parse_hex(i + 3, rdata);
+		break;
+
+	case TYPE_DNSKEY:
+	case TYPE_CDNSKEY:
+		need(4);
+		put16(rdata, parse_int(tokens[i], 65535));
+		put8(rdata, parse_int(tokens[i + 1], 255));
+		put8(rdata, parse_int(tokens[i + 2], 255));
+		parse_base64(i + 3, rdata);
+		break;
+
+	case TYPE_RRSIG:
+		need(9);
+		put16(rdata, parse_type(tokens[i]));
+		put8(rdata, parse_int(tokens[i + 1], 255));
+		put8(rdata, parse_int(tokens[i + 2], 255));
+		put32(rdata, parse_ttl(tokens[i + 3]));
+		put32(rdata, parse_time(tokens[i + 4]));
+		put32(rdata, parse_time(tokens[i + 5]));
+		put16(rdata, parse_int(tokens[i + 6], 65535));
+		parse_name(tokens[i + 7], rdata);
+		parse_base64(i + 8, rdata);
+		break;
+
+	case TYPE_NSEC:
+		need(1);
+		parse_name(tokens[i], rdata);
+		parse_bitmap(i + 1, rdata);
+		break;
+
+	case TYPE_ZONEMD:
+		need(4);
+		put32(rdata, parse_int(tokens[i], 0xffffffff));
+		put8(rdata, parse_int(tokens[i + 1], 255));
+		put8(rdata, parse_int(tokens[i + 2], 255));
+		parse_hex(i + 3, rdata);
+		break;
+
+	default:
+		error("RR type " + std::to_string(type) + " requires RFC 3597 syntax");
+	}
+}
+
+void ZoneParser::record(bool has_owner, const Callback& callback)
+{
+	auto   n = tokens.size();
+	size_t i = 0;
+
+	if (has_owner) {
+		name.clear();
+		parse_name(tokens[0], name);
+		owner = name;
+		i = 1;
+	} else if (owner.empty()) {
+		error("no owner name");
+	}
+
+	// TTL and class are both optional, and may appear in either order
+	uint32_t ttl = have_ttl ? default_ttl : last_ttl;
+	bool	 got_ttl = false, got_class = false;
+
+	while (i < n && !tokens[i].quoted) {
+		const auto& t = tokens[i];
+		auto	    u = upper(t.p, t.n);
+		if (!got_class && (u == "IN" || u == "CLASS1")) {
+			got_class = true;
+		} else if (!got_class && (u == "CH" || u == "HS" || u == "CS" ||
+					  (u.size() > 5 && u.compare(0, 5, "CLASS") == 0))) {
+			error("unsupported class " + u);
+		} else if (!got_ttl && isdigit(static_cast<uint8_t>(t.p[0]))) {
+			ttl = parse_ttl(t);
+			got_ttl = true;
+		} else {
+			break;
+		}
+		++i;
+	}
+
+	if (i >= n) {
+		error("missing RR type");
+	}
+
+	auto type = parse_type(tokens[i++]);
+	if (got_ttl) {
+		last_ttl = ttl;
+	}
+
+	rdata.clear();
+	if (i < n && !tokens[i].quoted && tokens[i].n == 2 && tokens[i].p[0] == '\\' &&
+	    tokens[i].p[1] == '#') {
+		rdata_generic(type, i + 1);
+	} else {
+		rdata_from_text(type, i);
+	}
+
+	if (rdata.size() > 65535) {
+		error("RDATA too long");
+	}
+
+	Record rr;
+	rr.owner = owner.data();
+	rr.rdata = rdata.data();
+	rr.ttl = ttl;
+	rr.type = type;
+	rr.klass = 1; // IN
+	rr.rdlen = rdata.size();
+
+	callback(rr);
+}
+
+void ZoneParser::parse(const Callback& callback)
+{
+	pos = base;
+	line = 1;
+	depth = 0;
+	origin.assign(1, 0); // "."
+	owner.clear();
+
+	bool has_owner;
+	while (next_record(has_owner)) {
+		if (tokens[0].n && tokens[0].p[0] == '$' && !tokens[0].quoted) {
+			directive();
+		} else {
+			record(has_owner, callback);
+		}
+	}
+}
+
+ZoneParser::ZoneParser(const std::string& filename, uint32_t default_ttl)
+    : default_ttl(default_ttl), last_ttl(default_ttl)
+{
+	auto fd = ::open(filename.c_str(), O_RDONLY);
+	if (fd < 0) {
+		throw_errno("opening zone file: " + filename);
+	}
+
+	struct stat st;
+	if (::fstat(fd, &st) < 0) {
+		::close(fd);
+		throw_errno("fstat: " + filename);
+	}
+
+	size = st.st_size;
+	if (size) {
+		auto p = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (p == MAP_FAILED) {
+			::close(fd);
+			throw_errno("mmap: " + filename);
+		}
+		base = reinterpret_cast<const char*>(p);
+		::madvise(p, size, MADV_SEQUENTIAL);
+	}
+
+	::close(fd);
+}
+
+ZoneParser::~ZoneParser()
+{
+	if (base) {
+		::munmap(const_cast<char*>(base), size);
+	}
+}
@@ -0,0 +1,204 @@
+/*
+ * Copyright (C) Internet Systems Consortium, Inc. ("ISC")
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ */
+
+#include <algorithm>
+#include <cstring>
+#include <endian.h>
+#include <stdexcept>
+#include <time.h>
+
+#include "rrl.h"
+
+static const int64_t ns_per_sec = 1000000000LL;
+
+RateLimiter::Config RateLimiter::Config::parse(const std::string& spec)
+{
+	Config config;
+
+	auto number = [&](const std::string& s) -> unsigned {
+		size_t n = 0;
+		auto   v = std::stoul(s, &n);
+		if (n != s.size() || v > UINT32_MAX) {
+			throw std::invalid_argument("number");
+		}
+		return v;
+	};
+
+	try {
+		// a bare number is just the positive response rate
+		if (!spec.empty() && spec.find('=') == std::string::npos) {
+			config.rate[responses] = number(spec);
+			return config;
+		}
+
+		size_t pos = 0;
+		while (pos < spec.size()) {
+			auto end = std::min(spec.find(',', pos), spec.size());
+			auto item = spec.substr(pos, end - pos);
+			pos = end + 1;
+
+			auto eq = item.find('=');
+			if (eq == std::string::npos) {
+				throw std::invalid_argument("item");
+			}
+
+			auto name = item.substr(0, eq);
+			auto value = number(item.substr(eq + 1));
+
+			if (name == "responses") {
+				config.rate[responses] = value;
+			} else if (name == "nxdomains") {
+				config.rate[nxdomains] = value;
+			} else if (name == "errors") {
+				config.rate[errors] = value;
+			} else if (name == "slip") {
+				config.slip = value;
+			} else if (name == "window") {
+				config.window = value;
+			} else if (name == "ipv4-prefix" && value <= 32) {
+				config.ipv4_prefix = value;
+			} else if (name == "ipv6-prefix" && value <= 64) {
+				config.ipv6_prefix = value;
+			} else if (name == "size" && value > 0) {
+				config.size = value;
+			} else {
+				throw std::invalid_argument("name");
+			}
+		}
+	} catch (std::logic_error&) {
+		throw std::runtime_error("invalid rate limit: " + spec);
+	}
+
+	if (!config.enabled() || !config.window) {
+		throw std::runtime_error("invalid rate limit: " + spec);
+	}
+
+	return config;
+}
+
+// reduces the client address to its prefix and mixes in the response
+// identity, giving a non-zero key (zero marks an unused bucket)
+uint64_t RateLimiter::key(const in6_addr& client, uint64_t identity) const
+{
+	uint64_t hi, lo;
+	::memcpy(&hi, &client.s6_addr[0], sizeof hi);
+	::memcpy(&lo, &client.s6_addr[8], sizeof lo);
+	hi = be64toh(hi);
+	lo = be64toh(lo);
+
+	uint64_t prefix;
+	if (IN6_IS_ADDR_V4MAPPED(&client)) {
+		prefix = (lo & ipv4_mask) | (1ULL << 63);
+	} else {
+		prefix = hi & ipv6_mask;
+	}
+
+	// a 64-bit finaliser (from MurmurHash3) of both halves
+	uint64_t h = prefix ^ (identity * 0x9e3779b97f4a7c15ULL);
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ULL;
+	h ^= h >> 33;
+
+	return h ? h : 1;
+}
+
+// finds the bucket for this key in its set, or else recycles the one
+// in that set that would be fullest, i.e. the least recently limited
+RateLimiter::Bucket& RateLimiter::find(uint64_t key, int64_t now)
+{
+	auto set = &buckets[key & mask & ~size_t(ways - 1)];
+
+	auto victim = set;
+	for (auto b = set; b < set + ways; ++b) {
+		if (b->key == key) {
+			return *b;
+		}
+		if (b->tat < victim->tat) {
+			victim = b;
+		}
+	}
+
+	victim->key = key;
+	victim->tat = now;
+	victim->slips = 0;
+
+	return *victim;
+}
+
+//
+// A "generic cell rate algorithm" form of token bucket: each response
+// moves the bucket's theoretical arrival time on by the interval, and
+// a response is limited if that gets more than one second's worth of
+// responses ahead of now.  Limited responses still count, up to the
+// window, so that a sustained flood stays limited.
+//
+RateLimiter::Action RateLimiter::check(const in6_addr& client, uint64_t identity,
+				       Category category, int64_t now)
+{
+	auto t = interval[category];
+	if (!t) {
+		return pass;
+	}
+
+	auto& b = find(key(client, identity), now);
+
+	auto tat = std::max(b.tat, now) + t;
+	if (tat - now <= burst) {
+		b.tat = tat;
+		return pass;
+	}
+
+	b.tat = std::min(tat, now + window);
+
+	if (slip_every && (++b.slips % slip_every) == 0) {
+		_slipped.store(_slipped.load(std::memory_order_relaxed) + 1,
+			       std::memory_order_relaxed);
+		return slip;
+	} else {
+		_dropped.store(_dropped.load(std::memory_order_relaxed) + 1,
+			       std::memory_order_relaxed);
+		return drop;
+	}
+}
+
+RateLimiter::Action RateLimiter::check(const in6_addr& client, uint64_t identity,
+				       Category category)
+{
+	// a coarse clock is ample here, and doesn't cost a TSC read
+	timespec ts;
+	clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+
+	return check(client, identity, category, ts.tv_sec * ns_per_sec + ts.tv_nsec);
+}
+
+RateLimiter::RateLimiter(const Config& config)
+{
+	for (auto i = 0U; i < categories; ++i) {
+		auto rate = config.rate[i];
+		interval[i] = rate ? std::max(int64_t(1), ns_per_sec / rate) : 0;
+	}
+
+	burst = ns_per_sec;
+	window = std::max(burst, int64_t(config.window) * ns_per_sec);
+	slip_every = config.slip;
+
+	ipv4_mask = config.ipv4_prefix ? (~0ULL << (32 - config.ipv4_prefix)) & 0xffffffffULL : 0;
+	ipv6_mask = config.ipv6_prefix ? ~0ULL << (64 - config.ipv6_prefix) : 0;
+
+	// round up to a power of two, and at least one whole set
+	size_t n = ways;
+	while (n < config.size) {
+		n <<= 1;
+	}
+
+	buckets.resize(n);
+	mask = n - 1;
+}
@@ -7,62 +7,30 @@
  *
  */
 
-#include <ldns/ldns.h>
-
 #include "rrlist.h"
 
-void RRList::append(const ldns_rr* rr)
+void RRList::append(const Record* rr)
 {
 	if (rr) {
-		auto p = std::shared_ptr<ldns_rr>(ldns_rr_clone(rr), ldns_rr_free);
-		_list.push_back(p);
+		_list.push_back(rr);
 	}
 }
 
-void RRList::append(const ldns_dnssec_rrs* rrs)
+void RRList::append(const RRList& rrs)
 {
-	while (rrs) {
-		append(rrs->rr);
-		rrs = rrs->next;
-	}
+	_list.insert(_list.end(), rrs._list.cbegin(), rrs._list.cend());
 }
 
-void RRList::append(const ldns_dnssec_rrsets* rrset)
+void RRList::reserve(size_t n)
 {
-	if (rrset) {
-		append(rrset->rrs);
-		append(rrset->signatures);
-	}
+	_list.reserve(n);
 }
 
 RRList RRList::operator+(const RRList& rhs) const
 {
 	RRList result;
-
-	for (auto rr : _list) {
-		result._list.push_back(rr);
-	}
-
-	for (auto rr : rhs._list) {
-		result._list.push_back(rr);
-	}
-
+	result.reserve(count() + rhs.count());
+	result.append(*this);
+	result.append(rhs);
 	return result;
 }
-
-RRList::RRList(const ldns_dnssec_rrsets* rrs)
-{
-	append(rrs);
-}
-
-RRList::RRList(const RRList& rhs)
-{
-	for (auto rr : rhs._list) {
-		_list.push_back(rr);
-	}
-}
-
-RRList::RRList(RRList&& rhs)
-{
-	std::swap(_list, rhs._list);
-}
@@ -7,12 +7,23 @@
  *
  */
 
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cinttypes>
+#include <csignal>
 #include <iostream>
 #include <thread>
 
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/inotify.h>
 #include <sys/stat.h>
+#include <syslog.h>
+#include <unistd.h>
 
 #include "context.h"
+#include "grace.h"
 #include "netserver/tcp.h"
 #include "server.h"
 #include "thread.h"
@@ -23,10 +34,19 @@
 
 void DNSServer::recv(NetserverPacket& p) const
 {
+	// the zone snapshot, ACL and cookie secret stay valid until done
+	GracePeriod::Reader reader;
+
 	bool tcp = (p.l4 == IPPROTO_TCP);
 
-	Context ctx(zone);
-	auto    reply = ctx.execute(p.readbuf, p.iovs, tcp);
+	auto shed = shedder();
+	if (shed) {
+		shed->set_backlog(p.backlog);
+	}
+
+	Context ctx(zone, cache(), rate_limiter(), acl.load(std::memory_order_acquire), shed,
+		    cookies.load(std::memory_order_acquire), udp_limits, minimal);
+	auto    reply = ctx.execute(p.readbuf, p.iovs, tcp, &p.source);
 
 	// consume the rest of the inbound TCP segment so it can be ACK'd.
 	if (tcp) {
@@ -35,40 +55,541 @@ void DNSServer::recv(NetserverPacket& p) const
 
 	if (reply) {
 		send_up(p);
+		if (ctx.clamped_response()) {
+			auto& c = clamp_count()->count;
+			c.store(c.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+		}
+	}
+
+	// note who asked for what, for the statistics
+	auto t = recorder();
+	const uint8_t* label;
+	size_t	       len;
+	if (t && ctx.tld(label, len)) {
+		t->record(p.source, label, len, ctx.response_code() == LDNS_RCODE_NXDOMAIN);
+	}
+}
+
+//---------------------------------------------------------------------
+
+//
+// returns the calling worker thread's response cache, creating it on
+// first use.  Ownership stays with the server so that the statistics
+// thread can safely read the counters.
+//
+ResponseCache* DNSServer::cache() const
+{
+	thread_local ResponseCache* cache = nullptr;
+
+	if (!cache && cache_size) {
+		std::lock_guard<std::mutex> lock(cache_mutex);
+		caches.emplace_back(new ResponseCache(cache_size));
+		cache = caches.back().get();
+	}
+
+	return cache;
+}
+
+void DNSServer::set_cache_size(size_t size)
+{
+	cache_size = size;
+}
+
+// as above, for the worker thread's rate limiter, if enabled
+RateLimiter* DNSServer::rate_limiter() const
+{
+	thread_local RateLimiter* rrl = nullptr;
+
+	if (!rrl && rrl_config.enabled()) {
+		std::lock_guard<std::mutex> lock(cache_mutex);
+		limiters.emplace_back(new RateLimiter(rrl_config));
+		rrl = limiters.back().get();
+	}
+
+	return rrl;
+}
+
+// and its load shedder
+LoadShedder* DNSServer::shedder() const
+{
+	thread_local LoadShedder* shedder = nullptr;
+
+	if (!shedder && shed_config.enabled()) {
+		std::lock_guard<std::mutex> lock(cache_mutex);
+		shedders.emplace_back(new LoadShedder(shed_config));
+		shedder = shedders.back().get();
+	}
+
+	return shedder;
+}
+
+// and for the worker thread's traffic sketch, if enabled
+TrafficRecorder* DNSServer::recorder() const
+{
+	thread_local TrafficRecorder* recorder = nullptr;
+
+	if (!recorder && top_count) {
+		std::lock_guard<std::mutex> lock(cache_mutex);
+		recorders.emplace_back(new TrafficRecorder());
+		recorder = recorders.back().get();
+	}
+
+	return recorder;
+}
+
+// and for its count of responses cut down by the payload limit
+DNSServer::ClampCount* DNSServer::clamp_count() const
+{
+	thread_local ClampCount* count = nullptr;
+
+	if (!count) {
+		std::lock_guard<std::mutex> lock(cache_mutex);
+		clamp_counts.emplace_back(new ClampCount());
+		count = clamp_counts.back().get();
+	}
+
+	return count;
+}
+
+// each thread enforces the full rates (see rrl.h)
+void DNSServer::set_rate_limit(const RateLimiter::Config& config)
+{
+	rrl_config = config;
+}
+
+void DNSServer::set_shedding(const LoadShedder::Config& config)
+{
+	shed_config = config;
+}
+
+void DNSServer::set_top_count(size_t count)
+{
+	top_count = std::min(count, size_t(TrafficSketch::capacity));
+}
+
+void DNSServer::set_udp_limits(const UDPLimits& limits)
+{
+	udp_limits = limits;
+}
+
+void DNSServer::set_minimal_responses(bool enable)
+{
+	minimal = enable;
+}
+
+//---------------------------------------------------------------------
+
+// loads the client ACL, which is then reloaded along with the zone on SIGHUP
+void DNSServer::set_acl(const std::string& filename)
+{
+	acl_file = filename;
+
+	auto next = ClientACL::load(acl_file);
+	syslog(LOG_NOTICE, "loaded %zu ACL rules from %s (%zu kB)", next->size(),
+	       acl_file.c_str(), next->memory() / 1024);
+
+	auto previous = std::move(acl_current);
+	acl_current = std::move(next);
+	acl.store(acl_current.get(), std::memory_order_release);
+	GracePeriod::wait();
+
+	update_blocklist();
+}
+
+// as above, keeping the current ACL if the new one can't be loaded
+void DNSServer::reload_acl()
+{
+	if (acl_file.empty()) {
+		return;
+	}
+
+	try {
+		set_acl(acl_file);
+	} catch (std::exception& e) {
+		syslog(LOG_WARNING, "ACL reload failed, keeping the current one: %s", e.what());
+	}
+}
+
+// takes over the XDP pre-filter, which drops what the ACL drops
+void DNSServer::set_xdp(std::unique_ptr<XDPFilter> filter)
+{
+	xdp = std::move(filter);
+	update_blocklist();
+}
+
+// the userspace ACL still applies if this fails, just more slowly
+void DNSServer::update_blocklist()
+{
+	if (!xdp || !acl_current) {
+		return;
+	}
+
+	try {
+		xdp->set_blocklist(*acl_current);
+	} catch (std::exception& e) {
+		syslog(LOG_WARNING, "XDP blocklist update failed: %s", e.what());
+	}
+}
+
+//---------------------------------------------------------------------
+
+// DNS cookies, with the secret first made here and then replaced on a
+// schedule (RFC 9018) by a thread of its own
+void DNSServer::enable_cookies()
+{
+	roll_cookie_secret();
+
+	auto t = std::thread(&DNSServer::cookie_thread, this);
+	thread_setname(t, "cookie-secret");
+	t.detach();
+}
+
+//
+// a new secret, with the current key kept alongside so that recently
+// issued cookies remain valid until the next
+//
+void DNSServer::roll_cookie_secret()
+{
+	std::shared_ptr<const CookieSecret> next(new CookieSecret(nullptr, cookies_current.get()));
+
+	auto previous = std::move(cookies_current);
+	cookies_current = std::move(next);
+	cookies.store(cookies_current.get(), std::memory_order_release);
+	GracePeriod::wait();
+}
+
+void DNSServer::cookie_thread()
+{
+	housekeeping_enter();
+
+	while (true) {
+		std::this_thread::sleep_for(std::chrono::seconds(CookieSecret::rollover));
+		roll_cookie_secret();
+	}
+}
+
+//---------------------------------------------------------------------
+
+//
+// logs the heaviest clients, networks, TLDs and non-existent TLDs
+// since the last interval, with their (over)estimated query counts
+//
+void DNSServer::log_traffic(const TrafficSketch& traffic) const
+{
+	static const char* names[] = {"clients", "networks", "TLDs", "NXDOMAIN TLDs"};
+
+	auto total = traffic.total();
+	if (!total) {
+		return;
+	}
+
+	for (auto i = 0U; i < TrafficSketch::streams; ++i) {
+		auto stream = static_cast<TrafficSketch::Stream>(i);
+
+		std::string text;
+		for (const auto& item : traffic.top(stream, top_count)) {
+			char buf[32];
+			snprintf(buf, sizeof buf, " %" PRIu64 " (%.1f%%)", item.count,
+				 (100.0 * item.count) / total);
+			text += (text.empty() ? " " : ", ") + TrafficSketch::text(stream, item.key) + buf;
+		}
+
+		if (!text.empty()) {
+			syslog(LOG_INFO, "top %s of %" PRIu64 " queries:%s", names[i], total,
+			       text.c_str());
+		}
+	}
+}
+
+void DNSServer::stats_thread(unsigned int interval)
+{
+	housekeeping_enter();
+
+	std::unique_ptr<TrafficSketch> traffic(new TrafficSketch());
+
+	while (true) {
+		std::this_thread::sleep_for(std::chrono::seconds(interval));
+
+		uint64_t hits = 0, misses = 0, dropped = 0, slipped = 0, clamped = 0;
+		uint64_t shed[LoadShedder::classes] = {};
+		{
+			std::lock_guard<std::mutex> lock(cache_mutex);
+			for (const auto& c : caches) {
+				hits += c->hits();
+				misses += c->misses();
+			}
+			for (const auto& l : limiters) {
+				dropped += l->dropped();
+				slipped += l->slipped();
+			}
+			for (const auto& s : shedders) {
+				for (auto i = 0U; i < LoadShedder::classes; ++i) {
+					shed[i] += s->shed_count(static_cast<LoadShedder::Class>(i));
+				}
+			}
+			for (const auto& c : clamp_counts) {
+				clamped += c->count.load(std::memory_order_relaxed);
+			}
+		}
+
+		if (cache_size) {
+			auto total = hits + misses;
+			syslog(LOG_INFO, "response cache: %" PRIu64 " hits, %" PRIu64 " misses (%.1f%% hit rate)",
+			       hits, misses, total ? (100.0 * hits) / total : 0.0);
+		}
+
+		if (clamped) {
+			syslog(LOG_INFO,
+			       "UDP payload limit: %" PRIu64 " responses cut down to avoid fragmenting",
+			       clamped);
+		}
+
+		if (rrl_config.enabled()) {
+			syslog(LOG_INFO, "rate limiting: %" PRIu64 " responses dropped, %" PRIu64 " slipped",
+			       dropped, slipped);
+		}
+
+		if (shed_config.enabled()) {
+			syslog(LOG_INFO,
+			       "overload: shed %" PRIu64 " ANY, %" PRIu64 " non-EDNS, %" PRIu64
+			       " NXDOMAIN and %" PRIu64 " DO queries",
+			       shed[LoadShedder::any], shed[LoadShedder::noedns],
+			       shed[LoadShedder::nxdomain], shed[LoadShedder::dnssec]);
+		}
+
+		if (xdp) {
+			auto c = xdp->counters();
+			syslog(LOG_INFO,
+			       "XDP: %" PRIu64 " blocklisted, %" PRIu64 " malformed, %" PRIu64
+			       " over rate dropped, %" PRIu64 " passed",
+			       c.blocked, c.malformed, c.limited, c.passed);
+		}
+
+		if (top_count) {
+			traffic->clear();
+			{
+				std::lock_guard<std::mutex> lock(cache_mutex);
+				for (const auto& r : recorders) {
+					r->collect(*traffic);
+				}
+			}
+			log_traffic(*traffic);
+		}
 	}
 }
 
+void DNSServer::stats(unsigned int interval)
+{
+	auto t = std::thread(&DNSServer::stats_thread, this, interval);
+	thread_setname(t, "stats");
+	t.detach();
+}
+
 //---------------------------------------------------------------------
 
-void DNSServer::loader_thread(std::string filename, bool compress)
+// written to by the SIGHUP handler to wake the loader thread
+static int reload_pipe[2] = {-1, -1};
+
+static void reload_signal(int)
+{
+	auto saved = errno;
+	char c = 0;
+	(void)!::write(reload_pipe[1], &c, 1);
+	errno = saved;
+}
+
+static void reload_setup()
 {
+	if (::pipe2(reload_pipe, O_NONBLOCK | O_CLOEXEC) < 0) {
+		throw_errno("pipe2");
+	}
+
+	struct sigaction sa = {};
+	sa.sa_handler = reload_signal;
+	sa.sa_flags = SA_RESTART;
+	::sigaction(SIGHUP, &sa, nullptr);
+}
+
+// waits for up to the given number of seconds, returning true on SIGHUP
+static bool reload_wait(unsigned seconds)
+{
+	pollfd pfd = {reload_pipe[0], POLLIN, 0};
+	if (::poll(&pfd, 1, seconds * 1000) <= 0) {
+		return false;
+	}
+
+	char buf[64];
+	while (::read(reload_pipe[0], buf, sizeof buf) > 0)
+		;
+	return true;
+}
+
+//
+// returns true if any of the pending inotify events are for the given
+// file name being closed after writing or renamed into place
+//
+static bool inotify_match(int fd, const std::string& name)
+{
+	alignas(inotify_event) char buf[4096];
+	bool			    match = false;
+
+	ssize_t n;
+	while ((n = ::read(fd, buf, sizeof buf)) > 0) {
+		for (auto p = buf; p < buf + n;) {
+			auto ev = reinterpret_cast<const inotify_event*>(p);
+			if (ev->len && name == ev->name) {
+				match = true;
+			}
+			p += sizeof(inotify_event) + ev->len;
+		}
+	}
+
+	return match;
+}
+
+//
+// reloads the zone when the file is replaced (via inotify on its
+// directory, so that both in-place writes and renames are seen) or
+// on SIGHUP.  Bursts of events are coalesced by waiting until the file
+// has been left alone for a short while, but no longer than a few
+// seconds in all.  If inotify is unavailable the file's mtime is
+// polled instead.
+//
+void DNSServer::loader_thread(std::string filename, ZoneOptions options)
+{
+	housekeeping_enter();
+
+	using clock = std::chrono::steady_clock;
+	const auto debounce = std::chrono::milliseconds(500);
+	const auto debounce_max = std::chrono::seconds(5);
+
+	try {
+		zone.load(filename, options);
+	} catch (std::exception& e) {
+		std::cerr << "error: " << e.what() << std::endl;
+	}
+
+	auto slash = filename.rfind('/');
+	auto dir = (slash == std::string::npos) ? std::string(".") : filename.substr(0, slash + 1);
+	auto base = (slash == std::string::npos) ? filename : filename.substr(slash + 1);
+
+	int ifd = ::inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (ifd >= 0 && ::inotify_add_watch(ifd, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+		::close(ifd);
+		ifd = -1;
+	}
+	if (ifd < 0) {
+		syslog(LOG_WARNING, "inotify unavailable, polling %s for changes", filename.c_str());
+	}
+
 	timespec    mtim = {0, 0};
 	struct stat st;
-	bool	first = true;
+	if (::stat(filename.c_str(), &st) == 0) {
+		mtim = st.st_mtim;
+	}
 
 	while (true) {
-		int res = ::stat(filename.c_str(), &st);
-		if (first || (res == 0 && !(st.st_mtim == mtim))) {
-			try {
-				zone.load(filename, compress);
-				mtim = st.st_mtim;
-			} catch (std::exception& e) {
-				std::cerr << "error: " << e.what() << std::endl;
+		pollfd fds[2] = {{reload_pipe[0], POLLIN, 0}, {ifd, POLLIN, 0}};
+		if (::poll(fds, 2, (ifd < 0) ? 1000 : -1) < 0) {
+			continue;
+		}
+
+		bool force = (fds[0].revents & POLLIN) && reload_wait(0);
+
+		bool changed = false;
+		if (ifd >= 0 && (fds[1].revents & POLLIN)) {
+			changed = inotify_match(ifd, base);
+
+			// wait for the writer to finish, ignoring events for
+			// other files in the directory
+			auto now = clock::now();
+			auto quiet = now + debounce;
+			auto limit = now + debounce_max;
+			while (changed) {
+				auto left = std::min(quiet, limit) - clock::now();
+				auto ms = left / std::chrono::milliseconds(1);
+				pollfd pfd = {ifd, POLLIN, 0};
+				if (ms <= 0 || ::poll(&pfd, 1, ms) <= 0) {
+					break;
+				}
+				if (inotify_match(ifd, base)) {
+					quiet = clock::now() + debounce;
+				}
 			}
+		} else if (ifd < 0) {
+			changed = (::stat(filename.c_str(), &st) == 0 && !(st.st_mtim == mtim));
+		}
+
+		if (force) {
+			reload_acl();
+		}
+
+		if (!force && !changed) {
+			continue;
+		}
+
+		if (::stat(filename.c_str(), &st) == 0) {
+			mtim = st.st_mtim;
+		}
+
+		try {
+			zone.load(filename, options, true, force);
+		} catch (std::exception& e) {
+			std::cerr << "error: " << e.what() << std::endl;
 		}
-		first = false;
-		std::this_thread::sleep_for(std::chrono::seconds(1));
 	}
 }
 
-void DNSServer::load(const std::string& filename, bool compress)
+void DNSServer::load(const std::string& filename, const ZoneOptions& options)
 {
-	auto t = std::thread(&DNSServer::loader_thread, this, filename, compress);
+	reload_setup();
+
+	auto t = std::thread(&DNSServer::loader_thread, this, filename, options);
 	thread_setname(t, "zone-loader");
 	t.detach();
 }
 
-void DNSServer::load_sync(const std::string& filename, bool compress)
+//
+// keeps the zone up to date by transfers from the primary servers,
+// checking their SOA serial at the interval given in the zone's SOA
+// record, or immediately on SIGHUP
+//
+void DNSServer::transfer_thread(std::vector<ZoneTransfer::Primary> primaries,
+				ZoneOptions			    options)
+{
+	housekeeping_enter();
+
+	ZoneTransfer xfr(primaries);
+
+	while (true) {
+		auto wait = xfr.retry_interval();
+		try {
+			// only a zone that loads becomes the base for the next IXFR
+			if (xfr.refresh()) {
+				zone.load(xfr.zone(), options);
+				xfr.commit();
+			}
+			wait = xfr.refresh_interval();
+		} catch (std::exception& e) {
+			syslog(LOG_WARNING, "zone refresh failed: %s", e.what());
+		}
+		if (reload_wait(wait)) {
+			reload_acl();
+		}
+	}
+}
+
+void DNSServer::transfer(const std::vector<ZoneTransfer::Primary>& primaries,
+			 const ZoneOptions&			     options)
+{
+	reload_setup();
+
+	auto t = std::thread(&DNSServer::transfer_thread, this, primaries, options);
+	thread_setname(t, "zone-transfer");
+	t.detach();
+}
+
+void DNSServer::load_sync(const std::string& filename, const ZoneOptions& options)
 {
-	zone.load(filename, compress, false);
+	zone.load(filename, options, false);
 }
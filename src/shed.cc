@@ -0,0 +1,81 @@
+/*
+ * Copyright (C) Internet Systems Consortium, Inc. ("ISC")
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ */
+
+#include <algorithm>
+#include <stdexcept>
+
+#include "shed.h"
+
+LoadShedder::Config LoadShedder::Config::parse(const std::string& spec)
+{
+	Config config;
+
+	auto number = [&](const std::string& s) -> unsigned {
+		size_t n = 0;
+		auto   v = std::stoul(s, &n);
+		if (n != s.size() || v == 0 || v > 100) {
+			throw std::invalid_argument("number");
+		}
+		return v;
+	};
+
+	try {
+		// a bare number is where shedding starts
+		if (!spec.empty() && spec.find('=') == std::string::npos) {
+			auto first = number(spec);
+			for (auto i = 0U; i < classes; ++i) {
+				config.watermark[i] = first + i * (100 - first) / classes;
+			}
+			return config;
+		}
+
+		size_t pos = 0;
+		while (pos < spec.size()) {
+			auto end = std::min(spec.find(',', pos), spec.size());
+			auto item = spec.substr(pos, end - pos);
+			pos = end + 1;
+
+			auto eq = item.find('=');
+			if (eq == std::string::npos) {
+				throw std::invalid_argument("item");
+			}
+
+			auto name = item.substr(0, eq);
+			auto value = number(item.substr(eq + 1));
+
+			if (name == "any") {
+				config.watermark[any] = value;
+			} else if (name == "noedns") {
+				config.watermark[noedns] = value;
+			} else if (name == "nxdomain") {
+				config.watermark[nxdomain] = value;
+			} else if (name == "do") {
+				config.watermark[dnssec] = value;
+			} else {
+				throw std::invalid_argument("name");
+			}
+		}
+	} catch (std::logic_error&) {
+		throw std::runtime_error("invalid shedding watermarks: " + spec);
+	}
+
+	if (!config.enabled()) {
+		throw std::runtime_error("invalid shedding watermarks: " + spec);
+	}
+
+	return config;
+}
+
+LoadShedder::LoadShedder(const Config& config)
+{
+	for (auto i = 0U; i < classes; ++i) {
+		watermark[i] = config.watermark[i];
+		_shed[i] = 0;
+	}
+}
@@ -0,0 +1,279 @@
+/*
+ * Copyright (C) Internet Systems Consortium, Inc. ("ISC")
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ */
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+#include "grace.h"
+#include "sketch.h"
+#include "util.h"
+
+static uint64_t mix(uint64_t h)
+{
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ULL;
+	h ^= h >> 33;
+	return h;
+}
+
+// eight bytes at a time with a single finaliser, since this runs
+// several times per query and every 16 bits of the result are used
+// to index the sketch
+static uint64_t hash(const void* key, size_t len)
+{
+	auto	 p = reinterpret_cast<const uint8_t*>(key);
+	uint64_t h = len;
+
+	for (; len >= 8; len -= 8, p += 8) {
+		uint64_t w;
+		::memcpy(&w, p, sizeof w);
+		h = ((h << 29) | (h >> 35)) ^ (w * 0x9e3779b97f4a7c15ULL);
+	}
+
+	if (len) {
+		uint64_t w = 0; // NB: memcpy() of a variable length is a call
+		for (auto i = 0U; i < len; ++i) {
+			w |= uint64_t(p[i]) << (8 * i);
+		}
+		h = ((h << 29) | (h >> 35)) ^ (w * 0x9e3779b97f4a7c15ULL);
+	}
+
+	return mix(h);
+}
+
+static bool fewer(const TrafficSketch::Item& a, const TrafficSketch::Item& b)
+{
+	return a.count < b.count;
+}
+
+//---------------------------------------------------------------------
+
+// each row is indexed by its own 16 bits of the hash
+uint64_t TrafficSketch::Summary::estimate(uint64_t hash) const
+{
+	uint64_t result = UINT64_MAX;
+	for (auto i = 0U; i < depth; ++i, hash >>= 16) {
+		auto n = counts[i * width + (hash & (width - 1))];
+		result = std::min(result, uint64_t(n));
+	}
+	return result;
+}
+
+uint64_t TrafficSketch::Summary::increment(uint64_t hash)
+{
+	uint64_t result = UINT64_MAX;
+	for (auto i = 0U; i < depth; ++i, hash >>= 16) {
+		auto n = ++counts[i * width + (hash & (width - 1))];
+		result = std::min(result, uint64_t(n));
+	}
+	return result;
+}
+
+//
+// updates or adds a candidate, replacing the smallest if the table is
+// full.  An estimate never goes down, so a key with an estimate below
+// the table's minimum can't already be in it.
+//
+void TrafficSketch::Summary::offer(uint64_t hash, uint64_t count, const void* key, size_t len)
+{
+	bool full = items.size() == capacity;
+	if (full && count < min) {
+		return;
+	}
+
+	// keys are told apart just by their 64-bit hash and length, which
+	// is plenty for statistics
+	auto iter = std::find_if(items.begin(), items.end(), [&](const Item& i) {
+		return i.hash == hash && i.key.len == len;
+	});
+
+	if (iter != items.end()) {
+		bool was_min = iter->count == min;
+		iter->count = std::max(iter->count, count);
+		if (!full || !was_min) {
+			return;
+		}
+	} else {
+		Item item;
+		item.hash = hash;
+		item.count = count;
+		item.key.len = std::min(len, sizeof item.key.data);
+		::memcpy(item.key.data, key, item.key.len);
+
+		if (!full) {
+			items.push_back(item);
+			if (items.size() < capacity) {
+				return;
+			}
+		} else {
+			// the candidates' counts lag the sketch, so before evicting
+			// the smallest bring its count up to date, lest background
+			// noise churn the table
+			auto victim = std::min_element(items.begin(), items.end(), fewer);
+			victim->count = estimate(victim->hash);
+			if (victim->count < count) {
+				*victim = item;
+			}
+		}
+	}
+
+	min = std::min_element(items.begin(), items.end(), fewer)->count;
+}
+
+//---------------------------------------------------------------------
+
+void TrafficSketch::add(Stream stream, const void* key, size_t len)
+{
+	auto& s = summary[stream];
+	auto  h = hash(key, len);
+	auto  n = s.increment(h);
+
+	if (s.items.size() == capacity && n < s.min) {
+		return;
+	}
+
+	s.offer(h, n, key, len);
+}
+
+void TrafficSketch::record(const in6_addr& client, const uint8_t* tld, size_t len, bool nxdomain)
+{
+	++_total;
+
+	add(clients, &client, sizeof client);
+
+	// the client's /24 or /56, as in RRL
+	auto prefix = client;
+	if (IN6_IS_ADDR_V4MAPPED(&client)) {
+		prefix.s6_addr[15] = 0;
+	} else {
+		::memset(&prefix.s6_addr[7], 0, 9);
+	}
+	add(prefixes, &prefix, sizeof prefix);
+
+	add(tlds, tld, len);
+	if (nxdomain) {
+		add(nxdomains, tld, len);
+	}
+}
+
+void TrafficSketch::merge(const TrafficSketch& other)
+{
+	for (auto i = 0U; i < streams; ++i) {
+		auto&	    s = summary[i];
+		const auto& o = other.summary[i];
+
+		for (auto j = 0U; j < depth * width; ++j) {
+			s.counts[j] += o.counts[j];
+		}
+
+		for (const auto& item : o.items) {
+			s.offer(item.hash, s.estimate(item.hash), item.key.data, item.key.len);
+		}
+	}
+
+	_total += other._total;
+}
+
+void TrafficSketch::clear()
+{
+	for (auto& s : summary) {
+		::memset(s.counts, 0, sizeof s.counts);
+		s.items.clear();
+		s.min = 0;
+	}
+	_total = 0;
+}
+
+// the candidates with the highest current estimates
+std::vector<TrafficSketch::Item> TrafficSketch::top(Stream stream, size_t n) const
+{
+	const auto& s = summary[stream];
+
+	auto result = s.items;
+	for (auto& item : result) {
+		item.count = s.estimate(item.hash);
+	}
+
+	std::sort(result.begin(), result.end(),
+		  [](const Item& a, const Item& b) { return fewer(b, a); });
+	if (result.size() > n) {
+		result.resize(n);
+	}
+
+	return result;
+}
+
+std::string TrafficSketch::text(Stream stream, const Key& key)
+{
+	if (stream == clients || stream == prefixes) {
+		in6_addr addr;
+		::memcpy(&addr, key.data, sizeof addr);
+
+		if (IN6_IS_ADDR_V4MAPPED(&addr)) {
+			in_addr addr4;
+			::memcpy(&addr4, &addr.s6_addr[12], sizeof addr4);
+			return inet_ntop(addr4) + ((stream == prefixes) ? "/24" : "");
+		} else {
+			return inet_ntop(addr) + ((stream == prefixes) ? "/56" : "");
+		}
+	}
+
+	// a label, with anything unprintable escaped
+	if (key.len == 0) {
+		return ".";
+	}
+
+	std::string result;
+	for (auto i = 0U; i < key.len; ++i) {
+		auto c = key.data[i];
+		if (c > 0x20 && c < 0x7f && c != '.' && c != '\\') {
+			result += c;
+		} else {
+			char buf[5];
+			snprintf(buf, sizeof buf, "\\%03u", c);
+			result += buf;
+		}
+	}
+
+	return result;
+}
+
+TrafficSketch::TrafficSketch()
+{
+	for (auto& s : summary) {
+		s.items.reserve(capacity);
+	}
+	clear();
+}
+
+//---------------------------------------------------------------------
+
+void TrafficRecorder::collect(TrafficSketch& into)
+{
+	auto full = active.load(std::memory_order_relaxed);
+	auto empty = (full == buffers[0].get()) ? buffers[1].get() : buffers[0].get();
+
+	// once the worker's current packet is done, it can't still be
+	// writing to the full buffer
+	active.store(empty, std::memory_order_release);
+	GracePeriod::wait();
+
+	into.merge(*full);
+	full->clear();
+}
+
+TrafficRecorder::TrafficRecorder()
+    : buffers{std::unique_ptr<TrafficSketch>(new TrafficSketch()),
+	      std::unique_ptr<TrafficSketch>(new TrafficSketch())},
+      active(buffers[0].get())
+{
+}
@@ -7,8 +7,85 @@
  *
  */
 
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <syslog.h>
+#include <unistd.h>
+
 #include "thread.h"
 
+CPUList cpu_list(const std::string& spec)
+{
+	CPUList result;
+	size_t	pos = 0;
+
+	auto number = [&]() -> unsigned {
+		size_t n = 0;
+		auto   v = std::stoul(spec.substr(pos), &n);
+		if (v >= CPU_SETSIZE) {
+			throw std::out_of_range("CPU number");
+		}
+		pos += n;
+		return v;
+	};
+
+	try {
+		while (pos < spec.size()) {
+			auto first = number();
+			auto last = first;
+			if (pos < spec.size() && spec[pos] == '-') {
+				++pos;
+				last = number();
+			}
+			if (last < first || (pos < spec.size() && spec[pos++] != ',')) {
+				throw std::invalid_argument("CPU list");
+			}
+			for (auto cpu = first; cpu <= last; ++cpu) {
+				result.push_back(cpu);
+			}
+		}
+	} catch (std::logic_error&) {
+		throw std::runtime_error("invalid CPU list: " + spec);
+	}
+
+	std::sort(result.begin(), result.end());
+	result.erase(std::unique(result.begin(), result.end()), result.end());
+
+	if (result.empty()) {
+		throw std::runtime_error("invalid CPU list: " + spec);
+	}
+
+	return result;
+}
+
+std::string cpu_list_text(const CPUList& cpus)
+{
+	std::string result;
+
+	for (size_t i = 0; i < cpus.size();) {
+		auto j = i;
+		while (j + 1 < cpus.size() && cpus[j + 1] == cpus[j] + 1) {
+			++j;
+		}
+		if (!result.empty()) {
+			result += ",";
+		}
+		result += std::to_string(cpus[i]);
+		if (j > i) {
+			result += "-" + std::to_string(cpus[j]);
+		}
+		i = j + 1;
+	}
+
+	return result;
+}
+
 void thread_setcpu(std::thread& t, unsigned int n)
 {
 	cpu_set_t cpu;
@@ -21,3 +98,49 @@ void thread_setname(std::thread& t, const std::string& name)
 {
 	pthread_setname_np(t.native_handle(), name.substr(0, 15).c_str());
 }
+
+// --------------------------------------------------------------------
+
+static struct {
+	CPUList cpus; // empty for no restriction
+	bool	idle = false;
+	int	nice = 10;
+} housekeeping;
+
+void housekeeping_configure(const CPUList& cpus, bool idle, int nice)
+{
+	housekeeping.cpus = cpus;
+	housekeeping.idle = idle;
+	housekeeping.nice = nice;
+}
+
+void housekeeping_pin()
+{
+	if (!housekeeping.cpus.empty()) {
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		for (auto cpu : housekeeping.cpus) {
+			CPU_SET(cpu, &set);
+		}
+		if (auto err = pthread_setaffinity_np(pthread_self(), sizeof set, &set)) {
+			syslog(LOG_WARNING, "housekeeping CPU affinity: %s", strerror(err));
+		}
+	}
+}
+
+void housekeeping_enter()
+{
+	housekeeping_pin();
+
+	sched_param param = {};
+	auto	    policy = housekeeping.idle ? SCHED_IDLE : SCHED_BATCH;
+	if (auto err = pthread_setschedparam(pthread_self(), policy, &param)) {
+		syslog(LOG_WARNING, "housekeeping scheduling policy: %s", strerror(err));
+	}
+
+	// the nice value is per thread on Linux, despite what POSIX says
+	pid_t tid = ::syscall(SYS_gettid);
+	if (::setpriority(PRIO_PROCESS, tid, housekeeping.nice) < 0) {
+		syslog(LOG_WARNING, "housekeeping nice value: %s", strerror(errno));
+	}
+}
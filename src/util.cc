@@ -35,6 +35,16 @@ void throw_errno(const std::string& what)
 	throw std::system_error(errno, std::system_category(), what);
 }
 
+uint64_t fnv1a64(const void* buf, size_t n, uint64_t h)
+{
+	auto p = reinterpret_cast<const uint8_t*>(buf);
+	while (n--) {
+		h ^= *p++;
+		h *= 1099511628211ULL;
+	}
+	return h;
+}
+
 void hexdump(std::ostream& os, const void* buf, size_t n)
 {
 	auto p = reinterpret_cast<const uint8_t*>(buf);
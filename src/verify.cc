@@ -0,0 +1,630 @@
+/*
+ * Copyright (C) Internet Systems Consortium, Inc. ("ISC")
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+
+#include <ldns/ldns.h>
+#include <openssl/core_names.h>
+#include <openssl/ecdsa.h>
+#include <openssl/err.h>
+#include <openssl/evp.h>
+#include <openssl/param_build.h>
+
+#include "util.h"
+#include "verify.h"
+
+static const uint16_t dnskey_zone = 0x0100;   // DNSKEY flags
+static const uint16_t dnskey_revoke = 0x0080;
+static const uint8_t  zonemd_simple = 1;      // ZONEMD scheme
+static const size_t   zonemd_min_digest = 12; // RFC 8976 section 2.2.4
+
+// --------------------------------------------------------------------
+
+static uint16_t get16(const uint8_t* p)
+{
+	return (p[0] << 8) | p[1];
+}
+
+static uint32_t get32(const uint8_t* p)
+{
+	return (uint32_t(get16(p)) << 16) | get16(p + 2);
+}
+
+static void put16(std::string& out, uint16_t v)
+{
+	out.push_back(v >> 8);
+	out.push_back(v & 0xff);
+}
+
+static void put32(std::string& out, uint32_t v)
+{
+	put16(out, v >> 16);
+	put16(out, v & 0xffff);
+}
+
+// the length of an uncompressed name within the given number of bytes
+static size_t name_length(const uint8_t* p, size_t len)
+{
+	size_t n = 0;
+	while (n < len) {
+		auto c = p[n];
+		if (c & 0xc0) {
+			break;
+		}
+		n += c + 1;
+		if (c == 0) {
+			return n;
+		}
+	}
+	throw std::runtime_error("malformed name in RDATA");
+}
+
+static unsigned label_count(const uint8_t* name)
+{
+	unsigned n = 0;
+	for (; *name; name += *name + 1) {
+		++n;
+	}
+	return n;
+}
+
+// the name in presentation format, for error messages
+static std::string name_text(const uint8_t* name)
+{
+	std::string result;
+	for (; *name; name += *name + 1) {
+		result.append(reinterpret_cast<const char*>(name + 1), *name);
+		result.push_back('.');
+	}
+	return result.empty() ? "." : result;
+}
+
+static std::string rrset_text(const ZoneNode& node, uint16_t type)
+{
+	return name_text(node.name) + " TYPE" + std::to_string(type);
+}
+
+//
+// the RDATA in canonical form, with the embedded names of the types
+// listed in RFC 4034 section 6.2 (as amended by RFC 6840 section 5.1)
+// that can appear in the root zone converted to lower case
+//
+static std::string canonical_rdata(const Record& rr)
+{
+	std::string out(reinterpret_cast<const char*>(rr.rdata), rr.rdlen);
+
+	size_t start = 0;
+	size_t end = 0;
+	switch (rr.type) {
+	case LDNS_RR_TYPE_NS:
+	case LDNS_RR_TYPE_CNAME:
+	case LDNS_RR_TYPE_PTR:
+	case LDNS_RR_TYPE_DNAME: end = name_length(rr.rdata, rr.rdlen); break;
+	case LDNS_RR_TYPE_SOA:
+		end = name_length(rr.rdata, rr.rdlen);
+		end += name_length(rr.rdata + end, rr.rdlen - end);
+		break;
+	case LDNS_RR_TYPE_MX:
+		start = 2;
+		end = start + name_length(rr.rdata + start, std::max(rr.rdlen, uint16_t(2)) - 2);
+		break;
+	case LDNS_RR_TYPE_RRSIG:
+		start = 18;
+		end = start + name_length(rr.rdata + start, std::max(rr.rdlen, uint16_t(18)) - 18);
+		break;
+	}
+
+	for (auto i = start; i < end; ++i) {
+		out[i] = lower(out[i]);
+	}
+
+	return out;
+}
+
+static void append_rr(std::string& out, const std::string& owner, uint16_t type, uint16_t klass,
+		      uint32_t ttl, const std::string& rdata)
+{
+	out += owner;
+	put16(out, type);
+	put16(out, klass);
+	put32(out, ttl);
+	put16(out, rdata.size());
+	out += rdata;
+}
+
+// --------------------------------------------------------------------
+
+struct ZoneVerifier::Key {
+	uint16_t      tag;
+	uint8_t	      algorithm;
+	EVP_PKEY*     pkey = nullptr;
+	const EVP_MD* md = nullptr; // none for EdDSA
+	size_t	      ecdsa = 0;    // the size of r and s, for ECDSA
+
+	bool verify(const std::string& data, const uint8_t* sig, size_t len) const;
+
+	~Key()
+	{
+		EVP_PKEY_free(pkey);
+	}
+};
+
+bool ZoneVerifier::Key::verify(const std::string& data, const uint8_t* sig, size_t len) const
+{
+	// ECDSA signatures are just r and s (RFC 6605), OpenSSL wants DER
+	std::vector<uint8_t> der;
+	if (ecdsa) {
+		if (len != 2 * ecdsa) {
+			return false;
+		}
+		auto s = ECDSA_SIG_new();
+		ECDSA_SIG_set0(s, BN_bin2bn(sig, ecdsa, nullptr),
+			       BN_bin2bn(sig + ecdsa, ecdsa, nullptr));
+		der.resize(i2d_ECDSA_SIG(s, nullptr));
+		auto p = der.data();
+		i2d_ECDSA_SIG(s, &p);
+		ECDSA_SIG_free(s);
+		sig = der.data();
+		len = der.size();
+	}
+
+	auto ctx = EVP_MD_CTX_new();
+	auto ok = ctx && EVP_DigestVerifyInit(ctx, nullptr, md, nullptr, pkey) == 1 &&
+		  EVP_DigestVerify(ctx, sig, len, reinterpret_cast<const uint8_t*>(data.data()),
+				   data.size()) == 1;
+	EVP_MD_CTX_free(ctx);
+
+	if (!ok) {
+		ERR_clear_error();
+	}
+
+	return ok;
+}
+
+static EVP_PKEY* make_pkey(const char* type, OSSL_PARAM* params)
+{
+	EVP_PKEY* pkey = nullptr;
+
+	auto ctx = EVP_PKEY_CTX_new_from_name(nullptr, type, nullptr);
+	if (ctx && EVP_PKEY_fromdata_init(ctx) == 1) {
+		EVP_PKEY_fromdata(ctx, &pkey, EVP_PKEY_PUBLIC_KEY, params);
+	}
+	EVP_PKEY_CTX_free(ctx);
+
+	return pkey;
+}
+
+// exponent length, exponent and modulus (RFC 3110 section 2)
+static EVP_PKEY* rsa_key(const uint8_t* p, size_t len)
+{
+	if (len < 3) {
+		return nullptr;
+	}
+
+	size_t elen = p[0];
+	size_t offset = 1;
+	if (elen == 0) {
+		elen = get16(p + 1);
+		offset = 3;
+	}
+	if (elen == 0 || offset + elen >= len) {
+		return nullptr;
+	}
+
+	auto e = BN_bin2bn(p + offset, elen, nullptr);
+	auto n = BN_bin2bn(p + offset + elen, len - offset - elen, nullptr);
+
+	auto bld = OSSL_PARAM_BLD_new();
+	OSSL_PARAM_BLD_push_BN(bld, OSSL_PKEY_PARAM_RSA_N, n);
+	OSSL_PARAM_BLD_push_BN(bld, OSSL_PKEY_PARAM_RSA_E, e);
+	auto params = OSSL_PARAM_BLD_to_param(bld);
+
+	auto pkey = params ? make_pkey("RSA", params) : nullptr;
+
+	OSSL_PARAM_free(params);
+	OSSL_PARAM_BLD_free(bld);
+	BN_free(n);
+	BN_free(e);
+
+	return pkey;
+}
+
+// the curve point as x followed by y (RFC 6605 section 4)
+static EVP_PKEY* ec_key(const char* group, const uint8_t* p, size_t len)
+{
+	std::vector<uint8_t> point(len + 1);
+	point[0] = 0x04; // uncompressed
+	::memcpy(point.data() + 1, p, len);
+
+	OSSL_PARAM params[] = {
+		OSSL_PARAM_construct_utf8_string(OSSL_PKEY_PARAM_GROUP_NAME,
+						 const_cast<char*>(group), 0),
+		OSSL_PARAM_construct_octet_string(OSSL_PKEY_PARAM_PUB_KEY, point.data(),
+						  point.size()),
+		OSSL_PARAM_construct_end()};
+
+	return make_pkey("EC", params);
+}
+
+// RFC 4034 appendix B
+static uint16_t key_tag(const uint8_t* p, size_t len)
+{
+	uint32_t ac = 0;
+	for (size_t i = 0; i < len; ++i) {
+		ac += (i & 1) ? p[i] : p[i] << 8;
+	}
+	ac += (ac >> 16) & 0xffff;
+	return ac & 0xffff;
+}
+
+//
+// the apex DNSKEYs that are zone keys and use an algorithm we support
+//
+void ZoneVerifier::load_keys()
+{
+	for (auto rr : zone.apex()->records) {
+		if (rr->type != LDNS_RR_TYPE_DNSKEY || rr->rdlen < 4) {
+			continue;
+		}
+
+		auto flags = get16(rr->rdata);
+		if (!(flags & dnskey_zone) || (flags & dnskey_revoke) || rr->rdata[2] != 3) {
+			continue;
+		}
+
+		std::unique_ptr<Key> key(new Key());
+		key->tag = key_tag(rr->rdata, rr->rdlen);
+		key->algorithm = rr->rdata[3];
+
+		auto p = rr->rdata + 4;
+		auto len = rr->rdlen - 4U;
+
+		switch (key->algorithm) {
+		case LDNS_RSASHA1:
+		case LDNS_RSASHA1_NSEC3:
+			key->pkey = rsa_key(p, len);
+			key->md = EVP_sha1();
+			break;
+		case LDNS_RSASHA256:
+			key->pkey = rsa_key(p, len);
+			key->md = EVP_sha256();
+			break;
+		case LDNS_RSASHA512:
+			key->pkey = rsa_key(p, len);
+			key->md = EVP_sha512();
+			break;
+		case LDNS_ECDSAP256SHA256:
+			key->pkey = (len == 64) ? ec_key("prime256v1", p, len) : nullptr;
+			key->md = EVP_sha256();
+			key->ecdsa = 32;
+			break;
+		case LDNS_ECDSAP384SHA384:
+			key->pkey = (len == 96) ? ec_key("secp384r1", p, len) : nullptr;
+			key->md = EVP_sha384();
+			key->ecdsa = 48;
+			break;
+		case LDNS_ED25519:
+			key->pkey = EVP_PKEY_new_raw_public_key(EVP_PKEY_ED25519, nullptr, p, len);
+			break;
+		case LDNS_ED448:
+			key->pkey = EVP_PKEY_new_raw_public_key(EVP_PKEY_ED448, nullptr, p, len);
+			break;
+		}
+
+		if (key->pkey) {
+			keys.push_back(std::move(key));
+		} else {
+			ERR_clear_error();
+		}
+	}
+
+	if (keys.empty()) {
+		throw std::runtime_error("zone has no usable DNSKEY records");
+	}
+}
+
+// --------------------------------------------------------------------
+
+//
+// RFC 8976 section 3 - the digest of every record in the zone in
+// canonical order, bar the apex ZONEMD RRset and its signatures.  Any
+// one ZONEMD record with the SOA's serial, the SIMPLE scheme and a
+// supported hash algorithm that matches is sufficient.
+//
+void ZoneVerifier::check_digest() const
+{
+	auto apex = zone.apex();
+	auto serial = zone.serial();
+
+	std::vector<const Record*> zonemds;
+	bool			   found = false;
+
+	for (auto rr : apex->records) {
+		if (rr->type != LDNS_RR_TYPE_ZONEMD) {
+			continue;
+		}
+		found = true;
+		if (rr->rdlen >= 6 + zonemd_min_digest && get32(rr->rdata) == serial &&
+		    rr->rdata[4] == zonemd_simple && (rr->rdata[5] == 1 || rr->rdata[5] == 2)) {
+			zonemds.push_back(rr);
+		}
+	}
+
+	if (!found) {
+		throw std::runtime_error("zone has no ZONEMD record");
+	} else if (zonemds.empty()) {
+		throw std::runtime_error("zone has no ZONEMD record for this serial with a "
+					 "supported scheme and hash algorithm");
+	}
+
+	// one context per hash algorithm, indexed by its number
+	EVP_MD_CTX* ctx[3] = {nullptr, nullptr, EVP_MD_CTX_new()};
+	ctx[1] = EVP_MD_CTX_new();
+	EVP_DigestInit_ex(ctx[1], EVP_sha384(), nullptr);
+	EVP_DigestInit_ex(ctx[2], EVP_sha512(), nullptr);
+
+	// RRsets in type order, and RRs within them by canonical RDATA
+	struct RR {
+		const Record* rr;
+		std::string   rdata;
+
+		bool operator<(const RR& b) const
+		{
+			return rr->type != b.rr->type ? rr->type < b.rr->type : rdata < b.rdata;
+		}
+	};
+
+	std::vector<RR> rrs;
+	std::string	buf;
+
+	for (auto node : zone.names()) {
+		auto owner = strlower(node->name, ZoneData::name_length(node->name));
+
+		rrs.clear();
+		for (auto rr : node->records) {
+			if (node == apex && rr->covered() == LDNS_RR_TYPE_ZONEMD) {
+				continue;
+			}
+			rrs.push_back({rr, canonical_rdata(*rr)});
+		}
+		std::sort(rrs.begin(), rrs.end());
+
+		buf.clear();
+		for (const auto& rr : rrs) {
+			append_rr(buf, owner, rr.rr->type, rr.rr->klass, rr.rr->ttl, rr.rdata);
+		}
+
+		for (auto c : ctx) {
+			if (c) {
+				EVP_DigestUpdate(c, buf.data(), buf.size());
+			}
+		}
+	}
+
+	uint8_t	     digest[3][EVP_MAX_MD_SIZE];
+	unsigned int length[3] = {0, 0, 0};
+	for (auto h = 1; h < 3; ++h) {
+		EVP_DigestFinal_ex(ctx[h], digest[h], &length[h]);
+		EVP_MD_CTX_free(ctx[h]);
+	}
+
+	for (auto rr : zonemds) {
+		auto h = rr->rdata[5];
+		if (rr->rdlen - 6U == length[h] && ::memcmp(rr->rdata + 6, digest[h], length[h]) == 0) {
+			return;
+		}
+	}
+
+	throw std::runtime_error("ZONEMD digest does not match the zone");
+}
+
+// --------------------------------------------------------------------
+
+//
+// checks one RRSIG over the given RRset (RFC 4035 section 5.3),
+// returning false with the reason if it isn't valid
+//
+bool ZoneVerifier::check_signature(const Record& sig, const std::vector<const Record*>& rrset,
+				   std::string& why) const
+{
+	if (sig.rdlen < 19) {
+		why = "malformed RRSIG";
+		return false;
+	}
+
+	auto r = sig.rdata;
+	auto algorithm = r[2];
+	auto labels = r[3];
+	auto ttl = get32(r + 4);
+	auto expiration = get32(r + 8);
+	auto inception = get32(r + 12);
+	auto tag = get16(r + 16);
+	auto signer = name_length(r + 18, sig.rdlen - 18U);
+
+	auto apex = zone.apex()->name;
+	if (signer != ZoneData::name_length(apex) || strlower(r + 18, signer) != strlower(apex, signer)) {
+		why = "signer is not the zone apex";
+		return false;
+	}
+
+	// serial number arithmetic (RFC 4034 section 3.1.5)
+	if (int32_t(now - inception) < 0) {
+		why = "signature not yet valid";
+		return false;
+	} else if (int32_t(expiration - now) < 0) {
+		why = "signature expired";
+		return false;
+	}
+
+	// the RRSIG RDATA without the signature, then the RRset in
+	// canonical form and order
+	auto data = canonical_rdata(sig).substr(0, 18 + signer);
+
+	auto owner = rrset[0]->owner;
+	auto count = label_count(owner);
+	if (labels > count) {
+		why = "RRSIG label count too large";
+		return false;
+	}
+
+	std::string wild;
+	while (count-- > labels) {
+		owner += *owner + 1;
+	}
+	if (labels < label_count(rrset[0]->owner)) {
+		wild = "\001*";
+	}
+	wild += strlower(owner, ZoneData::name_length(owner));
+
+	std::vector<std::string> rdatas;
+	for (auto rr : rrset) {
+		rdatas.push_back(canonical_rdata(*rr));
+	}
+	std::sort(rdatas.begin(), rdatas.end());
+	rdatas.erase(std::unique(rdatas.begin(), rdatas.end()), rdatas.end());
+
+	for (const auto& rdata : rdatas) {
+		append_rr(data, wild, rrset[0]->type, rrset[0]->klass, ttl, rdata);
+	}
+
+	auto signature = r + 18 + signer;
+	auto siglen = sig.rdlen - 18U - signer;
+
+	bool found = false;
+	for (const auto& key : keys) {
+		if (key->tag == tag && key->algorithm == algorithm) {
+			found = true;
+			if (key->verify(data, signature, siglen)) {
+				return true;
+			}
+		}
+	}
+
+	why = found ? "signature does not verify" : "no matching DNSKEY";
+	return false;
+}
+
+//
+// every authoritative RRset at the name must have at least one valid
+// signature.  At a delegation only the DS and NSEC RRsets are signed.
+//
+size_t ZoneVerifier::check_signatures(const ZoneNode& node) const
+{
+	if (node.glue) {
+		return 0;
+	}
+
+	auto cut = (&node != zone.apex()) && node.has(LDNS_RR_TYPE_NS);
+
+	std::map<uint16_t, std::vector<const Record*>> rrsets;
+	std::map<uint16_t, std::vector<const Record*>> sigs;
+	for (auto rr : node.records) {
+		if (rr->type == LDNS_RR_TYPE_RRSIG) {
+			sigs[rr->covered()].push_back(rr);
+		} else {
+			rrsets[rr->type].push_back(rr);
+		}
+	}
+
+	size_t count = 0;
+	for (const auto& iter : rrsets) {
+		auto type = iter.first;
+		if (cut && type != LDNS_RR_TYPE_DS && type != LDNS_RR_TYPE_NSEC) {
+			continue;
+		}
+
+		std::string why = "not signed";
+		bool	    valid = false;
+		for (auto sig : sigs[type]) {
+			++count;
+			if (check_signature(*sig, iter.second, why)) {
+				valid = true;
+				break;
+			}
+		}
+
+		if (!valid) {
+			throw std::runtime_error(rrset_text(node, type) + ": " + why);
+		}
+	}
+
+	return count;
+}
+
+// --------------------------------------------------------------------
+
+size_t ZoneVerifier::verify(unsigned threads)
+{
+	if (!zone.apex()) {
+		throw std::runtime_error("no SOA found in zone");
+	}
+
+	load_keys();
+
+	const auto& names = zone.names();
+
+	// item zero is the digest, which takes the longest so goes first,
+	// and the rest are the names in turn
+	std::atomic<size_t> next{0};
+	std::atomic<size_t> count{0};
+	std::exception_ptr  error;
+	std::mutex	    error_mutex;
+
+	auto worker = [&]() {
+		try {
+			size_t i;
+			while ((i = next.fetch_add(1, std::memory_order_relaxed)) <= names.size()) {
+				if (i == 0) {
+					check_digest();
+				} else {
+					count += check_signatures(*names[i - 1]);
+				}
+			}
+		} catch (...) {
+			std::lock_guard<std::mutex> lock(error_mutex);
+			if (!error) {
+				error = std::current_exception();
+			}
+			next = names.size() + 1; // stop the other threads early
+		}
+	};
+
+	size_t n = std::max(1U, threads);
+	n = std::min(n, names.size() + 1);
+
+	std::vector<std::thread> pool;
+	for (size_t i = 1; i < n; ++i) {
+		pool.emplace_back(worker);
+	}
+	worker();
+
+	for (auto& t : pool) {
+		t.join();
+	}
+
+	if (error) {
+		std::rethrow_exception(error);
+	}
+
+	return count;
+}
+
+ZoneVerifier::ZoneVerifier(const ZoneData& zone, time_t now) : zone(zone), now(now)
+{
+}
+
+ZoneVerifier::~ZoneVerifier()
+{
+}
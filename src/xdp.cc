@@ -0,0 +1,245 @@
+/*
+ * Copyright (C) Internet Systems Consortium, Inc. ("ISC")
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ */
+
+#include <cerrno>
+#include <cstring>
+#include <map>
+#include <stdexcept>
+#include <vector>
+
+#include <net/if.h>
+
+#include "util.h"
+#include "xdp.h"
+#include "xdpmaps.h"
+
+#ifdef HAVE_XDP
+
+#include <bpf/bpf.h>
+#include <bpf/libbpf.h>
+
+// libbpf returns -errno
+static void check(int res, const std::string& what)
+{
+	if (res < 0) {
+		errno = -res;
+		throw_errno(what);
+	}
+}
+
+static int map_fd(bpf_object* obj, const char* name)
+{
+	auto fd = bpf_object__find_map_fd_by_name(obj, name);
+	if (fd < 0) {
+		throw std::runtime_error(std::string("XDP object has no map ") + name);
+	}
+	return fd;
+}
+
+using MapKey = std::vector<uint8_t>;
+
+//
+// makes the map hold exactly the given entries, adding the new ones
+// before deleting the old so that there's never a moment without the
+// blocklist
+//
+static void sync_map(int fd, size_t key_size, const std::map<MapKey, uint8_t>& entries)
+{
+	for (const auto& e : entries) {
+		check(bpf_map_update_elem(fd, e.first.data(), &e.second, BPF_ANY),
+		      "updating XDP blocklist");
+	}
+
+	std::vector<MapKey> stale;
+	MapKey		    key(key_size), next(key_size);
+	const void*	    prev = nullptr;
+
+	while (bpf_map_get_next_key(fd, prev, next.data()) == 0) {
+		if (!entries.count(next)) {
+			stale.push_back(next);
+		}
+		key = next;
+		prev = key.data();
+	}
+
+	for (const auto& k : stale) {
+		(void)bpf_map_delete_elem(fd, k.data());
+	}
+}
+
+// an LPM key for the rule, with the host bits cleared so that each
+// prefix has exactly one key
+template <typename K> static MapKey lpm_key(const uint8_t* addr, unsigned bits)
+{
+	K key = {};
+	key.bits = bits;
+	for (auto i = 0U; i < sizeof key.addr; ++i) {
+		auto n = (bits > i * 8) ? bits - i * 8 : 0;
+		key.addr[i] = (n >= 8) ? addr[i] : addr[i] & uint8_t(0xff00 >> n);
+	}
+
+	auto p = reinterpret_cast<const uint8_t*>(&key);
+	return MapKey(p, p + sizeof key);
+}
+
+XDPFilter::XDPFilter(const std::string& object, const std::string& ifname, const in_addr& addr,
+		     const in6_addr& addr6, uint16_t port)
+    : addr(addr), addr6(addr6), port(port)
+{
+	auto ifindex = ::if_nametoindex(ifname.c_str());
+	if (!ifindex) {
+		throw_errno("if_nametoindex(" + ifname + ")");
+	}
+
+	try {
+		obj = bpf_object__open_file(object.c_str(), nullptr);
+		if (!obj) {
+			throw_errno("opening XDP object " + object);
+		}
+		check(bpf_object__load(obj), "loading XDP object " + object);
+
+		config_fd = map_fd(obj, "config");
+		blocklist4_fd = map_fd(obj, "blocklist4");
+		blocklist6_fd = map_fd(obj, "blocklist6");
+		counters_fd = map_fd(obj, "counters");
+
+		set_rate(0);
+
+		// a link rather than a netlink attachment, so that the
+		// kernel detaches the program if the server dies
+		auto prog = bpf_object__find_program_by_name(obj, "froot_filter");
+		if (!prog) {
+			throw std::runtime_error("XDP object has no froot_filter program");
+		}
+		link = bpf_program__attach_xdp(prog, ifindex);
+		if (!link) {
+			throw_errno("attaching XDP program to " + ifname);
+		}
+	} catch (...) {
+		close();
+		throw;
+	}
+}
+
+XDPFilter::~XDPFilter()
+{
+	close();
+}
+
+void XDPFilter::close()
+{
+	if (link) {
+		bpf_link__destroy(link);
+		link = nullptr;
+	}
+	if (obj) {
+		bpf_object__close(obj);
+		obj = nullptr;
+	}
+}
+
+// the burst allowance is a second's worth, as with RateLimiter
+void XDPFilter::set_rate(unsigned rate)
+{
+	xdp_config config = {};
+	config.addr = addr.s_addr;
+	config.port = htons(port);
+	if (!IN6_IS_ADDR_UNSPECIFIED(&addr6)) {
+		config.has_addr6 = 1;
+		::memcpy(config.addr6, &addr6, sizeof config.addr6);
+	}
+	if (rate) {
+		config.interval = 1000000000ULL / rate;
+		config.burst = config.interval * (rate - 1);
+	}
+
+	uint32_t zero = 0;
+	check(bpf_map_update_elem(config_fd, &zero, &config, BPF_ANY), "updating XDP config");
+}
+
+//
+// every rule goes into the maps, not just those that drop, so that a
+// more specific allow or refuse rule still lets the client through to
+// be dealt with by the server
+//
+void XDPFilter::set_blocklist(const ClientACL& acl)
+{
+	std::map<MapKey, uint8_t> v4, v6;
+
+	for (const auto& rule : acl.rules()) {
+		uint8_t block = (rule.action == ClientACL::drop);
+		if (rule.ipv4) {
+			v4[lpm_key<xdp_key4>(&rule.addr[12], rule.bits)] = block;
+		} else {
+			v6[lpm_key<xdp_key6>(rule.addr, rule.bits)] = block;
+		}
+	}
+
+	if (v4.size() > XDP_BLOCKLIST_SIZE || v6.size() > XDP_BLOCKLIST_SIZE) {
+		throw std::runtime_error("too many ACL rules for the XDP blocklist");
+	}
+
+	sync_map(blocklist4_fd, sizeof(xdp_key4), v4);
+	sync_map(blocklist6_fd, sizeof(xdp_key6), v6);
+}
+
+// the per-CPU counters, summed
+XDPFilter::Counters XDPFilter::counters() const
+{
+	std::vector<uint64_t> values(libbpf_num_possible_cpus());
+	uint64_t	      total[xdp_counters] = {};
+
+	for (uint32_t i = 0; i < xdp_counters; ++i) {
+		if (bpf_map_lookup_elem(counters_fd, &i, values.data()) == 0) {
+			for (auto n : values) {
+				total[i] += n;
+			}
+		}
+	}
+
+	Counters result;
+	result.blocked = total[xdp_blocked];
+	result.malformed = total[xdp_malformed];
+	result.limited = total[xdp_limited];
+	result.passed = total[xdp_passed];
+
+	return result;
+}
+
+#else
+
+XDPFilter::XDPFilter(const std::string&, const std::string&, const in_addr& addr,
+		     const in6_addr& addr6, uint16_t port)
+    : addr(addr), addr6(addr6), port(port)
+{
+	throw std::runtime_error("XDP support not built in (use make XDP=1)");
+}
+
+XDPFilter::~XDPFilter()
+{
+}
+
+void XDPFilter::close()
+{
+}
+
+void XDPFilter::set_rate(unsigned)
+{
+}
+
+void XDPFilter::set_blocklist(const ClientACL&)
+{
+}
+
+XDPFilter::Counters XDPFilter::counters() const
+{
+	return Counters();
+}
+
+#endif
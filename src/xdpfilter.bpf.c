@@ -0,0 +1,230 @@
+/*
+ * Copyright (C) Internet Systems Consortium, Inc. ("ISC")
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ */
+
+//
+// The optional XDP pre-filter, which drops DNS traffic that froot would
+// discard anyway before it costs an AF_PACKET copy and ring slot:
+//
+//   - anything from a source with a "drop" rule in the client ACL
+//   - UDP queries that Context::execute rejects without an answer, i.e.
+//     those shorter than 17 bytes, with QR set, or with QDCOUNT != 1
+//   - UDP queries from a /24 or /56 over the configured rate
+//
+// Everything else, including fragments and IPv6 with extension headers,
+// is passed to userspace untouched.
+//
+
+#include <linux/bpf.h>
+#include <linux/if_ether.h>
+#include <linux/in.h>
+#include <linux/ip.h>
+#include <linux/ipv6.h>
+#include <linux/tcp.h>
+#include <linux/udp.h>
+
+#include <bpf/bpf_endian.h>
+#include <bpf/bpf_helpers.h>
+
+#include "xdpmaps.h"
+
+struct {
+	__uint(type, BPF_MAP_TYPE_ARRAY);
+	__uint(max_entries, 1);
+	__type(key, __u32);
+	__type(value, struct xdp_config);
+} config SEC(".maps");
+
+struct {
+	__uint(type, BPF_MAP_TYPE_LPM_TRIE);
+	__uint(map_flags, BPF_F_NO_PREALLOC);
+	__uint(max_entries, XDP_BLOCKLIST_SIZE);
+	__type(key, struct xdp_key4);
+	__type(value, __u8);
+} blocklist4 SEC(".maps");
+
+struct {
+	__uint(type, BPF_MAP_TYPE_LPM_TRIE);
+	__uint(map_flags, BPF_F_NO_PREALLOC);
+	__uint(max_entries, XDP_BLOCKLIST_SIZE);
+	__type(key, struct xdp_key6);
+	__type(value, __u8);
+} blocklist6 SEC(".maps");
+
+// the theoretical arrival time of each source prefix's next query
+struct {
+	__uint(type, BPF_MAP_TYPE_LRU_HASH);
+	__uint(max_entries, XDP_SOURCES_SIZE);
+	__type(key, __u64);
+	__type(value, __u64);
+} sources SEC(".maps");
+
+struct {
+	__uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+	__uint(max_entries, xdp_counters);
+	__type(key, __u32);
+	__type(value, __u64);
+} counters SEC(".maps");
+
+struct dnshdr {
+	__be16 id;
+	__be16 flags;
+	__be16 qdcount;
+	__be16 ancount;
+	__be16 nscount;
+	__be16 arcount;
+};
+
+static __always_inline int count(enum xdp_counter c, int verdict)
+{
+	__u32  key = c;
+	__u64* n = bpf_map_lookup_elem(&counters, &key);
+	if (n) {
+		*n += 1;
+	}
+	return verdict;
+}
+
+// the same checks as Context::execute makes before answering
+static __always_inline int malformed(const struct udphdr* udp, void* end)
+{
+	const struct dnshdr* dns = (const void*)(udp + 1);
+
+	if (bpf_ntohs(udp->len) < sizeof(*udp) + 17) {
+		return 1;
+	}
+	if ((void*)(dns + 1) > end) {
+		return 1;
+	}
+
+	return (dns->flags & bpf_htons(0x8000)) || dns->qdcount != bpf_htons(1);
+}
+
+//
+// GCRA, as in RateLimiter.  Updates from different CPUs can race, which
+// only ever lets a few more queries through.
+//
+static __always_inline int limited(const struct xdp_config* cfg, __u64 source)
+{
+	if (!cfg->interval) {
+		return 0;
+	}
+
+	__u64  now = bpf_ktime_get_ns();
+	__u64* tat = bpf_map_lookup_elem(&sources, &source);
+	if (!tat) {
+		__u64 next = now + cfg->interval;
+		bpf_map_update_elem(&sources, &source, &next, BPF_ANY);
+		return 0;
+	}
+
+	__u64 t = (*tat > now) ? *tat : now;
+	if (t - now > cfg->burst) {
+		return 1;
+	}
+
+	*tat = t + cfg->interval;
+	return 0;
+}
+
+SEC("xdp")
+int froot_filter(struct xdp_md* ctx)
+{
+	void* data = (void*)(long)ctx->data;
+	void* end = (void*)(long)ctx->data_end;
+
+	__u32		    zero = 0;
+	struct xdp_config* cfg = bpf_map_lookup_elem(&config, &zero);
+	if (!cfg) {
+		return XDP_PASS;
+	}
+
+	struct ethhdr* eth = data;
+	if ((void*)(eth + 1) > end) {
+		return XDP_PASS;
+	}
+
+	void* l4;
+	__u8  proto;
+	__u8* block;
+	__u64 source; // the /24 or /56, for rate limiting
+
+	if (eth->h_proto == bpf_htons(ETH_P_IP)) {
+		struct iphdr* ip = (void*)(eth + 1);
+		if ((void*)(ip + 1) > end || ip->ihl < 5) {
+			return XDP_PASS;
+		}
+		if (ip->daddr != cfg->addr || (ip->frag_off & bpf_htons(0x3fff))) {
+			return XDP_PASS;
+		}
+
+		l4 = (void*)ip + ip->ihl * 4;
+		proto = ip->protocol;
+
+		struct xdp_key4 key = {32};
+		__builtin_memcpy(key.addr, &ip->saddr, sizeof key.addr);
+		block = bpf_map_lookup_elem(&blocklist4, &key);
+
+		source = (0xffULL << 56) | (bpf_ntohl(ip->saddr) >> 8);
+	} else if (eth->h_proto == bpf_htons(ETH_P_IPV6)) {
+		struct ipv6hdr* ip6 = (void*)(eth + 1);
+		if ((void*)(ip6 + 1) > end) {
+			return XDP_PASS;
+		}
+		// unrolled, as there's no memcmp
+		const __u32* daddr = ip6->daddr.in6_u.u6_addr32;
+		if (!cfg->has_addr6 || daddr[0] != cfg->addr6[0] || daddr[1] != cfg->addr6[1] ||
+		    daddr[2] != cfg->addr6[2] || daddr[3] != cfg->addr6[3]) {
+			return XDP_PASS;
+		}
+
+		l4 = ip6 + 1;
+		proto = ip6->nexthdr;
+
+		struct xdp_key6 key = {128};
+		__builtin_memcpy(key.addr, &ip6->saddr, sizeof key.addr);
+		block = bpf_map_lookup_elem(&blocklist6, &key);
+
+		__u8 prefix[8];
+		__builtin_memcpy(prefix, &ip6->saddr, sizeof prefix);
+		prefix[7] = 0;
+		__builtin_memcpy(&source, prefix, sizeof source);
+	} else {
+		return XDP_PASS;
+	}
+
+	if (proto == IPPROTO_UDP) {
+		struct udphdr* udp = l4;
+		if ((void*)(udp + 1) > end || udp->dest != cfg->port) {
+			return XDP_PASS;
+		}
+		if (block && *block) {
+			return count(xdp_blocked, XDP_DROP);
+		}
+		if (malformed(udp, end)) {
+			return count(xdp_malformed, XDP_DROP);
+		}
+		if (limited(cfg, source)) {
+			return count(xdp_limited, XDP_DROP);
+		}
+	} else if (proto == IPPROTO_TCP) {
+		struct tcphdr* tcp = l4;
+		if ((void*)(tcp + 1) > end || tcp->dest != cfg->port) {
+			return XDP_PASS;
+		}
+		if (block && *block) {
+			return count(xdp_blocked, XDP_DROP);
+		}
+	} else {
+		return XDP_PASS;
+	}
+
+	return count(xdp_passed, XDP_PASS);
+}
+
+char LICENSE[] SEC("license") = "Dual MPL/GPL";
@@ -0,0 +1,617 @@
+/*
+ * Copyright (C) Internet Systems Consortium, Inc. ("ISC")
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <random>
+#include <stdexcept>
+
+#include <arpa/inet.h>
+#include <ldns/ldns.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <syslog.h>
+#include <unistd.h>
+
+#include "util.h"
+#include "xfr.h"
+
+static const int connect_timeout = 10 * 1000; // ms
+static const int read_timeout = 30 * 1000;    // ms
+static const int lone_soa_wait = 2 * 1000;    // ms, for more after a lone SOA
+
+// --------------------------------------------------------------------
+
+static uint16_t get16(const uint8_t* p)
+{
+	return (p[0] << 8) | p[1];
+}
+
+static uint32_t get32(const uint8_t* p)
+{
+	return (uint32_t(get16(p)) << 16) | get16(p + 2);
+}
+
+static void put16(std::string& out, uint16_t v)
+{
+	out.push_back(v >> 8);
+	out.push_back(v & 0xff);
+}
+
+static const uint8_t* data(const std::string& s)
+{
+	return reinterpret_cast<const uint8_t*>(s.data());
+}
+
+static uint16_t rr_type(const std::string& rr)
+{
+	return get16(data(rr) + ZoneData::name_length(data(rr)));
+}
+
+static const uint8_t* rr_rdata(const std::string& rr)
+{
+	return data(rr) + ZoneData::name_length(data(rr)) + 10;
+}
+
+// the given 32-bit field following the two names in SOA RDATA
+static uint32_t soa_field(const std::string& rr, int index)
+{
+	auto p = rr_rdata(rr);
+	p += ZoneData::name_length(p);
+	p += ZoneData::name_length(p);
+	return get32(p + 4 * index);
+}
+
+static uint32_t soa_serial(const std::string& rr)
+{
+	return soa_field(rr, 0);
+}
+
+// RFC 1982 serial number arithmetic
+static bool serial_newer(uint32_t a, uint32_t b)
+{
+	return int32_t(a - b) > 0;
+}
+
+//
+// copies a possibly compressed name from a message, returning the
+// offset just past the name as it appears at "pos"
+//
+static size_t read_name(const uint8_t* msg, size_t len, size_t pos, std::string& out)
+{
+	size_t end = 0;
+	size_t total = 0;
+	int    hops = 0;
+
+	while (true) {
+		if (pos >= len) {
+			throw std::runtime_error("truncated name");
+		}
+
+		auto c = msg[pos];
+		if ((c & 0xc0) == 0xc0) {
+			if (pos + 1 >= len || ++hops > 64) {
+				throw std::runtime_error("bad compression pointer");
+			}
+			if (!end) {
+				end = pos + 2;
+			}
+			pos = ((c & 0x3f) << 8) | msg[pos + 1];
+			continue;
+		} else if (c & 0xc0) {
+			throw std::runtime_error("bad label type");
+		}
+
+		if (pos + c + 1 > len || (total += c + 1) > 255) {
+			throw std::runtime_error("bad name");
+		}
+
+		out.append(reinterpret_cast<const char*>(msg + pos), c + 1);
+		pos += c + 1;
+
+		if (c == 0) {
+			return end ? end : pos;
+		}
+	}
+}
+
+//
+// copies a resource record from a message into uncompressed wire
+// format, expanding any compressed names in the RDATA (RFC 3597)
+//
+static size_t read_rr(const uint8_t* msg, size_t len, size_t pos, std::string& out)
+{
+	pos = read_name(msg, len, pos, out);
+	if (pos + 10 > len) {
+		throw std::runtime_error("truncated record");
+	}
+
+	auto type = get16(msg + pos);
+	auto rdlen = get16(msg + pos + 8);
+	auto rdata = pos + 10;
+	auto end = rdata + rdlen;
+	if (end > len) {
+		throw std::runtime_error("truncated record");
+	}
+
+	out.append(reinterpret_cast<const char*>(msg + pos), 8);
+	auto rdlen_pos = out.size();
+	put16(out, 0);
+
+	auto names = 0;
+	auto skip = 0;
+	switch (type) {
+	case LDNS_RR_TYPE_NS:
+	case LDNS_RR_TYPE_CNAME:
+	case LDNS_RR_TYPE_PTR:
+	case LDNS_RR_TYPE_DNAME: names = 1; break;
+	case LDNS_RR_TYPE_SOA: names = 2; break;
+	case LDNS_RR_TYPE_MX:
+		names = 1;
+		skip = 2;
+		break;
+	}
+
+	auto p = rdata;
+	if (names) {
+		if (p + skip > end) {
+			throw std::runtime_error("bad RDATA");
+		}
+		out.append(reinterpret_cast<const char*>(msg + p), skip);
+		p += skip;
+		while (names--) {
+			p = read_name(msg, end, p, out);
+		}
+		if (type == LDNS_RR_TYPE_SOA && end - p != 20) {
+			throw std::runtime_error("bad SOA RDATA");
+		}
+	}
+	out.append(reinterpret_cast<const char*>(msg + p), end - p);
+
+	auto n = out.size() - rdlen_pos - 2;
+	out[rdlen_pos] = n >> 8;
+	out[rdlen_pos + 1] = n & 0xff;
+
+	return end;
+}
+
+// --------------------------------------------------------------------
+
+ZoneTransfer::Primary ZoneTransfer::primary(const std::string& spec)
+{
+	Primary p;
+	::memset(&p.addr, 0, sizeof p.addr);
+	p.name = spec;
+
+	auto hash = spec.find('#');
+	auto host = spec.substr(0, hash);
+	auto port = (hash == std::string::npos) ? 53 : std::stoi(spec.substr(hash + 1));
+
+	auto sin = reinterpret_cast<sockaddr_in*>(&p.addr);
+	auto sin6 = reinterpret_cast<sockaddr_in6*>(&p.addr);
+
+	if (::inet_pton(AF_INET, host.c_str(), &sin->sin_addr) == 1) {
+		sin->sin_family = AF_INET;
+		sin->sin_port = htons(port);
+		p.addrlen = sizeof *sin;
+	} else if (::inet_pton(AF_INET6, host.c_str(), &sin6->sin6_addr) == 1) {
+		sin6->sin6_family = AF_INET6;
+		sin6->sin6_port = htons(port);
+		p.addrlen = sizeof *sin6;
+	} else {
+		throw std::runtime_error("invalid primary address: " + spec);
+	}
+
+	return p;
+}
+
+std::string ZoneTransfer::key(const std::string& rr)
+{
+	auto p = data(rr);
+	auto n = ZoneData::name_length(p);
+
+	// owner, type and class, but not the TTL or RDLENGTH
+	std::string result = strlower(p, n);
+	result.append(rr, n, 4);
+
+	auto type = rr_type(rr);
+	auto rdata = rr.substr(n + 10);
+	if (type == LDNS_RR_TYPE_NS || type == LDNS_RR_TYPE_CNAME || type == LDNS_RR_TYPE_PTR ||
+	    type == LDNS_RR_TYPE_DNAME) {
+		rdata = strlower(data(rdata), rdata.size());
+	}
+
+	return result + rdata;
+}
+
+int ZoneTransfer::connect(const Primary& p) const
+{
+	int fd = ::socket(p.addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (fd < 0) {
+		throw_errno("socket");
+	}
+
+	if (::connect(fd, reinterpret_cast<const sockaddr*>(&p.addr), p.addrlen) < 0 &&
+	    errno != EINPROGRESS) {
+		::close(fd);
+		throw_errno("connect");
+	}
+
+	pollfd pfd = {fd, POLLOUT, 0};
+	int    err = 0;
+	socklen_t errlen = sizeof err;
+	if (::poll(&pfd, 1, connect_timeout) <= 0) {
+		::close(fd);
+		throw std::runtime_error("connect timed out");
+	}
+	if (::getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &errlen) < 0 || err) {
+		::close(fd);
+		errno = err;
+		throw_errno("connect");
+	}
+
+	return fd;
+}
+
+static void read_fully(int fd, uint8_t* buf, size_t n)
+{
+	while (n) {
+		pollfd pfd = {fd, POLLIN, 0};
+		if (::poll(&pfd, 1, read_timeout) <= 0) {
+			throw std::runtime_error("read timed out");
+		}
+
+		auto r = ::read(fd, buf, n);
+		if (r < 0 && (errno == EAGAIN || errno == EINTR)) {
+			continue;
+		} else if (r < 0) {
+			throw_errno("read");
+		} else if (r == 0) {
+			throw std::runtime_error("connection closed");
+		}
+
+		buf += r;
+		n -= r;
+	}
+}
+
+//
+// whether more data arrives within the given time, rather than the
+// primary closing the connection or sending nothing more
+//
+static bool more_follows(int fd, int timeout)
+{
+	pollfd pfd = {fd, POLLIN, 0};
+	if (::poll(&pfd, 1, timeout) <= 0) {
+		return false;
+	}
+
+	uint8_t c;
+	return ::recv(fd, &c, 1, MSG_PEEK) > 0;
+}
+
+//
+// returns true once the records received so far form a whole AXFR
+// or IXFR response
+//
+static bool complete(const std::vector<std::string>& rrs, uint16_t qtype, uint32_t serial)
+{
+	if (rrs.empty()) {
+		return false;
+	}
+	if (qtype == LDNS_RR_TYPE_SOA) {
+		return true;
+	}
+
+	auto last = rrs.size() - 1;
+	auto latest = soa_serial(rrs[0]);
+
+	// a lone SOA means that we're up to date
+	if (rrs.size() == 1) {
+		return qtype == LDNS_RR_TYPE_IXFR && !serial_newer(latest, serial);
+	}
+
+	// AXFR style - the only other SOA is the closing one
+	if (rr_type(rrs[1]) != LDNS_RR_TYPE_SOA) {
+		return rr_type(rrs[last]) == LDNS_RR_TYPE_SOA;
+	}
+
+	// IXFR - sequences of (old SOA, deletions, new SOA, additions),
+	// ending with a final copy of the latest SOA
+	size_t i = 1;
+	while (true) {
+		if (i == last && soa_serial(rrs[i]) == latest) {
+			return true;
+		}
+		for (auto part = 0; part < 2; ++part) {
+			for (++i; i <= last && rr_type(rrs[i]) != LDNS_RR_TYPE_SOA; ++i)
+				;
+			if (i > last) {
+				return false;
+			}
+		}
+	}
+}
+
+//
+// sends the given query and returns the answer records of all of the
+// response messages, in order
+//
+std::vector<std::string> ZoneTransfer::exchange(const Primary& p, uint16_t qtype) const
+{
+	static thread_local std::mt19937 rng{std::random_device{}()};
+	uint16_t			 id = rng();
+
+	bool ixfr = (qtype == LDNS_RR_TYPE_IXFR);
+
+	// header, root question and, for IXFR, our SOA in the authority section
+	std::string query;
+	put16(query, id);
+	put16(query, 0);
+	put16(query, 1);
+	put16(query, 0);
+	put16(query, ixfr ? 1 : 0);
+	put16(query, 0);
+	query.push_back(0);
+	put16(query, qtype);
+	put16(query, LDNS_RR_CLASS_IN);
+	if (ixfr) {
+		query += soa;
+	}
+
+	std::string msg;
+	put16(msg, query.size());
+	msg += query;
+
+	int fd = connect(p);
+	std::vector<std::string> rrs;
+
+	try {
+		size_t done = 0;
+		while (done < msg.size()) {
+			pollfd pfd = {fd, POLLOUT, 0};
+			if (::poll(&pfd, 1, read_timeout) <= 0) {
+				throw std::runtime_error("write timed out");
+			}
+			auto n = ::write(fd, msg.data() + done, msg.size() - done);
+			if (n < 0 && (errno == EAGAIN || errno == EINTR)) {
+				continue;
+			} else if (n < 0) {
+				throw_errno("write");
+			}
+			done += n;
+		}
+
+		auto ours = loaded ? soa_serial(soa) : 0;
+		std::vector<uint8_t> buf(65535);
+
+		while (!complete(rrs, qtype, ours)) {
+			uint8_t lenbuf[2];
+			read_fully(fd, lenbuf, 2);
+			size_t len = get16(lenbuf);
+			read_fully(fd, buf.data(), len);
+
+			auto m = buf.data();
+			if (len < 12 || get16(m) != id || !(m[2] & 0x80)) {
+				throw std::runtime_error("malformed response");
+			}
+			auto rcode = m[3] & 0x0f;
+			if (rcode != LDNS_RCODE_NOERROR) {
+				throw std::runtime_error("response code " + std::to_string(rcode));
+			}
+
+			size_t pos = 12;
+			for (auto i = get16(m + 4); i > 0; --i) {
+				std::string qname;
+				pos = read_name(m, len, pos, qname) + 4;
+			}
+
+			auto ancount = get16(m + 6);
+			if (!ancount) {
+				throw std::runtime_error("empty response");
+			}
+			for (auto i = 0; i < ancount; ++i) {
+				rrs.emplace_back();
+				pos = read_rr(m, len, pos, rrs.back());
+			}
+
+			if (rr_type(rrs[0]) != LDNS_RR_TYPE_SOA) {
+				throw std::runtime_error("response does not start with SOA");
+			}
+
+			// a lone newer SOA means the primary can't supply the
+			// changes, unless it's just the opening SOA of an IXFR
+			// that continues in the next message
+			if (ixfr && rrs.size() == 1 && serial_newer(soa_serial(rrs[0]), ours) &&
+			    !more_follows(fd, lone_soa_wait)) {
+				throw std::runtime_error("no incremental transfer available");
+			}
+		}
+	} catch (...) {
+		::close(fd);
+		throw;
+	}
+
+	::close(fd);
+	return rrs;
+}
+
+uint32_t ZoneTransfer::query_serial(const Primary& p) const
+{
+	auto rrs = exchange(p, LDNS_RR_TYPE_SOA);
+	return soa_serial(rrs[0]);
+}
+
+//
+// make the pending records from a complete transfer, returning true if
+// the zone has changed.  Incremental changes are applied to a copy of
+// the current records, which are left untouched until commit().
+//
+bool ZoneTransfer::apply(const std::vector<std::string>& rrs)
+{
+	auto latest = soa_serial(rrs[0]);
+
+	if (rrs.size() == 1) {
+		return false;
+	}
+
+	if (rr_type(rrs[1]) != LDNS_RR_TYPE_SOA) {
+		Records fresh;
+		for (size_t i = 0; i < rrs.size() - 1; ++i) {
+			fresh[key(rrs[i])] = rrs[i];
+		}
+		pending_records.swap(fresh);
+		pending_soa = rrs[0];
+		return true;
+	}
+
+	if (!loaded) {
+		throw std::runtime_error("incremental response without a zone to apply it to");
+	}
+
+	auto   updated = records;
+	auto   current = soa_serial(soa);
+	size_t last = rrs.size() - 1;
+	size_t i = 1;
+
+	while (!(i == last && soa_serial(rrs[i]) == latest)) {
+		// the old SOA must follow on from where we are
+		if (soa_serial(rrs[i]) != current) {
+			throw std::runtime_error("IXFR sequence does not match current serial");
+		}
+
+		// deletions, starting with the old SOA
+		do {
+			updated.erase(key(rrs[i++]));
+		} while (rr_type(rrs[i]) != LDNS_RR_TYPE_SOA);
+
+		// additions, starting with the new SOA
+		current = soa_serial(rrs[i]);
+		do {
+			updated[key(rrs[i])] = rrs[i];
+			++i;
+		} while (rr_type(rrs[i]) != LDNS_RR_TYPE_SOA);
+	}
+
+	if (current != latest) {
+		throw std::runtime_error("IXFR did not reach the latest serial");
+	}
+
+	pending_records.swap(updated);
+	pending_soa = rrs[0];
+	return true;
+}
+
+bool ZoneTransfer::transfer(const Primary& p, bool incremental)
+{
+	auto before = loaded ? soa_serial(soa) : 0;
+
+	if (incremental) {
+		try {
+			if (apply(exchange(p, LDNS_RR_TYPE_IXFR))) {
+				syslog(LOG_NOTICE, "IXFR from %s: serial %u -> %u", p.name.c_str(),
+				       before, soa_serial(pending_soa));
+				return true;
+			}
+			return false;
+		} catch (std::exception& e) {
+			syslog(LOG_WARNING, "IXFR from %s failed (%s), trying AXFR", p.name.c_str(),
+			       e.what());
+		}
+	}
+
+	apply(exchange(p, LDNS_RR_TYPE_AXFR));
+	syslog(LOG_NOTICE, "AXFR from %s: serial %u, %zu records", p.name.c_str(),
+	       soa_serial(pending_soa), pending_records.size());
+
+	return true;
+}
+
+bool ZoneTransfer::refresh()
+{
+	// anything still pending failed to load
+	pending_records.clear();
+	pending_soa.clear();
+
+	for (const auto& p : primaries) {
+		try {
+			auto latest = query_serial(p);
+			if (loaded && !serial_newer(latest, serial())) {
+				return false;
+			}
+			return transfer(p, loaded);
+		} catch (std::exception& e) {
+			syslog(LOG_WARNING, "zone transfer from %s failed: %s", p.name.c_str(),
+			       e.what());
+		}
+	}
+
+	throw std::runtime_error("no primary server could supply the zone");
+}
+
+void ZoneTransfer::commit()
+{
+	if (pending_soa.empty()) {
+		return;
+	}
+
+	records.swap(pending_records);
+	soa.swap(pending_soa);
+	loaded = true;
+
+	pending_records.clear();
+	pending_soa.clear();
+}
+
+std::shared_ptr<ZoneData> ZoneTransfer::zone() const
+{
+	auto zone = std::make_shared<ZoneData>();
+
+	const auto& from = pending_soa.empty() ? records : pending_records;
+	for (const auto& iter : from) {
+		const auto& rr = iter.second;
+		auto	    p = data(rr);
+		auto	    n = ZoneData::name_length(p);
+
+		Record r;
+		r.owner = p;
+		r.type = get16(p + n);
+		r.klass = get16(p + n + 2);
+		r.ttl = get32(p + n + 4);
+		r.rdlen = get16(p + n + 8);
+		r.rdata = p + n + 10;
+		zone->add(r);
+	}
+
+	zone->finish();
+	return zone;
+}
+
+uint32_t ZoneTransfer::serial() const
+{
+	return loaded ? soa_serial(soa) : 0;
+}
+
+uint32_t ZoneTransfer::refresh_interval() const
+{
+	return loaded ? soa_field(soa, 1) : 60;
+}
+
+uint32_t ZoneTransfer::retry_interval() const
+{
+	return loaded ? soa_field(soa, 2) : 60;
+}
+
+ZoneTransfer::ZoneTransfer(const std::vector<Primary>& primaries) : primaries(primaries)
+{
+	if (primaries.empty()) {
+		throw std::runtime_error("no primary servers specified");
+	}
+}
@@ -7,116 +7,580 @@
  *
  */
 
+#include <algorithm>
 #include <atomic>
+#include <chrono>
+#include <exception>
 #include <iostream>
+#include <mutex>
 #include <stdexcept>
+#include <string>
+#include <thread>
 
 #include <arpa/inet.h>
 #include <syslog.h>
 
-#include <ldns/ldns.h>
-
+#include "arena.h"
+#include "grace.h"
+#include "image.h"
+#include "numa.h"
+#include "parser.h"
 #include "util.h"
+#include "verify.h"
 #include "zone.h"
 
-void Zone::build_answers(PData& data, PAux& aux, const ldns_dnssec_zone* zone,
-			 const ldns_dnssec_name* name, bool compressed)
+// the NUMA node of the calling worker thread
+static thread_local unsigned numa_node = 0;
+
+void Zone::set_numa_node(unsigned node)
+{
+	numa_node = node;
+}
+
+static const char* type_names[Answer::Type::max] = {
+    "root SOA", "root NS", "root DNSKEY", "root NSEC", "root ANY",
+    "root NODATA", "DS", "referral", "NXDOMAIN"};
+
+static void log_stats(const AnswerSet::Stats& stats)
+{
+	auto shared = stats.answers ? 100.0 * (stats.answers - stats.unique) / stats.answers : 0.0;
+	syslog(LOG_INFO, "%zu answers, %zu unique (%.1f%% deduplicated), %zu bytes", stats.answers,
+	       stats.unique, shared, stats.bytes);
+
+	// what minimal responses (-M) leave out of each type of answer
+	std::string omitted;
+	for (auto t = 0U; t < Answer::Type::max; ++t) {
+		auto saving = stats.full[t] - stats.minimal[t];
+		if (saving) {
+			omitted += omitted.empty() ? "" : ", ";
+			omitted += type_names[t];
+			omitted += " " + std::to_string(saving) + " of " + std::to_string(stats.full[t]);
+		}
+	}
+	if (!omitted.empty()) {
+		syslog(LOG_INFO, "minimal responses omit (bytes): %s", omitted.c_str());
+	}
+}
+
+std::string Zone::key(const ZoneNode* name)
+{
+	auto len = name->name[0];
+	return strlower(name->name + 1, len);
+}
+
+Zone::Entry::Entry(std::shared_ptr<const AnswerSet> set) : owned(set)
+{
+	this->set.store(set.get(), std::memory_order_relaxed);
+}
+
+Zone::Entry::Entry(const ZoneNode* node) : node(node)
+{
+}
+
+Zone::Entry::~Entry()
+{
+	if (!owned) {
+		delete set.load(std::memory_order_relaxed);
+	}
+}
+
+//
+// return the entry's AnswerSet, compiling it first if necessary.  If
+// two threads race to compile the same entry the loser discards its
+// copy, so no locking is needed.
+//
+const AnswerSet* Zone::materialise(const Snapshot& snapshot, Entry& entry)
+{
+	auto set = entry.set.load(std::memory_order_acquire);
+	if (set) {
+		return set;
+	}
+
+	auto mine = new AnswerSet(entry.node, *snapshot.zone, snapshot.compress);
+
+	const AnswerSet* expected = nullptr;
+	if (entry.set.compare_exchange_strong(expected, mine, std::memory_order_acq_rel)) {
+		return mine;
+	}
+
+	delete mine;
+	return expected;
+}
+
+//
+// build the AnswerSet for every name, spread across a bounded pool of
+// threads.  Each thread takes the next unbuilt name from a shared
+// counter and stores the result at the same index, so the output is
+// independent of the scheduling order.
+//
+// A name whose records are unchanged since the previous snapshot keeps
+// its AnswerSet as it is, and one whose records have changed shares
+// whichever of its answers they don't affect.  Returns the number of
+// answers shared.
+//
+size_t Zone::build_answers(Sets& sets, const Names& names, const ZoneData& zone,
+			   const ZoneOptions& options, const Snapshot* previous)
+{
+	auto find_previous = [&](const std::string& k) -> const Entry* {
+		if (!previous || previous->compress != options.compress) {
+			return nullptr;
+		}
+		auto iter = previous->aux.find(k);
+		if (iter == previous->aux.end()) {
+			return nullptr;
+		}
+		return iter->second.get();
+	};
+
+	std::atomic<size_t> next{0};
+	std::atomic<size_t> reused{0};
+	std::exception_ptr  error;
+	std::mutex	  error_mutex;
+
+	auto worker = [&]() {
+		try {
+			size_t i, shared = 0;
+			while ((i = next.fetch_add(1, std::memory_order_relaxed)) < names.size()) {
+				auto name = names[i];
+				auto prev = find_previous(key(name));
+				auto src = AnswerSet::hash_sources(name, zone);
+
+				// the apex's answers depend on more than these
+				if (prev && prev->owned && name != zone.apex() &&
+				    prev->owned->sources() == src) {
+					sets[i] = prev->owned;
+					shared += sets[i]->count();
+					continue;
+				}
+
+				const AnswerSet* old = nullptr;
+				if (prev) {
+					old = prev->set.load(std::memory_order_acquire);
+				}
+				auto set = std::make_shared<AnswerSet>(name, zone, options.compress,
+								       old, &src);
+				shared += set->reused();
+				sets[i] = set;
+			}
+			reused += shared;
+		} catch (...) {
+			std::lock_guard<std::mutex> lock(error_mutex);
+			if (!error) {
+				error = std::current_exception();
+			}
+			next = names.size(); // stop the other threads early
+		}
+	};
+
+	size_t n = std::max(1U, options.threads);
+	n = std::min(n, names.size());
+
+	std::vector<std::thread> pool;
+	for (size_t i = 1; i < n; ++i) {
+		pool.emplace_back(worker);
+	}
+	worker();
+
+	for (auto& t : pool) {
+		t.join();
+	}
+
+	if (error) {
+		std::rethrow_exception(error);
+	}
+
+	return reused;
+}
+
+//
+// the NUMA node that a snapshot's own arena is bound to when it is to
+// be replicated, that node then needing no copy of its own
+//
+static int home_node(const ZoneOptions& options)
 {
-	auto	owner = name->name;
-	auto	rdata = ldns_rdf_data(owner);
-	auto	len = rdata[0];
-	std::string key = strlower(rdata + 1, len);
+	auto nodes = numa_nodes();
+	if (!options.numa || nodes < 2) {
+		return -1;
+	}
+
+	for (auto node = 0U; node < nodes; ++node) {
+		if (!numa_node_cpus(node).empty()) {
+			return node;
+		}
+	}
+
+	return -1;
+}
+
+void Zone::build_zone(const ZoneData& zone, const ZoneOptions& options)
+{
+	// find all of the non-glue names, in canonical order
+	Names names;
+
+	for (auto name : zone.names()) {
+		if (!name->glue) {
+			names.push_back(name);
+		}
+	}
+
+	Sets sets(names.size());
+	auto reused = build_answers(sets, names, zone, options, current.get());
+
+	// assemble the new snapshot
+	auto snapshot = std::make_shared<Snapshot>();
+	snapshot->compress = options.compress;
+	snapshot->serial = zone.serial();
+	snapshot->reused = reused;
+
+	// pack the new answers into an arena of their own, keeping those
+	// still in the previous snapshot's arenas where they are
+	auto previous = current ? current->arenas : AnswerSet::Arenas();
+	snapshot->arenas = AnswerSet::pack(sets, options.hugepages, options.lock,
+					   home_node(options), &snapshot->stats, previous);
+
+	for (size_t i = 0; i < names.size(); ++i) {
+		auto k = key(names[i]);
+		auto entry = std::make_shared<Entry>(sets[i]);
+		snapshot->data[k] = entry;
+		snapshot->aux[k] = entry;
+	}
+
+	replicate(*snapshot, options);
+	publish(snapshot);
+}
+
+//
+// publish a snapshot containing just the index of names, with each
+// AnswerSet compiled on first use
+//
+void Zone::build_lazy(std::shared_ptr<const ZoneData> zone, const ZoneOptions& options)
+{
+	auto snapshot = std::make_shared<Snapshot>();
+	snapshot->compress = options.compress;
+	snapshot->serial = zone->serial();
+	snapshot->reused = 0;
+	snapshot->zone = zone;
+
+	for (auto name : zone->names()) {
+		if (!name->glue) {
+			auto k = key(name);
+			auto entry = std::make_shared<Entry>(name);
+			snapshot->data[k] = entry;
+			snapshot->aux[k] = entry;
+		}
+	}
+
+	publish(snapshot);
+}
 
-	auto nd = std::make_shared<AnswerSet>(name, zone, compressed);
-	(*data)[key] = nd;
-	(*aux)[key] = nd;
+//
+// compile any AnswerSets of a lazily loaded snapshot that haven't yet
+// been used, giving up if the snapshot is replaced.  Names that are
+// queried are compiled on demand in the meantime, so the popular ones
+// are done first.
+//
+void Zone::complete(PSnapshot snap)
+{
+	for (const auto& iter : snap->data) {
+		if (snapshot.load(std::memory_order_acquire) != snap.get()) {
+			return;
+		}
+		materialise(*snap, *iter.second);
+	}
 }
 
-void Zone::build_zone(const ldns_dnssec_zone* zone, bool compressed)
+//
+// make a copy of the snapshot for each other NUMA node, each built by
+// a thread running on that node so that the maps and AnswerSets are
+// allocated there too, with the answers packed into a node-bound arena
+//
+void Zone::replicate(Snapshot& snapshot, const ZoneOptions& options)
 {
-	PData new_data = std::make_shared<Data>();
-	PAux  new_aux = std::make_shared<Aux>();
+	auto nodes = numa_nodes();
+	if (!options.numa || nodes < 2) {
+		return;
+	}
+
+	// an image's answers aren't in an arena, so every node gets a copy
+	auto home = snapshot.arenas.empty() ? -1 : home_node(options);
+
+	snapshot.replicas.resize(nodes);
+
+	std::exception_ptr error;
+	std::mutex	   error_mutex;
 
-	auto node = ldns_rbtree_first(zone->names);
-	while (node != LDNS_RBTREE_NULL) {
-		// can be const in later versions of ldns
-		auto tmp = reinterpret_cast<const ldns_dnssec_name*>(node->data);
-		auto name = const_cast<ldns_dnssec_name*>(tmp);
+	auto worker = [&](unsigned node) {
+		try {
+			numa_pin_thread(node);
 
-		if (!ldns_dnssec_name_is_glue(name)) {
-			build_answers(new_data, new_aux, zone, name, compressed);
+			Sets sets;
+			for (const auto& iter : snapshot.data) {
+				sets.push_back(iter.second->owned);
+			}
+
+			auto replica = std::make_shared<Snapshot>();
+			replica->compress = snapshot.compress;
+			replica->serial = snapshot.serial;
+			replica->reused = snapshot.reused;
+			replica->stats = snapshot.stats;
+			replica->arenas =
+			    AnswerSet::pack(sets, options.hugepages, options.lock, node);
+
+			size_t i = 0;
+			for (const auto& iter : snapshot.data) {
+				auto entry = std::make_shared<Entry>(sets[i++]);
+				replica->data[iter.first] = entry;
+				replica->aux[iter.first] = entry;
+			}
+
+			snapshot.replicas[node] = replica;
+		} catch (...) {
+			std::lock_guard<std::mutex> lock(error_mutex);
+			if (!error) {
+				error = std::current_exception();
+			}
+		}
+	};
+
+	std::vector<std::thread> pool;
+	for (auto node = 0U; node < nodes; ++node) {
+		if (int(node) != home && !numa_node_cpus(node).empty()) {
+			pool.emplace_back(worker, node);
 		}
-		node = ldns_rbtree_next(node);
 	}
 
-	std::atomic_exchange(&data, new_data);
-	std::atomic_exchange(&aux, new_aux);
+	for (auto& t : pool) {
+		t.join();
+	}
+
+	if (error) {
+		std::rethrow_exception(error);
+	}
+
+	// the maps and AnswerSets are small next to the answers themselves
+	auto bytes = [](const AnswerSet::Arenas& arenas) {
+		size_t n = 0;
+		for (const auto& arena : arenas) {
+			n += arena->size();
+		}
+		return n;
+	};
+
+	size_t extra = 0;
+	for (const auto& replica : snapshot.replicas) {
+		if (replica) {
+			extra += bytes(replica->arenas);
+		}
+	}
+	size_t total = extra + bytes(snapshot.arenas);
+	syslog(LOG_INFO, "answers replicated to %zu NUMA nodes, %zu extra bytes (%zu in all)",
+	       pool.size() + (home >= 0), extra, total);
+}
+
+void Zone::publish(PSnapshot snapshot)
+{
+	auto previous = std::move(current);
+	current = snapshot;
+
+	this->snapshot.store(current.get(), std::memory_order_release);
+	_generation.fetch_add(1, std::memory_order_release);
+
+	// lookups that started before now may still be using the previous
+	// snapshot, however many have been published since
+	GracePeriod::wait();
 }
 
-void Zone::check_zone(const ldns_dnssec_zone* zone)
+void Zone::check_zone(const ZoneData& zone)
 {
-	if (!zone->names) {
+	if (zone.names().empty()) {
 		throw std::runtime_error("names not found in zone");
 	}
 
-	if (!zone->soa) {
+	if (!zone.apex()) {
 		throw std::runtime_error("no SOA found in zone");
 	}
 }
 
-void Zone::load(const std::string& filename, bool compressed, bool notice)
+//
+// refuse to publish a zone whose ZONEMD digest or signatures don't
+// verify, using the same number of threads as the answer compiler
+//
+void Zone::verify_zone(const ZoneData& zone, const ZoneOptions& options)
+{
+	auto start = std::chrono::steady_clock::now();
+
+	ZoneVerifier verifier(zone);
+	auto	     count = verifier.verify(options.threads);
+
+	auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+		std::chrono::steady_clock::now() - start);
+	syslog(LOG_INFO, "root zone SOA serial %u verified: ZONEMD and %zu signatures in %ld ms",
+	       zone.serial(), count, long(ms.count()));
+}
+
+//
+// map a compiled image and publish its answers directly, without
+// any parsing or answer generation
+//
+bool Zone::load_image(const std::string& filename, const ZoneOptions& options, bool notice,
+		      bool force)
+{
+	auto image = std::make_shared<const ZoneImage>(filename);
+	if (unchanged(image->serial(), force)) {
+		return false;
+	}
+
+	auto snapshot = std::make_shared<Snapshot>();
+
+	std::vector<std::pair<std::string, std::shared_ptr<const AnswerSet>>> sets;
+	ZoneImage::load(image, sets, &snapshot->stats);
+
+	snapshot->compress = image->compress();
+	snapshot->serial = image->serial();
+	snapshot->reused = 0;
+
+	for (const auto& set : sets) {
+		auto entry = std::make_shared<Entry>(set.second);
+		snapshot->data[set.first] = entry;
+		snapshot->aux[set.first] = entry;
+	}
+
+	// predecessor lookups rely on there being an entry for the root
+	if (snapshot->data.cbegin()->first != "") {
+		throw std::runtime_error("zone image does not contain the root");
+	}
+
+	replicate(*snapshot, options);
+	publish(snapshot);
+
+	if (notice) {
+		syslog(LOG_NOTICE, "root zone image loaded with SOA serial %u", snapshot->serial);
+		log_stats(snapshot->stats);
+	}
+
+	return true;
+}
+
+bool Zone::unchanged(uint32_t serial, bool force) const
 {
-	auto origin = std::shared_ptr<ldns_rdf>(ldns_dname_new_frm_str("."), ldns_rdf_deep_free);
-	auto fp = ::fopen(filename.c_str(), "r");
-	if (!fp) {
-		throw_errno("opening zone file: " + filename);
+	if (force || !current || current->serial != serial) {
+		return false;
 	}
 
-	ldns_dnssec_zone* zone = nullptr;
-	auto status = ldns_dnssec_zone_new_frm_fp(&zone, fp, origin.get(), 3600, LDNS_RR_CLASS_IN);
-	::fclose(fp);
+	syslog(LOG_INFO, "root zone SOA serial %u unchanged, not reloading", serial);
+	return true;
+}
 
-	if (status != LDNS_STATUS_OK || zone == nullptr) {
-		throw std::runtime_error("zone load failed");
+bool Zone::load(const std::string& filename, const ZoneOptions& options, bool notice, bool force)
+{
+	if (ZoneImage::is_image(filename)) {
+		return load_image(filename, options, notice, force);
 	}
 
-	// ensure release of the zone data
-	auto zp = std::shared_ptr<ldns_dnssec_zone>(zone, ldns_dnssec_zone_deep_free);
+	// stream the master file straight into the compact zone representation
+	auto zone = std::make_shared<ZoneData>();
+	ZoneParser parser(filename);
+	parser.parse([&](const Record& rr) { zone->add(rr); });
+	zone->finish();
 
-	// check the zone structure and build the zone representation
-	check_zone(zp.get());
-	ldns_dnssec_zone_mark_glue(zp.get());
-	build_zone(zp.get(), compressed);
+	return load(zone, options, notice, force);
+}
+
+bool Zone::load(std::shared_ptr<const ZoneData> zone, const ZoneOptions& options, bool notice,
+		bool force)
+{
+	check_zone(*zone);
+	if (unchanged(zone->serial(), force)) {
+		return false;
+	}
+
+	if (options.verify) {
+		verify_zone(*zone, options);
+	}
+
+	// a lazily built snapshot keeps the zone data to compile from
+	if (options.lazy || options.background) {
+		build_lazy(zone, options);
+		if (notice) {
+			syslog(LOG_NOTICE, "root zone loaded with SOA serial %u, answers compiled on demand",
+			       zone->serial());
+		}
+		// on a thread of its own, which inherits the loader's
+		// housekeeping CPUs and priority, so that the loader is free
+		// to publish a newer snapshot, which makes the previous
+		// completion stop
+		if (options.background) {
+			if (completer.joinable()) {
+				completer.join();
+			}
+			completer = std::thread(&Zone::complete, this, current);
+		}
+		return true;
+	}
+
+	build_zone(*zone, options);
 
 	// report the serial number
 	if (notice) {
-		auto soa_rr = ldns_dnssec_name_find_rrset(zp->soa, LDNS_RR_TYPE_SOA)->rrs->rr;
-		auto serial = ldns_rdf2native_int32(ldns_rr_rdf(soa_rr, 2));
-		syslog(LOG_NOTICE, "root zone loaded with SOA serial %u", serial);
+		const auto& arenas = current->arenas;
+		size_t	    bytes = 0;
+		for (const auto& arena : arenas) {
+			bytes += arena->size();
+		}
+		syslog(LOG_NOTICE, "root zone loaded with SOA serial %u (%zu answers reused)",
+		       zone->serial(), current->reused);
+		if (!arenas.empty()) {
+			auto arena = arenas.front();
+			syslog(LOG_INFO, "answers in %zu arenas, %zu bytes%s%s", arenas.size(),
+			       bytes, arena->huge() ? ", huge pages" : "",
+			       arena->locked() ? ", locked" : "");
+		}
+		log_stats(current->stats);
+	}
+
+	return true;
+}
+
+void Zone::save(const std::string& filename) const
+{
+	auto snap = current;
+	if (!snap) {
+		throw std::runtime_error("no zone loaded");
 	}
 
-	loaded = true;
+	ZoneImage::Sets sets;
+	for (const auto& iter : snap->data) {
+		sets.emplace_back(iter.first, materialise(*snap, *iter.second));
+	}
+
+	ZoneImage::write(filename, sets, snap->serial, snap->compress);
 }
 
 const AnswerSet* Zone::lookup(const std::string& qname, bool& matched) const
 {
-	if (!loaded) {
+	auto snap = snapshot.load(std::memory_order_acquire);
+	if (!snap) {
 		return nullptr;
 	}
 
+	// use this thread's node-local copy, if there is one
+	if (numa_node < snap->replicas.size() && snap->replicas[numa_node]) {
+		snap = snap->replicas[numa_node].get();
+	}
+
 	// look for an exact match first
 	{
-		const auto& iter = aux->find(qname);
-		if (iter != aux->end()) {
+		const auto& iter = snap->aux.find(qname);
+		if (iter != snap->aux.end()) {
 			matched = true;
-			return iter->second.get();
+			return materialise(*snap, *iter->second);
 		}
 	}
 
 	// exact match not found, return predecessor (for NSEC generation)
 	matched = false;
-	auto iter = data->lower_bound(qname);
-	return (--iter)->second.get();
+	auto iter = snap->data.lower_bound(qname);
+	return materialise(*snap, *(--iter)->second);
 }
 
 Zone::Zone()
@@ -125,4 +589,9 @@ Zone::Zone()
 
 Zone::~Zone()
 {
+	// unpublishing the snapshot stops any completion
+	snapshot.store(nullptr, std::memory_order_release);
+	if (completer.joinable()) {
+		completer.join();
+	}
 }
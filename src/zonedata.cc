@@ -0,0 +1,353 @@
+/*
+ * Copyright (C) Internet Systems Consortium, Inc. ("ISC")
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ */
+
+#include <algorithm>
+#include <cstring>
+
+#include <arpa/inet.h>
+
+#include "util.h"
+#include "zonedata.h"
+
+static const uint16_t TYPE_NS = 2;
+static const uint16_t TYPE_CNAME = 5;
+static const uint16_t TYPE_SOA = 6;
+static const uint16_t TYPE_PTR = 12;
+static const uint16_t TYPE_RRSIG = 46;
+static const uint16_t TYPE_DNAME = 39;
+
+uint16_t Record::covered() const
+{
+	if (type == TYPE_RRSIG && rdlen >= 2) {
+		return (rdata[0] << 8) | rdata[1];
+	} else {
+		return type;
+	}
+}
+
+// --------------------------------------------------------------------
+
+RRList ZoneNode::rrset(uint16_t type) const
+{
+	RRList result;
+	rrset(type, result);
+	return result;
+}
+
+void ZoneNode::rrset(uint16_t type, RRList& out) const
+{
+	// count first so that the list is only grown once
+	size_t n = 0;
+	for (auto rr : records) {
+		if (rr->type == type || (rr->type == TYPE_RRSIG && rr->covered() == type)) {
+			++n;
+		}
+	}
+	if (!n) {
+		return;
+	}
+	out.reserve(out.count() + n);
+
+	auto first = out.count();
+	for (auto rr : records) {
+		if (rr->type == type) {
+			out.append(rr);
+		}
+	}
+
+	if (out.count() > first) {
+		for (auto rr : records) {
+			if (rr->type == TYPE_RRSIG && rr->covered() == type) {
+				out.append(rr);
+			}
+		}
+	}
+}
+
+bool ZoneNode::has(uint16_t type) const
+{
+	for (auto rr : records) {
+		if (rr->type == type) {
+			return true;
+		}
+	}
+	return false;
+}
+
+// --------------------------------------------------------------------
+
+size_t ZoneData::name_length(const uint8_t* name)
+{
+	auto p = name;
+	while (*p) {
+		p += *p + 1;
+	}
+	return p - name + 1;
+}
+
+std::string ZoneData::name_key(const uint8_t* name)
+{
+	return strlower(name, name_length(name));
+}
+
+//
+// DNSSEC canonical ordering (RFC 4034 section 6.1) - labels are compared
+// right to left, case insensitively, with a shorter label sorting first
+//
+int ZoneData::name_compare(const uint8_t* a, const uint8_t* b)
+{
+	const uint8_t* la[128];
+	const uint8_t* lb[128];
+	size_t	       na = 0, nb = 0;
+
+	for (auto p = a; *p; p += *p + 1) {
+		la[na++] = p;
+	}
+	for (auto p = b; *p; p += *p + 1) {
+		lb[nb++] = p;
+	}
+
+	while (na && nb) {
+		auto x = la[--na];
+		auto y = lb[--nb];
+		auto lx = *x++;
+		auto ly = *y++;
+		auto n = std::min(lx, ly);
+
+		for (auto i = 0U; i < n; ++i) {
+			auto cx = lower(x[i]);
+			auto cy = lower(y[i]);
+			if (cx != cy) {
+				return cx < cy ? -1 : 1;
+			}
+		}
+
+		if (lx != ly) {
+			return lx < ly ? -1 : 1;
+		}
+	}
+
+	return na ? 1 : nb ? -1 : 0;
+}
+
+// returns true if "name" is equal to or below "parent"
+bool ZoneData::is_subdomain(const uint8_t* name, const uint8_t* parent)
+{
+	auto nlen = name_length(name);
+	auto plen = name_length(parent);
+
+	auto p = name;
+	while (true) {
+		size_t rem = nlen - (p - name);
+		if (rem < plen) {
+			return false;
+		}
+		if (rem == plen) {
+			for (auto i = 0U; i < plen; ++i) {
+				if (lower(p[i]) != lower(parent[i])) {
+					return false;
+				}
+			}
+			return true;
+		}
+		p += *p + 1;
+	}
+}
+
+//
+// uncompressed wire format of the whole RR
+//
+void ZoneData::rr_append(std::string& out, const Record& rr)
+{
+	out.append(reinterpret_cast<const char*>(rr.owner), name_length(rr.owner));
+
+	uint16_t fixed[5] = {htons(rr.type), htons(rr.klass), htons(rr.ttl >> 16),
+			     htons(rr.ttl & 0xffff), htons(rr.rdlen)};
+	out.append(reinterpret_cast<const char*>(fixed), sizeof fixed);
+	out.append(reinterpret_cast<const char*>(rr.rdata), rr.rdlen);
+}
+
+std::string ZoneData::rr_to_string(const Record& rr)
+{
+	std::string result;
+	rr_append(result, rr);
+	return result;
+}
+
+// --------------------------------------------------------------------
+
+//
+// the number of leading bytes of the RDATA that hold domain names,
+// which are case-folded when sorting
+//
+static size_t name_prefix(const Record& rr)
+{
+	switch (rr.type) {
+	case TYPE_NS:
+	case TYPE_CNAME:
+	case TYPE_PTR:
+	case TYPE_DNAME:
+		return rr.rdlen;
+	case TYPE_SOA: {
+		auto n = ZoneData::name_length(rr.rdata);
+		return n + ZoneData::name_length(rr.rdata + n);
+	}
+	default:
+		return 0;
+	}
+}
+
+//
+// canonical RR ordering within an owner name, as used by ldns - by type,
+// then by length, then by canonical RDATA
+//
+static int rr_compare(const Record& a, const Record& b)
+{
+	if (a.type != b.type) {
+		return a.type < b.type ? -1 : 1;
+	}
+
+	if (a.rdlen != b.rdlen) {
+		return a.rdlen < b.rdlen ? -1 : 1;
+	}
+
+	auto n = name_prefix(a);
+	for (auto i = 0U; i < a.rdlen; ++i) {
+		uint8_t x = a.rdata[i];
+		uint8_t y = b.rdata[i];
+		if (i < n) {
+			x = lower(x);
+			y = lower(y);
+		}
+		if (x != y) {
+			return x < y ? -1 : 1;
+		}
+	}
+
+	return 0;
+}
+
+uint8_t* ZoneData::allocate(size_t n)
+{
+	const size_t chunk_size = 65536;
+
+	if (storage.empty() || storage.back().capacity() - storage.back().size() < n) {
+		storage.emplace_back();
+		storage.back().reserve(std::max(chunk_size, n));
+	}
+
+	auto& chunk = storage.back();
+	auto  offset = chunk.size();
+	chunk.resize(offset + n);
+
+	return chunk.data() + offset;
+}
+
+void ZoneData::add(const Record& rr)
+{
+	auto& node = nodes[name_key(rr.owner)];
+
+	// only store each owner name once
+	if (!node.name) {
+		auto len = name_length(rr.owner);
+		auto p = allocate(len);
+		::memcpy(p, rr.owner, len);
+		node.name = p;
+	}
+
+	records.push_back(rr);
+	auto& copy = records.back();
+	copy.owner = node.name;
+
+	auto p = allocate(rr.rdlen);
+	::memcpy(p, rr.rdata, rr.rdlen);
+	copy.rdata = p;
+
+	node.records.push_back(&copy);
+}
+
+//
+// sort the records and names into canonical order, locate the apex
+// and mark the names that are below a zone cut as glue
+//
+void ZoneData::finish()
+{
+	sorted.clear();
+	_apex = nullptr;
+
+	for (auto& iter : nodes) {
+		auto& rrs = iter.second.records;
+
+		std::stable_sort(rrs.begin(), rrs.end(), [](const Record* a, const Record* b) {
+			return rr_compare(*a, *b) < 0;
+		});
+
+		// silently drop duplicates, keeping the first seen
+		auto end = std::unique(rrs.begin(), rrs.end(), [](const Record* a, const Record* b) {
+			return rr_compare(*a, *b) == 0;
+		});
+		rrs.erase(end, rrs.end());
+
+		sorted.push_back(&iter.second);
+	}
+
+	std::sort(sorted.begin(), sorted.end(), [](const ZoneNode* a, const ZoneNode* b) {
+		return name_compare(a->name, b->name) < 0;
+	});
+
+	for (auto node : sorted) {
+		if (node->has(TYPE_SOA)) {
+			_apex = node;
+			break;
+		}
+	}
+
+	// names below a cut follow it immediately in canonical order
+	const ZoneNode* cut = nullptr;
+	for (auto node : sorted) {
+		auto& n = const_cast<ZoneNode&>(*node);
+		if (cut && is_subdomain(n.name, cut->name)) {
+			n.glue = true;
+		} else {
+			n.glue = false;
+			cut = (node != _apex && node->has(TYPE_NS)) ? node : nullptr;
+		}
+	}
+}
+
+const ZoneNode* ZoneData::find(const uint8_t* name) const
+{
+	// reuse the key's storage, this being called for every glue lookup
+	static thread_local std::string key;
+
+	key.assign(reinterpret_cast<const char*>(name), name_length(name));
+	std::transform(key.begin(), key.end(), key.begin(), lower);
+
+	auto iter = nodes.find(key);
+	return (iter != nodes.end()) ? &iter->second : nullptr;
+}
+
+uint32_t ZoneData::serial() const
+{
+	if (!_apex) {
+		return 0;
+	}
+
+	for (auto rr : _apex->records) {
+		if (rr->type == TYPE_SOA) {
+			auto n = name_prefix(*rr);
+			if (n + 4 > rr->rdlen) break;
+			uint32_t serial;
+			::memcpy(&serial, rr->rdata + n, sizeof serial);
+			return ntohl(serial);
+		}
+	}
+
+	return 0;
+}
@@ -8,9 +8,12 @@
  */
 
 #include <cstdlib>
+#include <cstring>
 #include <iostream>
 #include <map>
 
+#include <arpa/inet.h>
+
 #include <unistd.h> // for getopt
 
 #include "benchmark.h"
@@ -18,13 +21,68 @@
 #include "queryfile.h"
 #include "zone.h"
 
-void worker(const Zone& zone, const QueryFile& queries)
+//
+// makes the (spoofed) client addresses used with rate limiting: a fixed
+// pool of the given number of sources, or if zero a fresh random IPv4
+// address for every query, as in a fully spoofed flood
+//
+class Sources {
+
+	std::vector<in6_addr> pool;
+	in6_addr	      addr{};
+	uint32_t	      state = 2463534242U;
+
+	void set(uint32_t a)
+	{
+		addr.s6_addr[10] = addr.s6_addr[11] = 0xff;
+		a = htonl(a);
+		::memcpy(&addr.s6_addr[12], &a, sizeof a);
+	}
+
+	uint32_t random()
+	{
+		state ^= state << 13;
+		state ^= state >> 17;
+		state ^= state << 5;
+		return state;
+	}
+
+public:
+	const in6_addr* next(size_t i)
+	{
+		if (pool.empty()) {
+			set(random());
+			return &addr;
+		} else {
+			return &pool[i % pool.size()];
+		}
+	}
+
+	Sources(size_t count)
+	{
+		for (size_t i = 0; i < count; ++i) {
+			set(random());
+			pool.push_back(addr);
+		}
+	}
+};
+
+void worker(const Zone& zone, const QueryFile& queries, size_t cache_size,
+	    const RateLimiter::Config& rrl_config, size_t sources, bool cookies, bool minimal)
 {
 	std::map<uint16_t, uint64_t> rcode_count;
 	std::map<bool, uint64_t>     tc_count;
 
+	ResponseCache cache(cache_size);
+	RateLimiter   rrl(rrl_config);
+	Sources	      clients(sources);
+	CookieSecret  secret;
+
+	bool limit = rrl_config.enabled();
+
 	{
-		Context ctx(zone);
+		Context ctx(zone, cache_size ? &cache : nullptr, limit ? &rrl : nullptr, nullptr,
+			    nullptr, cookies ? &secret : nullptr, UDPLimits(), minimal);
 
 		std::vector<iovec> iov;
 		iov.reserve(5);
@@ -37,7 +95,8 @@ void worker(const Zone& zone, const QueryFile& queries)
 				ReadBuffer in{q.data(), q.size()};
 				iov.clear();
 
-				(void)ctx.execute(in, iov);
+				auto client = (limit || cookies) ? clients.next(i) : nullptr;
+				(void)ctx.execute(in, iov, false, client);
 				if (iov.size() >= 1) {
 
 					auto p = reinterpret_cast<uint8_t*>(iov[0].iov_base);
@@ -59,36 +118,63 @@ void worker(const Zone& zone, const QueryFile& queries)
 	for (const auto it : tc_count) {
 		std::cerr << "tc " << it.first << " : " << it.second << std::endl;
 	}
+
+	if (cache_size) {
+		std::cerr << "cache hits : " << cache.hits() << std::endl;
+		std::cerr << "cache misses : " << cache.misses() << std::endl;
+	}
+
+	if (limit) {
+		std::cerr << "rrl dropped : " << rrl.dropped() << std::endl;
+		std::cerr << "rrl slipped : " << rrl.slipped() << std::endl;
+	}
 }
 
 void usage(int result = EXIT_FAILURE)
 {
 	using namespace std;
 
-	cout << "frootbench [-C] [-b <bufsize>] [-D]" << endl;
+	cout << "frootbench [-C] [-b <bufsize>] [-D] [-q <entries>] [-R <rrl>] [-F <sources>] [-K]"
+	     << " [-M]" << endl;
 	cout << "  -C disable compression" << endl;
 	cout << "  -U specify EDNS UDP buffer size" << endl;
 	cout << "  -D send DO bit (implies EDNS)" << endl;
+	cout << "  -q enable the response cache with the given size" << endl;
+	cout << "  -R enable rate limiting, e.g. 20 or responses=20,nxdomains=10" << endl;
+	cout << "  -F the number of spoofed sources (default: 0, random per query)" << endl;
+	cout << "  -K send client cookies and have the server add its own (implies EDNS)" << endl;
+	cout << "  -M send minimal responses" << endl;
 
 	exit(result);
 }
 
 int app(int argc, char* argv[])
 {
-	bool     compress = true;
 	bool     edns = false;
 	bool     do_bit = false;
+	bool     cookies = false;
+	bool     minimal = false;
 	uint16_t bufsize = 0;
+	size_t   cache_size = 0;
+	size_t   sources = 0;
+
+	RateLimiter::Config rrl_config;
+	ZoneOptions	    options;
 
 	int opt;
-	while ((opt = getopt(argc, argv, "CU:Xh")) != -1) {
+	while ((opt = getopt(argc, argv, "CU:Xq:R:F:KMh")) != -1) {
 		switch (opt) {
-		case 'C': compress = false; break;
+		case 'C': options.compress = false; break;
 		case 'U':
 			bufsize = atoi(optarg);
 			edns = true;
 			break;
 		case 'X': do_bit = true; break;
+		case 'q': cache_size = atoi(optarg); break;
+		case 'R': rrl_config = RateLimiter::Config::parse(optarg); break;
+		case 'F': sources = atoi(optarg); break;
+		case 'K': cookies = true; break;
+		case 'M': minimal = true; break;
 		case 'h': usage(EXIT_SUCCESS);
 		default: usage();
 		}
@@ -107,7 +193,7 @@ int app(int argc, char* argv[])
 
 	{
 		BenchmarkTimer t("load zone");
-		zone.load("root.zone", compress);
+		zone.load("root.zone", options);
 	}
 
 	{
@@ -115,12 +201,12 @@ int app(int argc, char* argv[])
 		queries.read_raw("default.raw");
 	}
 
-	if (edns || do_bit) {
+	if (edns || do_bit || cookies) {
 		BenchmarkTimer t("add EDNS RRs");
-		queries.edns(bufsize, (do_bit << 15));
+		queries.edns(bufsize, (do_bit << 15), cookies);
 	}
 
-	worker(zone, queries);
+	worker(zone, queries, cache_size, rrl_config, sources, cookies, minimal);
 
 	return 0;
 }
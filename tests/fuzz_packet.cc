@@ -45,7 +45,7 @@ int app(int argc, char* argv[])
 	const char* ifile = nullptr;
 	const char* ipaddr = nullptr;
 	uint16_t    port = 53;
-	auto	compress = true;
+	ZoneOptions options;
 
 	int opt;
 	while ((opt = getopt(argc, argv, "i:f:s:p:Ch")) != -1) {
@@ -54,7 +54,7 @@ int app(int argc, char* argv[])
 		case 'f': zfname = optarg; break;
 		case 's': ipaddr = optarg; break;
 		case 'p': port = atoi(optarg); break;
-		case 'C': compress = false; break;
+		case 'C': options.compress = false; break;
 		case 'h': usage(EXIT_SUCCESS);
 		default: usage();
 		}
@@ -71,7 +71,7 @@ int app(int argc, char* argv[])
 	}
 
 	DNSServer server;
-	server.load_sync(zfname, compress);
+	server.load_sync(zfname, options);
 
 	ether_addr hwaddr({0x00, 0x0c, 0x29, 0xda, 0x75, 0x9f});
 
@@ -25,13 +25,13 @@ void usage(int result = EXIT_FAILURE)
 int app(int argc, char* argv[])
 {
 	const char* zfname = "root.zone";
-	bool	compress = true;
+	ZoneOptions options;
 
 	int opt;
 	while ((opt = getopt(argc, argv, "f:Ch")) != -1) {
 		switch (opt) {
 		case 'f': zfname = optarg; break;
-		case 'C': compress = false; break;
+		case 'C': options.compress = false; break;
 		case 'h': usage(EXIT_SUCCESS);
 		default: usage();
 		}
@@ -43,7 +43,7 @@ int app(int argc, char* argv[])
 
 	try {
 		Zone zone;
-		zone.load(zfname, compress, false);
+		zone.load(zfname, options, false);
 	} catch (std::runtime_error& e) {
 		// ignore
 	}
@@ -150,7 +150,8 @@ void QueryFile::write_raw(const std::string& filename) const
 	file.close();
 }
 
-void QueryFile::edns(const uint16_t buflen, uint16_t flags)
+// optionally with a COOKIE option holding just a client cookie
+void QueryFile::edns(const uint16_t buflen, uint16_t flags, bool cookie)
 {
 	std::vector<uint8_t> opt = {
 	    0, // name
@@ -166,13 +167,19 @@ void QueryFile::edns(const uint16_t buflen, uint16_t flags)
 	    0 // rdlen = 0
 	};
 
+	if (cookie) {
+		std::vector<uint8_t> option = {0, 10, 0, 8, 0xc0, 0x0c, 0x1e, 0xc0, 0x0c, 0x1e, 0, 1};
+		opt.back() = option.size();
+		opt.insert(opt.end(), option.cbegin(), option.cend());
+	}
+
 	for (auto& query : queries) {
 
 		// adjust ARCOUNT
 		auto* p = reinterpret_cast<uint16_t*>(query.data());
 		p[5] = htons(ntohs(p[5]) + 1);
 
-		query.reserve(query.size() + 11);
+		query.reserve(query.size() + opt.size());
 		query.insert(query.end(), opt.cbegin(), opt.cend());
 	}
 }
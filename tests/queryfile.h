@@ -26,7 +26,7 @@ public:
 	void read_txt(const std::string& filename);
 	void read_raw(const std::string& filename);
 	void write_raw(const std::string& filename) const;
-	void edns(const uint16_t buflen, uint16_t flags);
+	void edns(const uint16_t buflen, uint16_t flags, bool cookie = false);
 
 public:
 	const Record& operator[](size_t n) const
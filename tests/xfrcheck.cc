@@ -0,0 +1,224 @@
+/*
+ * Copyright (C) Internet Systems Consortium, Inc. ("ISC")
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ */
+
+//
+// Exercises the zone transfer client against a primary server.  The
+// zone is refreshed the given number of times, so that changes made
+// on the primary in between arrive by IXFR, and the final result is
+// optionally compared with a master file, e.g. the one the primary is
+// then serving.
+//
+// Without -X it instead runs through a fixed series of transfers from
+// a built-in stand-in primary (see xfrprimary.h), checking each.
+//
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <thread>
+
+#include <syslog.h>
+#include <unistd.h> // for getopt
+
+#include "parser.h"
+#include "xfr.h"
+#include "xfrprimary.h"
+
+typedef std::vector<std::string> Wire;
+
+static Wire records(const ZoneData& zone)
+{
+	Wire result;
+	for (auto name : zone.names()) {
+		for (auto rr : name->records) {
+			result.push_back(ZoneData::rr_to_string(*rr));
+		}
+	}
+	std::sort(result.begin(), result.end());
+	return result;
+}
+
+static bool compare(const ZoneData& zone, const char* zfname)
+{
+	ZoneData expected;
+	ZoneParser parser(zfname);
+	parser.parse([&](const Record& rr) { expected.add(rr); });
+	expected.finish();
+
+	auto ok = records(zone) == records(expected);
+	std::cerr << (ok ? "matches " : "differs from ") << zfname << std::endl;
+
+	return ok;
+}
+
+static Wire records(const StandInPrimary::Version& version)
+{
+	ZoneData zone;
+	for (const auto& rr : version) {
+		auto p = reinterpret_cast<const uint8_t*>(rr.data());
+		auto n = ZoneData::name_length(p);
+
+		Record r;
+		r.owner = p;
+		r.type = (p[n] << 8) | p[n + 1];
+		r.klass = (p[n + 2] << 8) | p[n + 3];
+		r.ttl = 86400;
+		r.rdlen = (p[n + 8] << 8) | p[n + 9];
+		r.rdata = p + n + 10;
+		zone.add(r);
+	}
+	zone.finish();
+
+	return records(zone);
+}
+
+static bool check(bool ok, const char* what)
+{
+	std::cerr << (ok ? "ok: " : "FAILED: ") << what << std::endl;
+	return ok;
+}
+
+//
+// one transfer of each kind, and the handling of a zone that then
+// fails to load
+//
+static int self_test()
+{
+	typedef StandInPrimary P;
+
+	P::Version v1 = {P::soa(1),
+			 P::ns(".", "a.root-servers.net."),
+			 P::a("a.root-servers.net.", "198.41.0.4"),
+			 P::ns("com.", "a.gtld-servers.net."),
+			 P::a("a.gtld-servers.net.", "192.5.6.30"),
+			 P::ns("org.", "a0.org.afilias-nst.info.")};
+
+	// deletes org, adds net and changes an address
+	P::Version v2 = {P::soa(2),
+			 P::ns(".", "a.root-servers.net."),
+			 P::a("a.root-servers.net.", "198.41.0.4"),
+			 P::ns("com.", "a.gtld-servers.net."),
+			 P::a("a.gtld-servers.net.", "192.5.6.31"),
+			 P::ns("net.", "a.gtld-servers.net.")};
+
+	auto v3 = v2;
+	v3[0] = P::soa(3);
+	v3.push_back(P::ns("example.", "ns.example."));
+	v3.push_back(P::a("ns.example.", "192.0.2.1"));
+
+	StandInPrimary primary;
+	ZoneTransfer   xfr({ZoneTransfer::primary(primary.spec())});
+	bool	       ok = true;
+
+	typedef std::vector<uint16_t> Queries;
+	const uint16_t soa = 6, ixfr = 251, axfr = 252;
+
+	primary.publish(v1);
+	ok &= check(xfr.refresh() && records(*xfr.zone()) == records(v1) &&
+			primary.queries() == Queries{soa, axfr},
+		    "first transfer by AXFR over several messages");
+	xfr.commit();
+
+	ok &= check(!xfr.refresh() && primary.queries() == Queries{soa}, "serial unchanged");
+
+	primary.publish(v2);
+	ok &= check(xfr.refresh() && records(*xfr.zone()) == records(v2) &&
+			primary.queries() == Queries{soa, ixfr},
+		    "IXFR with the opening SOA in a message of its own");
+	xfr.commit();
+
+	primary.publish(v3, false);
+	ok &= check(xfr.refresh() && records(*xfr.zone()) == records(v3) &&
+			primary.queries() == Queries{soa, ixfr, axfr},
+		    "AXFR after a lone SOA in answer to IXFR");
+
+	// not committed, as if the zone failed to load
+	ok &= check(xfr.refresh() && records(*xfr.zone()) == records(v3) && xfr.serial() == 2,
+		    "uncommitted transfer repeated");
+	xfr.commit();
+
+	ok &= check(!xfr.refresh() && xfr.serial() == 3, "serial current once committed");
+
+	return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+void usage(int result = EXIT_FAILURE)
+{
+	using namespace std;
+
+	cout << "xfrcheck [-X <addr>[#port] [-f <zonefile>] [-n <count>] [-i <seconds>]]" << endl;
+	cout << "  without -X, checks transfers from a built-in stand-in primary" << endl;
+
+	exit(result);
+}
+
+int app(int argc, char* argv[])
+{
+	const char*			   zfname = nullptr;
+	std::vector<ZoneTransfer::Primary> primaries;
+	unsigned			   count = 1;
+	unsigned			   interval = 1;
+
+	int opt;
+	while ((opt = getopt(argc, argv, "X:f:n:i:h")) != -1) {
+		switch (opt) {
+		case 'X': primaries.push_back(ZoneTransfer::primary(optarg)); break;
+		case 'f': zfname = optarg; break;
+		case 'n': count = atoi(optarg); break;
+		case 'i': interval = atoi(optarg); break;
+		case 'h': usage(EXIT_SUCCESS);
+		default: usage();
+		}
+	}
+
+	if (optind < argc) {
+		usage();
+	}
+
+	openlog("xfrcheck", LOG_PERROR, LOG_USER);
+
+	if (primaries.empty()) {
+		return self_test();
+	}
+
+	ZoneTransfer xfr(primaries);
+
+	for (auto i = 0U; i < count; ++i) {
+		if (i) {
+			std::this_thread::sleep_for(std::chrono::seconds(interval));
+		}
+
+		if (!xfr.refresh()) {
+			std::cerr << "serial " << xfr.serial() << " unchanged" << std::endl;
+			continue;
+		}
+
+		auto zone = xfr.zone();
+		xfr.commit();
+		std::cerr << "serial " << xfr.serial() << ", " << zone->count() << " records"
+			  << std::endl;
+	}
+
+	if (zfname && !compare(*xfr.zone(), zfname)) {
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
+
+int main(int argc, char* argv[])
+{
+	try {
+		return app(argc, argv);
+	} catch (std::exception& e) {
+		std::cerr << e.what() << std::endl;
+		return EXIT_FAILURE;
+	}
+}
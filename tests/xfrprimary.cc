@@ -0,0 +1,354 @@
+/*
+ * Copyright (C) Internet Systems Consortium, Inc. ("ISC")
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <stdexcept>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "util.h"
+#include "xfrprimary.h"
+
+static const uint16_t type_a = 1;
+static const uint16_t type_ns = 2;
+static const uint16_t type_soa = 6;
+static const uint16_t type_ixfr = 251;
+static const uint16_t type_axfr = 252;
+
+static const size_t rrs_per_message = 3;
+
+static void put16(std::string& out, uint16_t v)
+{
+	out.push_back(v >> 8);
+	out.push_back(v & 0xff);
+}
+
+static void put32(std::string& out, uint32_t v)
+{
+	put16(out, v >> 16);
+	put16(out, v & 0xffff);
+}
+
+static uint16_t get16(const uint8_t* p)
+{
+	return (p[0] << 8) | p[1];
+}
+
+static uint32_t get32(const uint8_t* p)
+{
+	return (uint32_t(get16(p)) << 16) | get16(p + 2);
+}
+
+// the position after the uncompressed name at "pos"
+static size_t skip_name(const std::string& msg, size_t pos)
+{
+	while (pos < msg.size() && msg[pos]) {
+		pos += uint8_t(msg[pos]) + 1;
+	}
+	if (pos >= msg.size()) {
+		throw std::runtime_error("truncated query");
+	}
+	return pos + 1;
+}
+
+static uint32_t soa_serial(const std::string& rr)
+{
+	auto pos = skip_name(rr, 0) + 10;
+	pos = skip_name(rr, skip_name(rr, pos));
+	return get32(reinterpret_cast<const uint8_t*>(rr.data()) + pos);
+}
+
+static void read_fully(int fd, void* buf, size_t n)
+{
+	auto p = static_cast<uint8_t*>(buf);
+	while (n) {
+		auto r = ::read(fd, p, n);
+		if (r < 0 && errno == EINTR) {
+			continue;
+		} else if (r < 0) {
+			throw_errno("read");
+		} else if (r == 0) {
+			throw std::runtime_error("connection closed");
+		}
+		p += r;
+		n -= r;
+	}
+}
+
+static void write_fully(int fd, const std::string& data)
+{
+	size_t done = 0;
+	while (done < data.size()) {
+		// the client may have hung up, which mustn't kill the test
+		auto n = ::send(fd, data.data() + done, data.size() - done, MSG_NOSIGNAL);
+		if (n < 0 && errno == EINTR) {
+			continue;
+		} else if (n < 0) {
+			throw_errno("send");
+		}
+		done += n;
+	}
+}
+
+// --------------------------------------------------------------------
+
+std::string StandInPrimary::name(const std::string& text)
+{
+	std::string out;
+	size_t	    start = 0;
+	while (start < text.size()) {
+		auto dot = text.find('.', start);
+		if (dot == std::string::npos) {
+			dot = text.size();
+		}
+		if (dot > start) {
+			out.push_back(dot - start);
+			out.append(text, start, dot - start);
+		}
+		start = dot + 1;
+	}
+	out.push_back(0);
+	return out;
+}
+
+std::string StandInPrimary::rr(const std::string& owner, uint16_t type, const std::string& rdata)
+{
+	auto out = name(owner);
+	put16(out, type);
+	put16(out, 1); // IN
+	put32(out, 86400);
+	put16(out, rdata.size());
+	return out + rdata;
+}
+
+std::string StandInPrimary::soa(uint32_t serial)
+{
+	auto rdata = name("a.root-servers.net.") + name("nstld.verisign-grs.com.");
+	put32(rdata, serial);
+	put32(rdata, 1800);
+	put32(rdata, 900);
+	put32(rdata, 604800);
+	put32(rdata, 86400);
+	return rr(".", type_soa, rdata);
+}
+
+std::string StandInPrimary::ns(const std::string& owner, const std::string& target)
+{
+	return rr(owner, type_ns, name(target));
+}
+
+std::string StandInPrimary::a(const std::string& owner, const std::string& addr)
+{
+	in_addr in;
+	if (::inet_pton(AF_INET, addr.c_str(), &in) != 1) {
+		throw std::runtime_error("invalid address " + addr);
+	}
+	return rr(owner, type_a, std::string(reinterpret_cast<const char*>(&in), sizeof in));
+}
+
+// --------------------------------------------------------------------
+
+void StandInPrimary::publish(const Version& version, bool ixfr)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	versions.push_back(version);
+	incremental = ixfr;
+}
+
+std::vector<uint16_t> StandInPrimary::queries()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	std::vector<uint16_t>	    result;
+	result.swap(served);
+	return result;
+}
+
+std::string StandInPrimary::spec() const
+{
+	return "127.0.0.1#" + std::to_string(_port);
+}
+
+//
+// the messages answering a query, each a list of records.  "serial"
+// is the client's, for IXFR.
+//
+std::vector<StandInPrimary::Version> StandInPrimary::response(uint16_t qtype,
+							      uint32_t serial) const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	if (versions.empty()) {
+		throw std::runtime_error("nothing published");
+	}
+
+	const auto& latest = versions.back();
+	const auto& top = latest[0];
+	std::vector<Version> messages;
+
+	// the records in order, split over messages
+	auto split = [&](const Version& rrs, size_t from) {
+		for (auto i = from; i < rrs.size(); i += rrs_per_message) {
+			auto end = std::min(rrs.size(), i + rrs_per_message);
+			messages.emplace_back(rrs.begin() + i, rrs.begin() + end);
+		}
+	};
+
+	if (qtype == type_soa) {
+		messages.push_back({top});
+		return messages;
+	}
+
+	if (qtype == type_ixfr) {
+		auto old = std::find_if(versions.begin(), versions.end(),
+					[&](const Version& v) { return soa_serial(v[0]) == serial; });
+
+		// up to date, or unable to supply the changes
+		if (serial == soa_serial(top) || old == versions.end() || !incremental) {
+			messages.push_back({top});
+			return messages;
+		}
+
+		// the opening SOA alone, then one sequence of differences
+		Version diff = {top, (*old)[0]};
+		for (auto i = 1U; i < old->size(); ++i) {
+			if (std::find(latest.begin(), latest.end(), (*old)[i]) == latest.end()) {
+				diff.push_back((*old)[i]);
+			}
+		}
+		diff.push_back(top);
+		for (auto i = 1U; i < latest.size(); ++i) {
+			if (std::find(old->begin(), old->end(), latest[i]) == old->end()) {
+				diff.push_back(latest[i]);
+			}
+		}
+		diff.push_back(top);
+
+		messages.push_back({top});
+		split(diff, 1);
+		return messages;
+	}
+
+	// AXFR
+	auto all = latest;
+	all.push_back(top);
+	split(all, 0);
+	return messages;
+}
+
+void StandInPrimary::answer(int conn)
+{
+	uint8_t lenbuf[2];
+	read_fully(conn, lenbuf, 2);
+	std::string query(get16(lenbuf), '\0');
+	read_fully(conn, &query[0], query.size());
+
+	if (query.size() < 12 || get16(reinterpret_cast<const uint8_t*>(query.data()) + 4) != 1) {
+		throw std::runtime_error("malformed query");
+	}
+
+	auto q = reinterpret_cast<const uint8_t*>(query.data());
+	auto pos = skip_name(query, 12);
+	if (pos + 4 > query.size()) {
+		throw std::runtime_error("truncated query");
+	}
+	auto qtype = get16(q + pos);
+
+	// an IXFR carries the client's SOA in the authority section
+	uint32_t serial = 0;
+	if (qtype == type_ixfr) {
+		serial = soa_serial(query.substr(pos + 4));
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		served.push_back(qtype);
+	}
+
+	bool first = true;
+	for (const auto& rrs : response(qtype, serial)) {
+		std::string msg;
+		put16(msg, get16(q));
+		put16(msg, 0x8400); // QR, AA
+		put16(msg, 1);
+		put16(msg, rrs.size());
+		put16(msg, 0);
+		put16(msg, 0);
+		msg += query.substr(12, pos + 4 - 12);
+		for (const auto& rr : rrs) {
+			msg += rr;
+		}
+
+		std::string framed;
+		put16(framed, msg.size());
+		write_fully(conn, framed + msg);
+
+		// so that the client really does see the first message alone
+		if (first && qtype == type_ixfr) {
+			std::this_thread::sleep_for(std::chrono::milliseconds(50));
+		}
+		first = false;
+	}
+}
+
+void StandInPrimary::run()
+{
+	while (!stop) {
+		pollfd pfd = {fd, POLLIN, 0};
+		if (::poll(&pfd, 1, 100) <= 0) {
+			continue;
+		}
+
+		int conn = ::accept(fd, nullptr, nullptr);
+		if (conn < 0) {
+			continue;
+		}
+
+		// a failed exchange is for the client to notice
+		try {
+			answer(conn);
+		} catch (std::exception&) {
+		}
+		::close(conn);
+	}
+}
+
+StandInPrimary::StandInPrimary()
+{
+	fd = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0) {
+		throw_errno("socket");
+	}
+
+	sockaddr_in addr = {};
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	socklen_t len = sizeof addr;
+
+	if (::bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof addr) < 0 ||
+	    ::listen(fd, 4) < 0 || ::getsockname(fd, reinterpret_cast<sockaddr*>(&addr), &len) < 0) {
+		::close(fd);
+		throw_errno("stand-in primary");
+	}
+	_port = ntohs(addr.sin_port);
+
+	thread = std::thread(&StandInPrimary::run, this);
+}
+
+StandInPrimary::~StandInPrimary()
+{
+	stop = true;
+	thread.join();
+	::close(fd);
+}
@@ -0,0 +1,71 @@
+/*
+ * Copyright (C) Internet Systems Consortium, Inc. ("ISC")
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+//
+// A stand-in primary server for the root zone on a loopback port, for
+// testing ZoneTransfer.  It serves whichever version of the zone was
+// last published: the SOA alone, an AXFR split over several messages,
+// or an IXFR from any earlier version with the opening SOA sent alone
+// in the first message.  If IXFR is disabled it answers an IXFR for
+// an older serial with just its SOA, as a primary that can't supply
+// the changes does.
+//
+class StandInPrimary {
+
+public:
+	// uncompressed wire format records, the SOA first
+	typedef std::vector<std::string> Version;
+
+	// builders for the records of a version
+	static std::string name(const std::string& text);
+	static std::string rr(const std::string& owner, uint16_t type, const std::string& rdata);
+	static std::string soa(uint32_t serial);
+	static std::string ns(const std::string& owner, const std::string& target);
+	static std::string a(const std::string& owner, const std::string& addr);
+
+private:
+	std::vector<Version>  versions; // every one published, in order
+	bool		      incremental = true;
+	std::vector<uint16_t> served; // the QTYPE of each query answered
+	mutable std::mutex    mutex;
+
+	int		  fd = -1;
+	uint16_t	  _port = 0;
+	std::atomic<bool> stop{false};
+	std::thread	  thread;
+
+	void run();
+	void answer(int conn);
+	std::vector<Version> response(uint16_t qtype, uint32_t serial) const;
+
+public:
+	void publish(const Version& version, bool ixfr = true);
+
+	// the QTYPEs of the queries answered since the last call
+	std::vector<uint16_t> queries();
+
+	// as given to ZoneTransfer::primary()
+	std::string spec() const;
+
+public:
+	StandInPrimary();
+	~StandInPrimary();
+
+	StandInPrimary(const StandInPrimary&) = delete;
+	StandInPrimary& operator=(const StandInPrimary&) = delete;
+};
@@ -0,0 +1,170 @@
+/*
+ * Copyright (C) Internet Systems Consortium, Inc. ("ISC")
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ */
+
+//
+// Loads a master file with both ldns and froot's own parser, reports
+// the time taken by each and checks that they produce exactly the same
+// records at every owner name, and agree on which names are glue.
+//
+
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+
+#include <unistd.h> // for getopt
+
+#include <ldns/ldns.h>
+
+#include "benchmark.h"
+#include "parser.h"
+#include "util.h"
+
+typedef std::vector<std::string> Wire;
+
+static void append(Wire& out, const ldns_rr* rr)
+{
+	auto lbuf = ldns_buffer_new(4096);
+	ldns_rr2buffer_wire(lbuf, rr, LDNS_SECTION_ANSWER);
+	auto p = reinterpret_cast<const char*>(ldns_buffer_begin(lbuf));
+	out.emplace_back(p, ldns_buffer_position(lbuf));
+	ldns_buffer_free(lbuf);
+}
+
+static void append(Wire& out, const ldns_dnssec_rrs* rrs)
+{
+	for (; rrs; rrs = rrs->next) {
+		append(out, rrs->rr);
+	}
+}
+
+static size_t compare(const ldns_dnssec_zone* lzone, const ZoneData& zone)
+{
+	size_t errors = 0;
+	size_t names = 0;
+
+	auto node = ldns_rbtree_first(lzone->names);
+	while (node != LDNS_RBTREE_NULL) {
+		auto name = reinterpret_cast<const ldns_dnssec_name*>(node->data);
+		auto owner = ldns_rdf_data(name->name);
+		node = ldns_rbtree_next(node);
+		++names;
+
+		Wire expected;
+		for (auto rrset = name->rrsets; rrset; rrset = rrset->next) {
+			append(expected, rrset->rrs);
+			append(expected, rrset->signatures);
+		}
+		append(expected, name->nsec);
+		append(expected, name->nsec_signatures);
+
+		auto ours = zone.find(owner);
+		if (!ours) {
+			std::cerr << "missing name: " << ldns_rdf2str(name->name) << std::endl;
+			++errors;
+			continue;
+		}
+
+		Wire actual;
+		for (auto rr : ours->records) {
+			actual.push_back(ZoneData::rr_to_string(*rr));
+		}
+
+		std::sort(expected.begin(), expected.end());
+		std::sort(actual.begin(), actual.end());
+
+		if (expected != actual) {
+			std::cerr << "records differ at: " << ldns_rdf2str(name->name) << std::endl;
+			++errors;
+		}
+
+		if (ldns_dnssec_name_is_glue(const_cast<ldns_dnssec_name*>(name)) != ours->glue) {
+			std::cerr << "glue differs at: " << ldns_rdf2str(name->name) << std::endl;
+			++errors;
+		}
+	}
+
+	if (names != zone.names().size()) {
+		std::cerr << "name count differs: " << names << " vs " << zone.names().size()
+			  << std::endl;
+		++errors;
+	}
+
+	return errors;
+}
+
+void usage(int result = EXIT_FAILURE)
+{
+	using namespace std;
+
+	cout << "zonecheck [-f <zonefile>]" << endl;
+
+	exit(result);
+}
+
+int app(int argc, char* argv[])
+{
+	const char* zfname = "root.zone";
+
+	int opt;
+	while ((opt = getopt(argc, argv, "f:h")) != -1) {
+		switch (opt) {
+		case 'f': zfname = optarg; break;
+		case 'h': usage(EXIT_SUCCESS);
+		default: usage();
+		}
+	}
+
+	if (optind < argc) {
+		usage();
+	}
+
+	ZoneData zone;
+	{
+		BenchmarkTimer t("froot parse");
+		ZoneParser parser(zfname);
+		parser.parse([&](const Record& rr) { zone.add(rr); });
+		zone.finish();
+	}
+
+	ldns_dnssec_zone* lzone = nullptr;
+	{
+		BenchmarkTimer t("ldns parse");
+		auto origin = ldns_dname_new_frm_str(".");
+		auto fp = ::fopen(zfname, "r");
+		if (!fp) {
+			throw_errno("opening zone file");
+		}
+		auto status = ldns_dnssec_zone_new_frm_fp(&lzone, fp, origin, 3600, LDNS_RR_CLASS_IN);
+		::fclose(fp);
+		ldns_rdf_deep_free(origin);
+		if (status != LDNS_STATUS_OK || !lzone) {
+			throw std::runtime_error("ldns zone load failed");
+		}
+		ldns_dnssec_zone_mark_glue(lzone);
+	}
+
+	auto errors = compare(lzone, zone);
+	ldns_dnssec_zone_deep_free(lzone);
+
+	std::cerr << zone.count() << " records, " << zone.names().size() << " names, " << errors
+		  << " differences" << std::endl;
+
+	return errors ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+int main(int argc, char* argv[])
+{
+	try {
+		return app(argc, argv);
+	} catch (std::exception& e) {
+		std::cerr << e.what() << std::endl;
+		return EXIT_FAILURE;
+	}
+}